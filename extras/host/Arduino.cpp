@@ -0,0 +1,256 @@
+/**
+ * Minimal Arduino core replacement for building the library on a Linux host.
+ *
+ * Copyright (c) 2018 Sparkbit Co., Ltd. All rights reserved.
+ *
+ * This work is licensed under the terms of the MIT license.
+ * See LICENSE file in the project root for details.
+ */
+
+#include "Arduino.h"
+
+HostSerial Serial;
+
+// ----------------------------------------
+//   Virtual clock
+// ----------------------------------------
+static uint64_t clockMicros = 0;
+
+void hostAdvanceMicros(uint64_t us) {
+    clockMicros += us;
+}
+
+uint64_t hostMicros() {
+    return clockMicros;
+}
+
+unsigned long millis() {
+    return (unsigned long)(clockMicros / 1000);
+}
+
+unsigned long micros() {
+    return (unsigned long)clockMicros;
+}
+
+void delay(unsigned long ms) {
+    clockMicros += (uint64_t)ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us) {
+    clockMicros += us;
+}
+
+// ----------------------------------------
+//   GPIO / misc
+// ----------------------------------------
+void pinMode(uint8_t pin, uint8_t mode) {
+    (void)pin;
+    (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+    (void)pin;
+    (void)val;
+}
+
+int digitalRead(uint8_t pin) {
+    (void)pin;
+    return LOW;
+}
+
+int analogRead(uint8_t pin) {
+    (void)pin;
+    return 0;
+}
+
+static unsigned long randomState = 1;
+
+long random(long howbig) {
+    if (howbig <= 0) {
+        return 0;
+    }
+
+    // xorshift, deterministic across runs
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+
+    return (long)(randomState % (unsigned long)howbig);
+}
+
+long random(long howsmall, long howbig) {
+    if (howsmall >= howbig) {
+        return howsmall;
+    }
+
+    return howsmall + random(howbig - howsmall);
+}
+
+void randomSeed(unsigned long seed) {
+    if (seed != 0) {
+        randomState = seed;
+    }
+}
+
+// ----------------------------------------
+//   String
+// ----------------------------------------
+String::String(const char *str) {
+    _len = str ? strlen(str) : 0;
+    _buf = (char *)malloc(_len + 1);
+    memcpy(_buf, str ? str : "", _len + 1);
+}
+
+String::String(const String &other) : String(other.c_str()) {}
+
+String::~String() {
+    free(_buf);
+}
+
+String& String::operator=(const String &other) {
+    if (this != &other) {
+        free(_buf);
+        _len = other._len;
+        _buf = (char *)malloc(_len + 1);
+        memcpy(_buf, other._buf, _len + 1);
+    }
+
+    return *this;
+}
+
+bool String::operator==(const char *str) const {
+    return strcmp(_buf, str ? str : "") == 0;
+}
+
+// ----------------------------------------
+//   Print
+// ----------------------------------------
+size_t Print::write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+
+    while (size--) {
+        if (write(*buffer++) == 0) {
+            break;
+        }
+        n++;
+    }
+
+    return n;
+}
+
+size_t Print::_printNumber(unsigned long n, uint8_t base) {
+    char buf[8 * sizeof(long) + 1];
+    char *str = &buf[sizeof(buf) - 1];
+
+    *str = '\0';
+
+    if (base < 2) {
+        base = 10;
+    }
+
+    do {
+        char c = n % base;
+        n /= base;
+        *--str = c < 10 ? c + '0' : c + 'A' - 10;
+    } while (n);
+
+    return write(str);
+}
+
+size_t Print::print(const __FlashStringHelper *ifsh) { return write((const char *)ifsh); }
+size_t Print::print(const String &s) { return write(s.c_str(), s.length()); }
+size_t Print::print(const char s[]) { return write(s); }
+size_t Print::print(char c) { return write((uint8_t)c); }
+size_t Print::print(unsigned char b, int base) { return print((unsigned long)b, base); }
+size_t Print::print(int n, int base) { return print((long)n, base); }
+size_t Print::print(unsigned int n, int base) { return print((unsigned long)n, base); }
+
+size_t Print::print(long n, int base) {
+    if (base == 10 && n < 0) {
+        return print('-') + _printNumber(-n, 10);
+    }
+
+    return _printNumber(n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+    return _printNumber(n, base);
+}
+
+size_t Print::print(double n, int digits) {
+    char buf[48];
+    return write(buf, snprintf(buf, sizeof(buf), "%.*f", digits, n));
+}
+
+size_t Print::print(const Printable &x) { return x.printTo(*this); }
+
+size_t Print::println(const __FlashStringHelper *ifsh) { return print(ifsh) + println(); }
+size_t Print::println(const String &s) { return print(s) + println(); }
+size_t Print::println(const char s[]) { return print(s) + println(); }
+size_t Print::println(char c) { return print(c) + println(); }
+size_t Print::println(unsigned char b, int base) { return print(b, base) + println(); }
+size_t Print::println(int n, int base) { return print(n, base) + println(); }
+size_t Print::println(unsigned int n, int base) { return print(n, base) + println(); }
+size_t Print::println(long n, int base) { return print(n, base) + println(); }
+size_t Print::println(unsigned long n, int base) { return print(n, base) + println(); }
+size_t Print::println(double n, int digits) { return print(n, digits) + println(); }
+size_t Print::println(const Printable &x) { return print(x) + println(); }
+size_t Print::println(void) { return write("\r\n"); }
+
+// ----------------------------------------
+//   Stream
+// ----------------------------------------
+int Stream::timedRead() {
+    unsigned long startMillis = millis();
+    int c;
+
+    do {
+        c = read();
+        if (c >= 0) {
+            return c;
+        }
+    } while (millis() - startMillis < _timeout);
+
+    return -1;
+}
+
+size_t Stream::readBytes(char *buffer, size_t length) {
+    size_t count = 0;
+
+    while (count < length) {
+        int c = timedRead();
+        if (c < 0) {
+            break;
+        }
+        *buffer++ = (char)c;
+        count++;
+    }
+
+    return count;
+}
+
+size_t Stream::readBytesUntil(char terminator, char *buffer, size_t length) {
+    size_t index = 0;
+
+    while (index < length) {
+        int c = timedRead();
+        if (c < 0 || c == terminator) {
+            break;
+        }
+        *buffer++ = (char)c;
+        index++;
+    }
+
+    return index;
+}
+
+// ----------------------------------------
+//   Serial (stdout)
+// ----------------------------------------
+size_t HostSerial::write(uint8_t b) {
+    return fwrite(&b, 1, 1, stdout);
+}
+
+size_t HostSerial::write(const uint8_t *buffer, size_t size) {
+    return fwrite(buffer, 1, size, stdout);
+}
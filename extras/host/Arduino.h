@@ -0,0 +1,176 @@
+/**
+ * Minimal Arduino core replacement for building the library on a Linux host.
+ *
+ * Only the subset used by the BC95 driver and the host tools is provided.
+ * Time is virtual: millis()/micros() return a simulated clock that is
+ * advanced by delay() and by the host-side stream implementations, so
+ * the driver's timeout loops behave as they would on a real board.
+ *
+ * Copyright (c) 2018 Sparkbit Co., Ltd. All rights reserved.
+ *
+ * This work is licensed under the terms of the MIT license.
+ * See LICENSE file in the project root for details.
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HIGH    1
+#define LOW     0
+#define INPUT   0
+#define OUTPUT  1
+
+#define DEC  10
+#define HEX  16
+#define OCT  8
+#define BIN  2
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+class __FlashStringHelper;
+#define F(str)  (reinterpret_cast<const __FlashStringHelper *>(str))
+
+// ----------------------------------------
+//   Virtual clock
+// ----------------------------------------
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// advance the virtual clock, used by the host streams to account for wire time
+void hostAdvanceMicros(uint64_t us);
+uint64_t hostMicros();
+
+// ----------------------------------------
+//   GPIO / misc
+// ----------------------------------------
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+// ----------------------------------------
+//   String
+// ----------------------------------------
+class String {
+    public:
+        String(const char *str = "");
+        String(const String &other);
+        ~String();
+
+        String& operator=(const String &other);
+        bool operator==(const char *str) const;
+
+        const char *c_str() const { return _buf; }
+        unsigned int length() const { return _len; }
+
+    private:
+        char *_buf;
+        unsigned int _len;
+};
+
+// ----------------------------------------
+//   Print / Stream
+// ----------------------------------------
+class Print;
+
+class Printable {
+    public:
+        virtual ~Printable() {}
+        virtual size_t printTo(Print &p) const = 0;
+};
+
+class Print {
+    public:
+        virtual ~Print() {}
+
+        virtual size_t write(uint8_t b) = 0;
+        virtual size_t write(const uint8_t *buffer, size_t size);
+        virtual int availableForWrite() { return 0; }
+        virtual void flush() {}
+
+        size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+        size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+
+        size_t print(const __FlashStringHelper *ifsh);
+        size_t print(const String &s);
+        size_t print(const char s[]);
+        size_t print(char c);
+        size_t print(unsigned char b, int base = DEC);
+        size_t print(int n, int base = DEC);
+        size_t print(unsigned int n, int base = DEC);
+        size_t print(long n, int base = DEC);
+        size_t print(unsigned long n, int base = DEC);
+        size_t print(double n, int digits = 2);
+        size_t print(const Printable &x);
+
+        size_t println(const __FlashStringHelper *ifsh);
+        size_t println(const String &s);
+        size_t println(const char s[]);
+        size_t println(char c);
+        size_t println(unsigned char b, int base = DEC);
+        size_t println(int n, int base = DEC);
+        size_t println(unsigned int n, int base = DEC);
+        size_t println(long n, int base = DEC);
+        size_t println(unsigned long n, int base = DEC);
+        size_t println(double n, int digits = 2);
+        size_t println(const Printable &x);
+        size_t println(void);
+
+    private:
+        size_t _printNumber(unsigned long n, uint8_t base);
+};
+
+class Stream : public Print {
+    public:
+        Stream() : _timeout(1000) {}
+
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+
+        void setTimeout(unsigned long timeout) { _timeout = timeout; }
+        unsigned long getTimeout() { return _timeout; }
+
+        size_t readBytes(char *buffer, size_t length);
+        size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+        size_t readBytesUntil(char terminator, char *buffer, size_t length);
+
+    protected:
+        unsigned long _timeout;
+
+        int timedRead();
+};
+
+// ----------------------------------------
+//   Serial (stdout)
+// ----------------------------------------
+class HostSerial : public Stream {
+    public:
+        void begin(unsigned long baud) { (void)baud; }
+        void end() {}
+
+        int available() { return 0; }
+        int read() { return -1; }
+        int peek() { return -1; }
+
+        size_t write(uint8_t b);
+        size_t write(const uint8_t *buffer, size_t size);
+        using Print::write;
+};
+
+extern HostSerial Serial;
+
+#endif  /* HOST_ARDUINO_H */
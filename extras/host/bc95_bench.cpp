@@ -0,0 +1,555 @@
+/**
+ * Host-side throughput and latency benchmark for QuectelBC95::Modem.
+ *
+ * Runs the driver against BC95Emulator and reports, per phase, datagrams
+ * per (simulated) second, bytes on the wire and per-call latency for
+ * sendUDPDatagram() and receiveUDPDatagram(). Latencies are measured on
+ * the virtual clock, i.e. they include UART wire time and the emulated
+ * modem processing delay. Host CPU time and Stream::write() calls per call
+ * are reported separately.
+ *
+ * The receive phase includes the time to notice the +NSONMI notification.
+ * The async phase queues the same datagrams with sendUDPDatagramAsync()
+ * and reports how long a single poll() holds the caller. The release phase
+ * sends request/reply exchanges with and without the AT+NSOSTF release
+ * assistance flag and reports the time the emulated radio stays in RRC
+ * connected state per exchange. The inline phase repeats the receive phase
+ * on firmware that delivers the datagram with +NSONMI (AT+NSONMI=2), which
+ * needs BC95_INLINE_RX_BUF_LEN on the host. The nidd phase repeats the send
+ * phase as non-IP data over the control plane (AT+CSODCP). The delivery
+ * phase numbers the async datagrams and reports the time until +NSOSTR
+ * confirms each one, with every fourth reported as not sent. The stream phase
+ * parses AT+NSORF responses from a HostPipe and reports the driver's CPU
+ * cost per received byte, through Stream and, when the build names HostPipe
+ * as BC95_MODEM_STREAM_TYPE, through BasicModem<HostPipe>. Built with
+ * -DBC95_COMMAND_STATS it also prints the driver's own per command class
+ * latency histograms.
+ *
+ * Copyright (c) 2018 Sparkbit Co., Ltd. All rights reserved.
+ *
+ * This work is licensed under the terms of the MIT license.
+ * See LICENSE file in the project root for details.
+ */
+
+#include <Arduino.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "bc95/quectel_bc95.h"
+#include "bc95_emulator.h"
+#include "host_pipe.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+#endif
+
+#define BENCH_REMOTE_ADDR  "52.220.84.189"
+#define BENCH_REMOTE_PORT  5683
+#define BENCH_LOCAL_PORT   56830
+#define BENCH_REPLY_DELAY  300  // ms between uplink and its downlink reply
+#define BENCH_STREAM_REPS  100  // stream phase calls per datagram of the other phases
+#define BENCH_DELIVERY_DELAY_US  400000  // uplink accepted until its +NSOSTR
+
+typedef struct {
+    const char *name;
+    uint32_t calls;
+    uint32_t failures;
+    uint64_t payloadBytes;
+    uint64_t txWireBytes;
+    uint64_t rxWireBytes;
+    uint64_t writeCalls;
+    uint64_t totalMicros;
+    uint64_t minMicros;
+    uint64_t maxMicros;
+    uint64_t cpuNanos;
+} bench_result_t;
+
+static uint64_t cpuNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// TSC ticks, nanoseconds where there is no cycle counter
+static uint64_t cpuCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return cpuNanos();
+#endif
+}
+
+static void beginPhase(bench_result_t *r, const char *name) {
+    memset(r, 0, sizeof(bench_result_t));
+    r->name = name;
+    r->minMicros = UINT64_MAX;
+}
+
+static void recordCall(bench_result_t *r, uint64_t elapsedMicros, uint64_t elapsedCpu, bool ok, size_t payloadLen) {
+    r->calls++;
+    r->totalMicros += elapsedMicros;
+    r->cpuNanos += elapsedCpu;
+
+    if (elapsedMicros < r->minMicros) { r->minMicros = elapsedMicros; }
+    if (elapsedMicros > r->maxMicros) { r->maxMicros = elapsedMicros; }
+
+    if (ok) {
+        r->payloadBytes += payloadLen;
+    }
+    else {
+        r->failures++;
+    }
+}
+
+static void printResult(const bench_result_t *r) {
+    double seconds = r->totalMicros / 1e6;
+    uint32_t ok = r->calls - r->failures;
+
+    printf("%-8s calls=%u ok=%u dgram/s=%.2f payload=%llu B wire_tx=%llu B wire_rx=%llu B "
+           "lat_avg=%.2f ms lat_min=%.2f ms lat_max=%.2f ms cpu=%.2f us/call writes=%.1f/call\n",
+        r->name,
+        r->calls,
+        ok,
+        seconds > 0 ? ok / seconds : 0.0,
+        (unsigned long long)r->payloadBytes,
+        (unsigned long long)r->txWireBytes,
+        (unsigned long long)r->rxWireBytes,
+        r->calls ? (r->totalMicros / 1000.0) / r->calls : 0.0,
+        r->calls ? r->minMicros / 1000.0 : 0.0,
+        r->maxMicros / 1000.0,
+        r->calls ? (r->cpuNanos / 1000.0) / r->calls : 0.0,
+        r->calls ? (double)r->writeCalls / r->calls : 0.0);
+}
+
+static uint32_t asyncCompleted;
+static uint32_t asyncFailed;
+
+static void onAsyncSent(int rspType, const char *rspBuf, size_t rspLen, void *arg) {
+    (void)rspBuf;
+    (void)rspLen;
+    (void)arg;
+
+    asyncCompleted++;
+
+    if (rspType != BC95_RESPONSE_TYPE_OK) {
+        asyncFailed++;
+    }
+}
+
+static uint32_t deliveriesSent;
+static uint32_t deliveriesFailed;
+static uint64_t deliveryReportedAt;
+
+static void onDelivery(uint8_t socket, uint8_t sequence, uint8_t status, void *arg) {
+    (void)socket;
+    (void)sequence;
+    (void)arg;
+
+    deliveryReportedAt = hostMicros();
+
+    if (status == BC95_DELIVERY_SENT) {
+        deliveriesSent++;
+    }
+    else {
+        deliveriesFailed++;
+    }
+}
+
+// queues a downlink, waits for it to be announced and reads it
+static void runReceivePhase(bench_result_t *r, const char *name, BC95Emulator *emu, QuectelBC95::Modem *modem, int8_t socket,
+                            const uint8_t *txBuf, uint8_t *rxBuf, size_t rxBufLen, size_t payloadLen, unsigned int count) {
+    bc95_emu_stats_t s0;
+    uint64_t t0, c0;
+
+    beginPhase(r, name);
+    s0 = emu->stats();
+
+    for (unsigned int i = 0 ; i < count ; i++) {
+        QuectelBC95::udp_rx_data_t rx;
+
+        emu->queueDownlink(socket, BENCH_REMOTE_ADDR, BENCH_REMOTE_PORT, txBuf, payloadLen);
+
+        t0 = hostMicros();
+        c0 = cpuNanos();
+
+        // wait for +NSONMI, then read
+        while (modem->pendingUDPDataLength(socket) == 0) {
+            modem->poll();
+        }
+
+        size_t received = modem->receiveUDPDatagram(socket, rxBuf, rxBufLen, &rx);
+        bool ok = received == payloadLen && memcmp(rxBuf, txBuf, payloadLen) == 0;
+
+        recordCall(r, hostMicros() - t0, cpuNanos() - c0, ok, payloadLen);
+    }
+
+    r->txWireBytes = emu->stats().txBytes - s0.txBytes;
+    r->rxWireBytes = emu->stats().rxBytes - s0.rxBytes;
+    r->writeCalls = emu->stats().writeCalls - s0.writeCalls;
+    printResult(r);
+}
+
+// the same AT+NSORF response read over and over, nothing but the driver's
+// parsing and stream calls is measured
+template<typename TModem>
+static void runStreamPhase(const char *name, TModem *modem, HostPipe *pipe, const uint8_t *rsp, size_t rspLen,
+                           const uint8_t *payload, size_t payloadLen, unsigned int reps) {
+    static uint8_t rxBuf[BC95_NSOST_MAX_DATA_LEN];
+    QuectelBC95::udp_rx_data_t rx;
+    uint64_t cycles = 0;
+    uint32_t failures = 0;
+    uint64_t c0 = cpuNanos();
+
+    for (unsigned int i = 0 ; i < reps ; i++) {
+        pipe->setReply(rsp, rspLen);
+
+        uint64_t t0 = cpuCycles();
+
+        if (modem->receiveUDPDatagram(0, rxBuf, sizeof(rxBuf), &rx) != payloadLen || memcmp(rxBuf, payload, payloadLen) != 0) {
+            failures++;
+        }
+
+        cycles += cpuCycles() - t0;
+    }
+
+    uint64_t nanos = cpuNanos() - c0;
+
+    printf("%-8s reps=%u failures=%u rx=%u B/call cycles/byte=%.2f ns/byte=%.2f\n",
+        name,
+        reps,
+        failures,
+        (unsigned int)rspLen,
+        (double)cycles / ((double)rspLen * reps),
+        (double)nanos / ((double)rspLen * reps));
+}
+
+#ifdef BC95_COMMAND_STATS
+static void printDriverStats(QuectelBC95::Modem *modem) {
+    static const char *const classNames[BC95_STATS_CLASS_COUNT] = { "NSOST", "NSORF", "socket", "NPING", "other" };
+    QuectelBC95::modem_stats_t stats;
+
+    modem->readStats(&stats);
+
+    printf("driver   idle_rx=%u B datagrams_received=%u nsorf/datagram=%.2f\n",
+        stats.idleRxBytes,
+        stats.datagramsReceived,
+        stats.datagramsReceived ? (double)stats.commands[BC95_STATS_CLASS_NSORF].count / stats.datagramsReceived : 0.0);
+
+    for (int c = 0 ; c < BC95_STATS_CLASS_COUNT ; c++) {
+        const QuectelBC95::command_stats_t *cs = &stats.commands[c];
+
+        if (cs->count == 0) {
+            continue;
+        }
+
+        printf("  %-6s count=%u failures=%u avg=%.2f ms max=%u ms tx=%u B rx=%u B hist(<2^i ms)=",
+            classNames[c],
+            cs->count,
+            cs->failures,
+            (double)cs->totalMillis / cs->count,
+            cs->maxMillis,
+            cs->txBytes,
+            cs->rxBytes);
+
+        for (int i = 0 ; i < BC95_STATS_HISTOGRAM_LEN ; i++) {
+            printf("%s%u", i ? "," : "", cs->histogram[i]);
+        }
+
+        printf("\n");
+    }
+}
+#endif
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [-b baud] [-d command_delay_us] [-n count] [-s payload_size]\n"
+        "  -b  UART baud rate (default 9600)\n"
+        "  -d  modem command processing delay in microseconds (default 2000)\n"
+        "  -n  datagrams per phase (default 20)\n"
+        "  -s  payload size in bytes, 1..512 (default 128)\n",
+        prog);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long baud = BC95_EMU_DEFAULT_BAUD;
+    unsigned long commandDelay = BC95_EMU_DEFAULT_COMMAND_DELAY_US;
+    unsigned int count = 20;
+    size_t payloadLen = 128;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:d:n:s:h")) != -1) {
+        switch (opt) {
+            case 'b': baud = strtoul(optarg, NULL, 10); break;
+            case 'd': commandDelay = strtoul(optarg, NULL, 10); break;
+            case 'n': count = strtoul(optarg, NULL, 10); break;
+            case 's': payloadLen = strtoul(optarg, NULL, 10); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (baud == 0 || payloadLen == 0 || payloadLen > BC95_NSOST_MAX_DATA_LEN) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    static uint8_t txBuf[BC95_NSOST_MAX_DATA_LEN];
+    static uint8_t rxBuf[BC95_NSOST_MAX_DATA_LEN];
+
+    for (size_t i = 0 ; i < payloadLen ; i++) {
+        txBuf[i] = (uint8_t)(i * 7 + 3);
+    }
+
+    BC95Emulator emu;
+    emu.begin(baud);
+    emu.setBaudRate(baud);
+    emu.setCommandDelay(commandDelay);
+
+    QuectelBC95::Modem modem(&emu);
+
+    int8_t socket = modem.createSocket(BENCH_LOCAL_PORT, true);
+    if (socket < 0) {
+        fprintf(stderr, "failed to create socket\n");
+        return 1;
+    }
+
+    printf("baud=%lu command_delay=%lu us count=%u payload=%u B\n", baud, commandDelay, count, (unsigned int)payloadLen);
+
+    bench_result_t r;
+    uint64_t t0, c0;
+    bc95_emu_stats_t s0;
+
+    // uplink
+    beginPhase(&r, "send");
+    s0 = emu.stats();
+
+    for (unsigned int i = 0 ; i < count ; i++) {
+        t0 = hostMicros();
+        c0 = cpuNanos();
+
+        size_t sent = modem.sendUDPDatagram(socket, BENCH_REMOTE_ADDR, BENCH_REMOTE_PORT, txBuf, payloadLen);
+
+        recordCall(&r, hostMicros() - t0, cpuNanos() - c0, sent == payloadLen, payloadLen);
+    }
+
+    r.txWireBytes = emu.stats().txBytes - s0.txBytes;
+    r.rxWireBytes = emu.stats().rxBytes - s0.rxBytes;
+    r.writeCalls = emu.stats().writeCalls - s0.writeCalls;
+    printResult(&r);
+
+    // downlink
+    runReceivePhase(&r, "receive", &emu, &modem, socket, txBuf, rxBuf, sizeof(rxBuf), payloadLen, count);
+
+    // the cost of checking for downlink data when nothing has arrived,
+    // NSORF is only issued once +NSONMI has announced data
+    beginPhase(&r, "poll");
+    s0 = emu.stats();
+
+    for (unsigned int i = 0 ; i < count ; i++) {
+        QuectelBC95::udp_rx_data_t rx;
+        size_t received = 0;
+
+        t0 = hostMicros();
+        c0 = cpuNanos();
+
+        modem.poll();
+
+        if (modem.pendingUDPDataLength(socket) > 0) {
+            received = modem.receiveUDPDatagram(socket, rxBuf, sizeof(rxBuf), &rx);
+        }
+
+        recordCall(&r, hostMicros() - t0, cpuNanos() - c0, received == 0, 0);
+    }
+
+    r.txWireBytes = emu.stats().txBytes - s0.txBytes;
+    r.rxWireBytes = emu.stats().rxBytes - s0.rxBytes;
+    r.writeCalls = emu.stats().writeCalls - s0.writeCalls;
+    printResult(&r);
+
+    // asynchronous uplink, one datagram queued at a time while the caller keeps polling
+    beginPhase(&r, "poll()");
+    s0 = emu.stats();
+    asyncCompleted = 0;
+    asyncFailed = 0;
+
+    unsigned int queued = 0;
+    uint64_t start = hostMicros();
+
+    while (asyncCompleted < count) {
+        if (queued < count && modem.isIdle()) {
+            // rejected when payloadLen exceeds BC95_ASYNC_DATA_BUF_LEN
+            if (!modem.sendUDPDatagramAsync(socket, BENCH_REMOTE_ADDR, BENCH_REMOTE_PORT, txBuf, payloadLen, onAsyncSent)) {
+                onAsyncSent(BC95_RESPONSE_TYPE_ERROR, NULL, 0, NULL);
+            }
+            queued++;
+        }
+
+        t0 = hostMicros();
+        c0 = cpuNanos();
+
+        modem.poll();
+
+        recordCall(&r, hostMicros() - t0, cpuNanos() - c0, true, 0);
+    }
+
+    uint64_t elapsed = hostMicros() - start;
+
+    printf("async    dgrams=%u ok=%u dgram/s=%.2f wire_tx=%llu B wire_rx=%llu B polls=%u "
+           "poll_avg=%.3f ms poll_max=%.3f ms cpu=%.2f us/poll\n",
+        count,
+        count - asyncFailed,
+        elapsed ? (count - asyncFailed) / (elapsed / 1e6) : 0.0,
+        (unsigned long long)(emu.stats().txBytes - s0.txBytes),
+        (unsigned long long)(emu.stats().rxBytes - s0.rxBytes),
+        r.calls,
+        r.calls ? (r.totalMicros / 1000.0) / r.calls : 0.0,
+        r.maxMicros / 1000.0,
+        r.calls ? (r.cpuNanos / 1000.0) / r.calls : 0.0);
+
+    // RRC connected time per request/reply exchange
+    static const uint16_t releaseFlags[] = { BC95_NSOST_FLAG_NONE, BC95_NSOST_FLAG_RELEASE_AFTER_REPLIED };
+
+    for (size_t f = 0 ; f < sizeof(releaseFlags) / sizeof(releaseFlags[0]) ; f++) {
+        // start from idle
+        while (emu.isConnected()) {
+            delay(10);
+        }
+
+        s0 = emu.stats();
+        uint32_t failures = 0;
+
+        for (unsigned int i = 0 ; i < count ; i++) {
+            QuectelBC95::udp_rx_data_t rx;
+
+            if (modem.sendUDPDatagram(socket, BENCH_REMOTE_ADDR, BENCH_REMOTE_PORT, txBuf, payloadLen, releaseFlags[f]) != payloadLen) {
+                failures++;
+            }
+
+            delay(BENCH_REPLY_DELAY);
+            emu.queueDownlink(socket, BENCH_REMOTE_ADDR, BENCH_REMOTE_PORT, txBuf, payloadLen);
+
+            while (modem.pendingUDPDataLength(socket) == 0) {
+                modem.poll();
+            }
+
+            if (modem.receiveUDPDatagram(socket, rxBuf, sizeof(rxBuf), &rx) != payloadLen) {
+                failures++;
+            }
+
+            // until the network lets go of the connection
+            while (emu.isConnected()) {
+                delay(10);
+            }
+        }
+
+        uint32_t connections = emu.stats().rrcConnections - s0.rrcConnections;
+        uint64_t connected = emu.stats().rrcConnectedMicros - s0.rrcConnectedMicros;
+
+        printf("release  flag=0x%03X exchanges=%u failures=%u connections=%u connected_avg=%.2f ms\n",
+            releaseFlags[f],
+            count,
+            failures,
+            connections,
+            count ? (connected / 1000.0) / count : 0.0);
+    }
+
+    // downlink on firmware with AT+NSONMI=2, no AT+NSORF round trip
+    emu.setFirmware("V150R100C10B300SP5", true);
+
+    if (modem.probeCapabilities()) {
+        printf("firmware revision=%s capabilities=0x%02X\n", modem.firmwareRevision(), modem.capabilities());
+    }
+
+    runReceivePhase(&r, "inline", &emu, &modem, socket, txBuf, rxBuf, sizeof(rxBuf), payloadLen, count);
+
+    // non-IP uplink over the control plane, no address or port on the wire
+    emu.setControlPlane(true);
+
+    beginPhase(&r, "nidd");
+    s0 = emu.stats();
+
+    for (unsigned int i = 0 ; i < count ; i++) {
+        t0 = hostMicros();
+        c0 = cpuNanos();
+
+        bool ok = modem.sendControlPlaneData(BC95_EMU_NIDD_CID, txBuf, payloadLen);
+
+        recordCall(&r, hostMicros() - t0, cpuNanos() - c0, ok, payloadLen);
+    }
+
+    r.txWireBytes = emu.stats().txBytes - s0.txBytes;
+    r.rxWireBytes = emu.stats().rxBytes - s0.rxBytes;
+    r.writeCalls = emu.stats().writeCalls - s0.writeCalls;
+    printResult(&r);
+
+    // numbered uplink, time from queueing a datagram until the radio reports it
+    emu.setDeliveryReports(true, BENCH_DELIVERY_DELAY_US);
+    modem.probeCapabilities();
+    modem.setDeliveryCallback(onDelivery);
+
+    deliveriesSent = 0;
+    deliveriesFailed = 0;
+    uint64_t confirmMicros = 0;
+    uint32_t untracked = 0;
+
+    for (unsigned int i = 0 ; i < count ; i++) {
+        uint8_t sequence = 0;
+        uint32_t reported = deliveriesSent + deliveriesFailed;
+
+        if (i % 4 == 3) {
+            emu.failDeliveries(1);
+        }
+
+        t0 = hostMicros();
+
+        if (!modem.sendUDPDatagramAsync(socket, BENCH_REMOTE_ADDR, BENCH_REMOTE_PORT, txBuf, payloadLen, NULL, NULL, BC95_NSOST_FLAG_NONE, &sequence) || sequence == 0) {
+            untracked++;
+            continue;
+        }
+
+        while (deliveriesSent + deliveriesFailed == reported) {
+            modem.poll();
+        }
+
+        confirmMicros += deliveryReportedAt - t0;
+    }
+
+    printf("delivery dgrams=%u sent=%u failed=%u untracked=%u confirm_avg=%.2f ms\n",
+        count,
+        deliveriesSent,
+        deliveriesFailed,
+        untracked,
+        (count > untracked) ? (confirmMicros / 1000.0) / (count - untracked) : 0.0);
+
+    modem.setDeliveryCallback(NULL);
+
+    // parser cost per byte with and without virtual stream calls
+    static uint8_t nsorfRsp[64 + BC95_NSOST_MAX_DATA_LEN * 2];
+    static const char HEXMAP[] = "0123456789ABCDEF";
+    size_t nsorfLen = sprintf((char *)nsorfRsp, "\r\n0,%s,%u,%u,", BENCH_REMOTE_ADDR, BENCH_REMOTE_PORT, (unsigned int)payloadLen);
+
+    for (size_t i = 0 ; i < payloadLen ; i++) {
+        nsorfRsp[nsorfLen++] = HEXMAP[txBuf[i] >> 4];
+        nsorfRsp[nsorfLen++] = HEXMAP[txBuf[i] & 0x0F];
+    }
+
+    nsorfLen += sprintf((char *)nsorfRsp + nsorfLen, ",0\r\n\r\nOK\r\n");
+
+    HostPipe pipe;
+    QuectelBC95::Modem pipeModem(&pipe);
+
+    runStreamPhase("stream", &pipeModem, &pipe, nsorfRsp, nsorfLen, txBuf, payloadLen, count * BENCH_STREAM_REPS);
+
+  #ifdef BC95_MODEM_STREAM_TYPE
+    QuectelBC95::BasicModem<BC95_MODEM_STREAM_TYPE> directModem(&pipe);
+
+    runStreamPhase("direct", &directModem, &pipe, nsorfRsp, nsorfLen, txBuf, payloadLen, count * BENCH_STREAM_REPS);
+  #endif
+
+  #ifdef BC95_COMMAND_STATS
+    printDriverStats(&modem);
+  #endif
+
+    return 0;
+}
@@ -0,0 +1,1387 @@
+/**
+ * Scriptable Quectel BC95 emulator for host-side benchmarks.
+ *
+ * Copyright (c) 2018 Sparkbit Co., Ltd. All rights reserved.
+ *
+ * This work is licensed under the terms of the MIT license.
+ * See LICENSE file in the project root for details.
+ */
+
+#include "bc95_emulator.h"
+
+static const char HEXMAP[] = "0123456789ABCDEF";
+
+// ----------------------------------------
+//   Utility Functions
+// ----------------------------------------
+static std::vector<std::string> splitArgs(const std::string &args) {
+    std::vector<std::string> out;
+    size_t start = 0;
+    size_t pos;
+
+    while ((pos = args.find(',', start)) != std::string::npos) {
+        out.push_back(args.substr(start, pos - start));
+        start = pos + 1;
+    }
+    out.push_back(args.substr(start));
+
+    return out;
+}
+
+static bool startsWith(const std::string &s, const char *prefix) {
+    return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+static int hexNibble(char c) {
+    if (c >= '0' && c <= '9') { return c - '0'; }
+    if (c >= 'A' && c <= 'F') { return 10 + c - 'A'; }
+    if (c >= 'a' && c <= 'f') { return 10 + c - 'a'; }
+    return -1;
+}
+
+// ----------------------------------------
+//   BC95Emulator
+// ----------------------------------------
+BC95Emulator::BC95Emulator() {
+    _hostBaud = BC95_EMU_DEFAULT_BAUD;
+    _modemBaud = BC95_EMU_DEFAULT_BAUD;
+    _commandDelay = BC95_EMU_DEFAULT_COMMAND_DELAY_US;
+    _spin = BC95_EMU_DEFAULT_SPIN_US;
+    _regStatus = 1;
+    _cfun = 1;
+    _cereg = 0;
+    _cscon = 0;
+    _cmee = 0;
+    _echo = false;
+    _notify = true;
+    _revision = "V100R100C10B656";
+    _nsonmiModes = false;
+    _nsonmi = 1;
+    _cpEnabled = false;
+    _crtdcp = false;
+    _deliveryReports = false;
+    _deliveryDelay = 0;
+    _deliveryFailures = 0;
+    _inBatch = false;
+    _batchFailed = false;
+    _cpsms = "0";
+    _cedrxs = "";
+    _psmReport = false;
+    _autoConnect = false;
+    _nvramWrites = 0;
+    _psmAsleep = false;
+    _pingRtt = 120;
+    _pingTtl = 52;
+    _pingSuccess = true;
+    _rsrp = -850;
+    _snr = 120;
+    _ecl = 0;
+    _txPower = -32768;
+    _sendErrorCode = 0;
+    _sendErrors = 0;
+    _inTail = 0;
+    _outTail = 0;
+
+    _baudSwitch.storedBaud = BC95_EMU_DEFAULT_BAUD;
+    _baudSwitch.switchPending = false;
+    _baudSwitch.confirmPending = false;
+
+    _rrc.connected = false;
+    _rrc.releaseOnDownlink = false;
+    _inactivity = BC95_EMU_DEFAULT_INACTIVITY_US;
+
+    _cell.earfcn = 3736;
+    _cell.pci = 90;
+    _cell.band = 8;
+    _cell.fullScan = 0;
+    _cell.locked = 0;
+    _cell.searching = false;
+    _cell.doneAt = 0;
+    _cell.lockEarfcn = 0;
+    _cell.lockPci = 0xFFFF;
+
+    _bands.push_back(5);
+    _bands.push_back(8);
+    _bands.push_back(20);
+
+    for (int i = 0 ; i < BC95_EMU_MAX_SOCKETS ; i++) {
+        _sockets[i].open = false;
+        _sockets[i].recvMsg = false;
+        _sockets[i].port = 0;
+    }
+
+    resetStats();
+}
+
+void BC95Emulator::begin(unsigned long baud) {
+    _hostBaud = baud;
+}
+
+void BC95Emulator::end() {
+    _in.clear();
+    _line.clear();
+}
+
+void BC95Emulator::setBaudRate(unsigned long baud) {
+    _modemBaud = baud;
+    _baudSwitch.storedBaud = baud;
+    _baudSwitch.switchPending = false;
+    _baudSwitch.confirmPending = false;
+}
+
+void BC95Emulator::setCommandDelay(unsigned long us) {
+    _commandDelay = us;
+}
+
+void BC95Emulator::setSpinTime(unsigned long us) {
+    _spin = us;
+}
+
+void BC95Emulator::setRegistrationStatus(uint8_t status) {
+    _register(status, hostMicros());
+}
+
+void BC95Emulator::setServingCell(uint32_t earfcn, uint16_t pci, uint8_t band) {
+    _cell.earfcn = earfcn;
+    _cell.pci = pci;
+    _cell.band = band;
+}
+
+void BC95Emulator::setCellSearch(unsigned long fullScanUs, unsigned long lockedUs) {
+    _cell.fullScan = fullScanUs;
+    _cell.locked = lockedUs;
+
+    if (fullScanUs > 0) {
+        _startSearch(hostMicros());
+    }
+}
+
+void BC95Emulator::setNotifications(bool enabled) {
+    _notify = enabled;
+}
+
+void BC95Emulator::setPingResponse(uint16_t rtt, uint16_t ttl, bool success) {
+    _pingRtt = rtt;
+    _pingTtl = ttl;
+    _pingSuccess = success;
+}
+
+void BC95Emulator::setFirmware(const char *revision, bool nsonmiModes) {
+    _revision = revision;
+    _nsonmiModes = nsonmiModes;
+}
+
+void BC95Emulator::failSends(int code, unsigned int count) {
+    _sendErrorCode = code;
+    _sendErrors = count;
+}
+
+void BC95Emulator::setDeliveryReports(bool enabled, unsigned long delayUs) {
+    _deliveryReports = enabled;
+    _deliveryDelay = delayUs;
+}
+
+void BC95Emulator::failDeliveries(unsigned int count) {
+    _deliveryFailures = count;
+}
+
+void BC95Emulator::setControlPlane(bool enabled) {
+    _cpEnabled = enabled;
+}
+
+bool BC95Emulator::queueControlPlaneDownlink(const uint8_t *data, size_t len) {
+    char head[32];
+    std::string urc;
+
+    if (!_cpEnabled || !_crtdcp) {
+        return false;
+    }
+
+    _rrcActivity(hostMicros(), false, 0);
+
+    // +CRTDCP:<cid>,<cpdata_length>,<cpdata>
+    snprintf(head, sizeof(head), "+CRTDCP:%u,%u,", BC95_EMU_NIDD_CID, (unsigned int)len);
+    urc = head;
+
+    for (size_t i = 0 ; i < len ; i++) {
+        urc += "0123456789ABCDEF"[data[i] >> 4];
+        urc += "0123456789ABCDEF"[data[i] & 0x0F];
+    }
+
+    _emitLine(urc, hostMicros());
+    _stats.urcs++;
+    _stats.cpDataReceived++;
+
+    return true;
+}
+
+void BC95Emulator::setRadioConditions(int16_t rsrp, int16_t snr, uint8_t ecl) {
+    _rsrp = rsrp;
+    _snr = snr;
+    _ecl = ecl;
+}
+
+bool BC95Emulator::queueDownlink(uint8_t socket, const char *remoteAddr, uint16_t remotePort, const uint8_t *data, size_t len) {
+    if (socket >= BC95_EMU_MAX_SOCKETS || !_sockets[socket].open || !_sockets[socket].recvMsg) {
+        return false;
+    }
+
+    _rrcActivity(hostMicros(), false, 0);
+
+    // +NSONMI:<socket>,<remote_addr>,<remote_port>,<length>,<data>, not buffered
+    if (_nsonmi == 2) {
+        char head[48];
+        std::string urc;
+
+        snprintf(head, sizeof(head), "+NSONMI:%u,%s,%u,%u,", socket, remoteAddr, remotePort, (unsigned int)len);
+        urc = head;
+
+        for (size_t i = 0 ; i < len ; i++) {
+            urc += "0123456789ABCDEF"[data[i] >> 4];
+            urc += "0123456789ABCDEF"[data[i] & 0x0F];
+        }
+
+        _emitLine(urc, hostMicros());
+        _stats.urcs++;
+        _stats.datagramsReceived++;
+        return true;
+    }
+
+    datagram_t dgram;
+    dgram.remoteAddr = remoteAddr;
+    dgram.remotePort = remotePort;
+    dgram.data.assign(data, data + len);
+    dgram.offset = 0;
+    _sockets[socket].rxQueue.push_back(dgram);
+
+    if (_notify && _nsonmi == 1) {
+        char urc[32];
+        snprintf(urc, sizeof(urc), "+NSONMI:%u,%u", socket, (unsigned int)len);
+        _emitLine(urc, hostMicros());
+        _stats.urcs++;
+    }
+
+    return true;
+}
+
+void BC95Emulator::queueURC(const char *line) {
+    _emitLine(line, hostMicros());
+    _stats.urcs++;
+}
+
+void BC95Emulator::setPowerSaving(bool asleep) {
+    if (_psmAsleep == asleep) {
+        return;
+    }
+
+    _psmAsleep = asleep;
+
+    if (_psmReport) {
+        queueURC(asleep ? "+NPSMR:1" : "+NPSMR:0");
+    }
+}
+
+void BC95Emulator::setInactivityTimer(unsigned long us) {
+    _inactivity = us;
+}
+
+bool BC95Emulator::isConnected() {
+    _updateRRC(hostMicros());
+
+    return _rrc.connected;
+}
+
+size_t BC95Emulator::pendingDownlink(uint8_t socket) {
+    size_t len = 0;
+
+    if (socket >= BC95_EMU_MAX_SOCKETS) {
+        return 0;
+    }
+
+    for (size_t i = 0 ; i < _sockets[socket].rxQueue.size() ; i++) {
+        len += _sockets[socket].rxQueue[i].data.size() - _sockets[socket].rxQueue[i].offset;
+    }
+
+    return len;
+}
+
+void BC95Emulator::resetStats() {
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+uint64_t BC95Emulator::_byteTime() const {
+    // 1 start bit, 8 data bits, 1 stop bit
+    return 10000000ULL / _modemBaud;
+}
+
+void BC95Emulator::_updateRRC(uint64_t now) {
+    if (_rrc.connected && now >= _rrc.releaseAt) {
+        _rrc.connected = false;
+        _stats.rrcConnectedMicros += _rrc.releaseAt - _rrc.since;
+
+        if (_cscon > 0) {
+            _emitLine("+CSCON:0", _rrc.releaseAt);
+            _stats.urcs++;
+        }
+    }
+}
+
+// 0x200 releases once the uplink is out, 0x400 once the next downlink has arrived
+void BC95Emulator::_rrcActivity(uint64_t at, bool uplink, uint16_t flag) {
+    _updateRRC(at);
+
+    if (!_rrc.connected) {
+        _rrc.connected = true;
+        _rrc.releaseOnDownlink = false;
+        _rrc.since = at;
+        _stats.rrcConnections++;
+
+        if (_cscon > 0) {
+            _emitLine("+CSCON:1", at);
+            _stats.urcs++;
+        }
+    }
+
+    _rrc.releaseAt = at + _inactivity;
+
+    if (uplink) {
+        _rrc.releaseOnDownlink = (flag & 0x400) != 0;
+
+        if (flag & 0x200) {
+            _rrc.releaseAt = at;
+        }
+    }
+    else if (_rrc.releaseOnDownlink) {
+        _rrc.releaseOnDownlink = false;
+        _rrc.releaseAt = at;
+    }
+}
+
+// <stat>[,"<tac>","<ci>",<AcT>], the location only with AT+CEREG=2 while registered
+void BC95Emulator::_register(uint8_t status, uint64_t at) {
+    if (_regStatus == status) {
+        return;
+    }
+
+    _regStatus = status;
+
+    if (_cereg > 0) {
+        _emitLine("+CEREG:" + _ceregStatus(), at);
+        _stats.urcs++;
+    }
+}
+
+void BC95Emulator::_startSearch(uint64_t at) {
+    bool found = false;
+    unsigned long duration;
+
+    if (_cell.lockEarfcn != 0) {
+        found = (_cell.lockEarfcn == _cell.earfcn && (_cell.lockPci == 0xFFFF || _cell.lockPci == _cell.pci));
+        duration = _cell.locked;
+    }
+    else {
+        for (size_t i = 0 ; i < _bands.size() ; i++) {
+            found = found || (_bands[i] == _cell.band);
+        }
+        duration = _cell.fullScan;
+    }
+
+    if (found && duration == 0) {
+        _cell.searching = false;
+        _register(1, at);
+        return;
+    }
+
+    _register(2, at);
+    _cell.searching = found;
+    _cell.doneAt = at + duration;
+}
+
+void BC95Emulator::_updateSearch(uint64_t now) {
+    if (_cell.searching && now >= _cell.doneAt) {
+        _cell.searching = false;
+        _register(1, _cell.doneAt);
+    }
+}
+
+// +NSOSTR for the numbered datagrams due by now
+void BC95Emulator::_updateDeliveries(uint64_t now) {
+    char buf[32];
+
+    while (!_deliveries.empty() && _deliveries.front().dueAt <= now) {
+        const delivery_t &d = _deliveries.front();
+
+        snprintf(buf, sizeof(buf), "+NSOSTR:%u,%u,%u", d.socket, d.sequence, d.sent ? 1 : 0);
+        _emitLine(buf, d.dueAt);
+        _stats.urcs++;
+        _deliveries.pop_front();
+    }
+}
+
+std::string BC95Emulator::_ceregStatus() const {
+    char buf[32];
+
+    if (_cereg >= 2 && (_regStatus == 1 || _regStatus == 5)) {
+        snprintf(buf, sizeof(buf), "%u,\"3B2E\",\"0A3C1F05\",9", _regStatus);
+    }
+    else {
+        snprintf(buf, sizeof(buf), "%u", _regStatus);
+    }
+
+    return buf;
+}
+
+void BC95Emulator::_spinWait() {
+    hostAdvanceMicros(_spin);
+}
+
+// applies a pending AT+NATSPEED switch or fallback due by now
+void BC95Emulator::_updateBaud(uint64_t now) {
+    if (_baudSwitch.switchPending && now >= _baudSwitch.switchAt) {
+        _baudSwitch.switchPending = false;
+        _baudSwitch.previousBaud = _modemBaud;
+        _modemBaud = _baudSwitch.pendingBaud;
+
+        if (_baudSwitch.store && !_baudSwitch.confirmPending) {
+            _baudSwitch.storedBaud = _modemBaud;
+        }
+    }
+
+    if (_baudSwitch.confirmPending && !_baudSwitch.switchPending && now >= _baudSwitch.confirmBy) {
+        // nothing heard at the new rate
+        _baudSwitch.confirmPending = false;
+        _modemBaud = _baudSwitch.previousBaud;
+    }
+}
+
+// timeout 0 switches for good, otherwise the rate is stored once confirmed
+void BC95Emulator::_scheduleBaud(unsigned long baud, uint64_t at, uint8_t timeout, bool store) {
+    _baudSwitch.pendingBaud = baud;
+    _baudSwitch.store = store;
+    _baudSwitch.switchAt = at;
+    _baudSwitch.switchPending = true;
+    _baudSwitch.confirmBy = at + timeout * 1000000ULL;
+    _baudSwitch.confirmPending = timeout > 0;
+}
+
+// ----------------------------------------
+//   Stream
+// ----------------------------------------
+int BC95Emulator::available() {
+    int n = 0;
+    uint64_t now = hostMicros();
+
+    _drainInput();
+    _pump();
+
+    for (size_t i = 0 ; i < _out.size() && _out[i].readyAt <= now ; i++) {
+        n++;
+    }
+
+    if (n == 0) {
+        _spinWait();
+    }
+
+    return n;
+}
+
+int BC95Emulator::read() {
+    _drainInput();
+    _pump();
+
+    if (_out.empty() || _out.front().readyAt > hostMicros()) {
+        _spinWait();
+        return -1;
+    }
+
+    rx_byte_t rb = _out.front();
+    _out.pop_front();
+    _stats.rxBytes++;
+
+    // baud rate mismatch, the host only sees framing errors
+    return (rb.baud == _hostBaud) ? rb.b : 0xFF;
+}
+
+int BC95Emulator::peek() {
+    _drainInput();
+    _pump();
+
+    if (_out.empty() || _out.front().readyAt > hostMicros()) {
+        _spinWait();
+        return -1;
+    }
+
+    return _out.front().b;
+}
+
+int BC95Emulator::availableForWrite() {
+    _drainInput();
+
+    if (_in.size() >= BC95_EMU_TX_FIFO_LEN) {
+        _spinWait();
+    }
+
+    return BC95_EMU_TX_FIFO_LEN - _in.size();
+}
+
+size_t BC95Emulator::write(uint8_t b) {
+    _stats.writeCalls++;
+    _drainInput();
+
+    // TX FIFO is full, block until the oldest byte has left
+    if (_in.size() >= BC95_EMU_TX_FIFO_LEN) {
+        hostAdvanceMicros(_in.front().readyAt - hostMicros());
+        _drainInput();
+    }
+
+    // the byte occupies the wire for one frame time after the previous one
+    rx_byte_t tb;
+    tb.b = b;
+    tb.baud = _hostBaud;
+    tb.readyAt = ((_inTail > hostMicros()) ? _inTail : hostMicros()) + _byteTime();
+    _in.push_back(tb);
+
+    _inTail = tb.readyAt;
+    _stats.txBytes++;
+
+    return 1;
+}
+
+size_t BC95Emulator::write(const uint8_t *buffer, size_t size) {
+    for (size_t i = 0 ; i < size ; i++) {
+        write(buffer[i]);
+    }
+
+    // one call from the host's point of view
+    _stats.writeCalls -= size;
+    _stats.writeCalls++;
+
+    return size;
+}
+
+void BC95Emulator::flush() {
+    // wait for the TX FIFO to drain
+    if (_inTail > hostMicros()) {
+        hostAdvanceMicros(_inTail - hostMicros());
+    }
+
+    _drainInput();
+}
+
+// ----------------------------------------
+//   Input
+// ----------------------------------------
+// hand bytes that have crossed the wire to the modem
+void BC95Emulator::_drainInput() {
+    uint64_t now = hostMicros();
+
+    while (!_in.empty() && _in.front().readyAt <= now) {
+        rx_byte_t tb = _in.front();
+        _in.pop_front();
+        _updateBaud(tb.readyAt);
+        _receive(tb);
+    }
+
+    _updateBaud(now);
+}
+
+void BC95Emulator::_receive(const rx_byte_t &tb) {
+    uint8_t b = tb.b;
+
+    if (tb.baud != _modemBaud) {
+        // baud rate mismatch, the modem only sees framing errors
+        return;
+    }
+
+    if (b == '\r') {
+        std::string cmd = _line;
+        _line.clear();
+
+        if (_echo) {
+            _emit(cmd + "\r", hostMicros());
+        }
+
+        if (!cmd.empty()) {
+            // the new rate works
+            if (_baudSwitch.confirmPending && !_baudSwitch.switchPending) {
+                _baudSwitch.confirmPending = false;
+
+                if (_baudSwitch.store) {
+                    _baudSwitch.storedBaud = _modemBaud;
+                }
+            }
+
+            _process(cmd);
+        }
+    }
+    else if (b != '\n') {
+        _line.push_back((char)b);
+    }
+}
+
+// ----------------------------------------
+//   Output
+// ----------------------------------------
+// move scheduled output whose time has come onto the (serial) wire
+void BC95Emulator::_pump() {
+    uint64_t now = hostMicros();
+
+    // a release due by now reports +CSCON in time order with the rest
+    _updateRRC(now);
+    _updateSearch(now);
+    _updateDeliveries(now);
+
+    while (!_scheduled.empty() && _scheduled.begin()->first <= now) {
+        _updateBaud(_scheduled.begin()->first);
+
+        uint64_t t = (_outTail > _scheduled.begin()->first) ? _outTail : _scheduled.begin()->first;
+        const std::string &text = _scheduled.begin()->second;
+
+        for (size_t i = 0 ; i < text.size() ; i++) {
+            t += _byteTime();
+
+            rx_byte_t rb;
+            rb.b = (uint8_t)text[i];
+            rb.readyAt = t;
+            rb.baud = _modemBaud;
+            _out.push_back(rb);
+        }
+
+        _outTail = t;
+        _scheduled.erase(_scheduled.begin());
+    }
+
+    _updateBaud(now);
+}
+
+void BC95Emulator::_emit(const std::string &text, uint64_t at) {
+    _scheduled.insert(std::make_pair(at, text));
+}
+
+void BC95Emulator::_emitLine(const std::string &line, uint64_t at) {
+    _emit("\r\n" + line + "\r\n", at);
+}
+
+void BC95Emulator::_ok(uint64_t at) {
+    if (_inBatch) {
+        return;
+    }
+
+    _emitLine("OK", at);
+}
+
+void BC95Emulator::_error(uint64_t at, int code) {
+    char buf[24];
+
+    _stats.errors++;
+
+    if (_inBatch) {
+        _batchFailed = true;
+    }
+
+    if (_cmee == 1) {
+        snprintf(buf, sizeof(buf), "+CME ERROR: %d", code);
+        _emitLine(buf, at);
+    }
+    else {
+        _emitLine("ERROR", at);
+    }
+}
+
+// ----------------------------------------
+//   Command processor
+// ----------------------------------------
+// AT+A;+B;... - the commands run in turn with one final result for the line
+void BC95Emulator::_processBatch(const std::string &line) {
+    std::vector<std::string> cmds;
+    size_t start = 0;
+    size_t pos;
+
+    while ((pos = line.find(';', start)) != std::string::npos) {
+        cmds.push_back(line.substr(start, pos - start));
+        start = pos + 1;
+    }
+    cmds.push_back(line.substr(start));
+
+    _inBatch = true;
+    _batchFailed = false;
+
+    for (size_t i = 0 ; i < cmds.size() && !_batchFailed ; i++) {
+        _process((i == 0) ? cmds[i] : "AT" + cmds[i]);
+    }
+
+    _inBatch = false;
+
+    if (!_batchFailed) {
+        _ok(hostMicros() + _commandDelay);
+    }
+}
+
+void BC95Emulator::_process(const std::string &cmd) {
+    uint64_t at = hostMicros() + _commandDelay;
+    char buf[64];
+
+    if (!_inBatch && startsWith(cmd, "AT+") && cmd.find(';') != std::string::npos) {
+        _processBatch(cmd);
+        return;
+    }
+
+    _stats.commands++;
+    _updateSearch(at);
+    _updateDeliveries(at);
+
+    if (cmd == "AT") {
+        _ok(at);
+    }
+    else if (cmd == "ATE0" || cmd == "ATE1") {
+        _echo = (cmd == "ATE1");
+        _ok(at);
+    }
+    else if (startsWith(cmd, "AT+CMEE=")) {
+        _cmee = atoi(cmd.c_str() + 8);
+        _ok(at);
+    }
+    else if (startsWith(cmd, "AT+NCONFIG=AUTOCONNECT,")) {
+        bool enabled = (cmd == "AT+NCONFIG=AUTOCONNECT,TRUE");
+
+        if (enabled != _autoConnect) {
+            _autoConnect = enabled;
+            _nvramWrites++;
+        }
+        _ok(at);
+    }
+    else if (startsWith(cmd, "AT+NCONFIG=")) {
+        _ok(at);
+    }
+    else if (cmd == "AT+NCONFIG?") {
+        _emitLine(_autoConnect ? "+NCONFIG:AUTOCONNECT,TRUE" : "+NCONFIG:AUTOCONNECT,FALSE", at);
+        _emitLine("+NCONFIG:CR_0354_0338_SCRAMBLING,TRUE", at);
+        _emitLine("+NCONFIG:CR_0859_SI_AVOID,TRUE", at);
+        _ok(at);
+    }
+    else if (cmd == "AT+CEREG?") {
+        snprintf(buf, sizeof(buf), "+CEREG:%u,", _cereg);
+        _emitLine(buf + _ceregStatus(), at);
+        _ok(at);
+    }
+    else if (cmd == "AT+CEREG=0" || cmd == "AT+CEREG=1" || cmd == "AT+CEREG=2") {
+        _cereg = cmd[9] - '0';
+        _ok(at);
+    }
+    else if (cmd == "AT+CSCON?") {
+        _updateRRC(at);
+        snprintf(buf, sizeof(buf), "+CSCON:%u,%u", _cscon, _rrc.connected ? 1 : 0);
+        _emitLine(buf, at);
+        _ok(at);
+    }
+    else if (cmd == "AT+CSCON=0" || cmd == "AT+CSCON=1") {
+        _cscon = cmd[9] - '0';
+        _ok(at);
+    }
+    else if (cmd == "AT+CGATT=0" || cmd == "AT+CGATT=1") {
+        _ok(at);
+    }
+    else if (cmd == "AT+CGATT?") {
+        _emitLine((_regStatus == 1 || _regStatus == 5) ? "+CGATT:1" : "+CGATT:0", at);
+        _ok(at);
+    }
+    else if (cmd == "AT+CSQ") {
+        _emitLine("+CSQ:20,99", at);
+        _ok(at);
+    }
+    else if (cmd == "AT+CGDCONT?") {
+        _emitLine("+CGDCONT:0,\"IP\",\"internet\",\"10.20.30.40\",0,0", at);
+
+        if (_cpEnabled) {
+            snprintf(buf, sizeof(buf), "+CGDCONT:%u,\"NONIP\",\"nidd\",,0,0", BC95_EMU_NIDD_CID);
+            _emitLine(buf, at);
+        }
+        _ok(at);
+    }
+    else if (_cpEnabled && (cmd == "AT+CRTDCP=0" || cmd == "AT+CRTDCP=1")) {
+        _crtdcp = (cmd == "AT+CRTDCP=1");
+        _ok(at);
+    }
+    else if (_cpEnabled && cmd == "AT+CRTDCP?") {
+        _emitLine(_crtdcp ? "+CRTDCP:1" : "+CRTDCP:0", at);
+        _ok(at);
+    }
+    else if (startsWith(cmd, "AT+CSODCP=")) {
+        _csodcp(cmd.substr(10), at);
+    }
+    else if (startsWith(cmd, "AT+CGPADDR")) {
+        _emitLine("+CGPADDR:0,10.20.30.40", at);
+        _ok(at);
+    }
+    else if (cmd == "AT+CGMI") {
+        _emitLine("Quectel", at);
+        _ok(at);
+    }
+    else if (cmd == "AT+CGMM") {
+        _emitLine("BC95HB-02-STD_900", at);
+        _ok(at);
+    }
+    else if (cmd == "AT+CGMR") {
+        _emitLine("SECURITY," + _revision, at);
+        _emitLine("PROTOCOL," + _revision, at);
+        _emitLine("APPLICATION," + _revision, at);
+        _ok(at);
+    }
+    else if (cmd == "AT+NSOSTF=?") {
+        _ok(at);
+    }
+    else if (_deliveryReports && cmd == "AT+NQSOS=?") {
+        _ok(at);
+    }
+    else if (_deliveryReports && startsWith(cmd, "AT+NQSOS=")) {
+        _nqsos(cmd.substr(9), at);
+    }
+    else if (_nsonmiModes && cmd == "AT+NSONMI=?") {
+        _emitLine("+NSONMI:(0,1,2,3)", at);
+        _ok(at);
+    }
+    else if (_nsonmiModes && startsWith(cmd, "AT+NSONMI=")) {
+        int mode = atoi(cmd.c_str() + 10);
+
+        if (mode < 0 || mode > 3 || cmd.size() != 11) {
+            _error(at, 50);
+        }
+        else {
+            _nsonmi = mode;
+            _ok(at);
+        }
+    }
+    else if (cmd == "AT+CGSN=1") {
+        _emitLine("+CGSN:863703030000001", at);
+        _ok(at);
+    }
+    else if (cmd == "AT+CIMI") {
+        _emitLine("520031234567890", at);
+        _ok(at);
+    }
+    else if (cmd == "AT+CFUN=0") {
+        _cfun = 0;
+        _cell.searching = false;
+        _register(0, at);
+        _ok(at);
+    }
+    else if (cmd == "AT+CFUN=1") {
+        if (_cfun != 1) {
+            _cfun = 1;
+            _startSearch(at);
+        }
+        _ok(at);
+    }
+    else if (startsWith(cmd, "AT+NEARFCN=")) {
+        _nearfcn(cmd.substr(11), at);
+    }
+    else if (startsWith(cmd, "AT+NBAND")) {
+        _nband(cmd.substr(8), at);
+    }
+    else if (startsWith(cmd, "AT+NSOCR=")) {
+        _nsocr(cmd.substr(9), at);
+    }
+    else if (startsWith(cmd, "AT+NSOCL=")) {
+        int s = atoi(cmd.c_str() + 9);
+
+        if (s >= 0 && s < BC95_EMU_MAX_SOCKETS && _sockets[s].open) {
+            _sockets[s].open = false;
+            _sockets[s].rxQueue.clear();
+            _ok(at);
+        }
+        else {
+            _error(at, 50);
+        }
+    }
+    else if (startsWith(cmd, "AT+NSOSTF=")) {
+        _nsost(cmd.substr(10), true, at);
+    }
+    else if (startsWith(cmd, "AT+NSOST=")) {
+        _nsost(cmd.substr(9), false, at);
+    }
+    else if (startsWith(cmd, "AT+NSORF=")) {
+        _nsorf(cmd.substr(9), at);
+    }
+    else if (startsWith(cmd, "AT+NPING=")) {
+        _nping(cmd.substr(9), at);
+    }
+    else if (cmd == "AT+NRB") {
+        _nrb(at);
+    }
+    else if (startsWith(cmd, "AT+CPSMS=")) {
+        _cpsms = cmd.substr(9);
+        _ok(at);
+    }
+    else if (cmd == "AT+CPSMS?") {
+        _emitLine("+CPSMS:" + _cpsms, at);
+        _ok(at);
+    }
+    else if (startsWith(cmd, "AT+CEDRXS=")) {
+        std::vector<std::string> a = splitArgs(cmd.substr(10));
+        _cedrxs = (a[0] == "1" || a[0] == "2") && a.size() >= 3 ? a[1] + "," + a[2] : "";
+        _ok(at);
+    }
+    else if (cmd == "AT+CEDRXS?") {
+        if (!_cedrxs.empty()) {
+            _emitLine("+CEDRXS:" + _cedrxs, at);
+        }
+        _ok(at);
+    }
+    else if (startsWith(cmd, "AT+NPSMR=")) {
+        _psmReport = (cmd == "AT+NPSMR=1");
+        _ok(at);
+    }
+    else if (cmd == "AT+NPSMR?") {
+        _emitLine(_psmReport ? (_psmAsleep ? "+NPSMR:1,1" : "+NPSMR:1,0") : "+NPSMR:0", at);
+        _ok(at);
+    }
+    else if (cmd == "AT+NUESTATS") {
+        _nuestats(at);
+    }
+    else if (cmd == "AT+NATSPEED?") {
+        snprintf(buf, sizeof(buf), "+NATSPEED:%lu,0,1,2,1,0,0", _modemBaud);
+        _emitLine(buf, at);
+        _ok(at);
+    }
+    else if (startsWith(cmd, "AT+NATSPEED=")) {
+        _natspeed(cmd.substr(12), at);
+    }
+    else {
+        _error(at, 4);
+    }
+}
+
+// AT+NSOCR=DGRAM,17,<port>,<receive control>
+void BC95Emulator::_nsocr(const std::string &args, uint64_t at) {
+    std::vector<std::string> a = splitArgs(args);
+    char buf[8];
+
+    if (a.size() < 3 || a[0] != "DGRAM" || a[1] != "17") {
+        _error(at, 50);
+        return;
+    }
+
+    uint16_t port = atoi(a[2].c_str());
+
+    for (int i = 0 ; i < BC95_EMU_MAX_SOCKETS ; i++) {
+        if (_sockets[i].open && port != 0 && _sockets[i].port == port) {
+            _error(at, 3);
+            return;
+        }
+    }
+
+    for (int i = 0 ; i < BC95_EMU_MAX_SOCKETS ; i++) {
+        if (!_sockets[i].open) {
+            _sockets[i].open = true;
+            _sockets[i].port = port;
+            _sockets[i].recvMsg = (a.size() < 4) || atoi(a[3].c_str()) != 0;
+            _sockets[i].rxQueue.clear();
+
+            snprintf(buf, sizeof(buf), "%d", i);
+            _emitLine(buf, at);
+            _ok(at);
+            return;
+        }
+    }
+
+    _error(at, 23);
+}
+
+// AT+NSOST=<socket>,<remote_addr>,<remote_port>,<length>,<data>
+// AT+NSOSTF=<socket>,<remote_addr>,<remote_port>,<flag>,<length>,<data>[,<sequence>]
+void BC95Emulator::_nsost(const std::string &args, bool withFlag, uint64_t at) {
+    std::vector<std::string> a = splitArgs(args);
+    size_t argc = withFlag ? 6 : 5;
+    int sequence = 0;
+    char buf[16];
+
+    if (a.size() < argc) {
+        _error(at, 50);
+        return;
+    }
+
+    if (a.size() > argc) {
+        sequence = atoi(a[argc].c_str());
+
+        if (!withFlag || !_deliveryReports || a.size() > argc + 1 || sequence < 1 || sequence > 255) {
+            _error(at, 50);
+            return;
+        }
+    }
+
+    int s = atoi(a[0].c_str());
+    uint16_t flag = withFlag ? strtoul(a[3].c_str(), NULL, 0) : 0;
+    size_t len = strtoul(a[argc - 2].c_str(), NULL, 10);
+    const std::string &hex = a[argc - 1];
+
+    if (s < 0 || s >= BC95_EMU_MAX_SOCKETS || !_sockets[s].open || hex.size() != len * 2 || len > 512) {
+        _error(at, 50);
+        return;
+    }
+
+    for (size_t i = 0 ; i < hex.size() ; i++) {
+        if (hexNibble(hex[i]) < 0) {
+            _error(at, 50);
+            return;
+        }
+    }
+
+    if (_sendErrors > 0) {
+        _sendErrors--;
+        _error(at, _sendErrorCode);
+        return;
+    }
+
+    _stats.datagramsSent++;
+
+    // open loop power control, full power from -110 dBm down or in enhanced coverage
+    _txPower = (_ecl > 0 || _rsrp <= -1100) ? 230 : (int16_t)(-_rsrp - 870);
+    _rrcActivity(at, true, flag);
+
+    snprintf(buf, sizeof(buf), "%d,%u", s, (unsigned int)len);
+    _emitLine(buf, at);
+    _ok(at);
+
+    if (sequence > 0) {
+        delivery_t d;
+
+        d.socket = s;
+        d.sequence = sequence;
+        d.sent = (_deliveryFailures == 0);
+        d.dueAt = at + _deliveryDelay;
+        _deliveries.push_back(d);
+
+        if (_deliveryFailures > 0) {
+            _deliveryFailures--;
+        }
+    }
+
+    // the uplink wakes the radio
+    if (_psmAsleep) {
+        _psmAsleep = false;
+
+        if (_psmReport) {
+            _emitLine("+NPSMR:0", at);
+            _stats.urcs++;
+        }
+    }
+}
+
+// AT+NQSOS=<socket>[,<socket>...], the numbered datagrams not reported yet
+void BC95Emulator::_nqsos(const std::string &args, uint64_t at) {
+    std::vector<std::string> a = splitArgs(args);
+    char buf[32];
+
+    for (size_t i = 0 ; i < a.size() ; i++) {
+        int s = atoi(a[i].c_str());
+
+        if (s < 0 || s >= BC95_EMU_MAX_SOCKETS || !_sockets[s].open) {
+            _error(at, 50);
+            return;
+        }
+    }
+
+    for (size_t i = 0 ; i < a.size() ; i++) {
+        int s = atoi(a[i].c_str());
+
+        for (size_t j = 0 ; j < _deliveries.size() ; j++) {
+            if (_deliveries[j].socket == s) {
+                snprintf(buf, sizeof(buf), "+NQSOS:%d,%u", s, _deliveries[j].sequence);
+                _emitLine(buf, at);
+            }
+        }
+    }
+
+    _ok(at);
+}
+
+// AT+CSODCP=<cid>,<cpdata_length>,<cpdata>[,<RAI>[,<type_of_user_data>]]
+void BC95Emulator::_csodcp(const std::string &args, uint64_t at) {
+    std::vector<std::string> a = splitArgs(args);
+
+    if (a.size() < 3) {
+        _error(at, 50);
+        return;
+    }
+
+    int cid = atoi(a[0].c_str());
+    size_t len = strtoul(a[1].c_str(), NULL, 10);
+    std::string hex = a[2];
+    int rai = (a.size() > 3) ? atoi(a[3].c_str()) : 0;
+
+    // <cpdata> may be quoted
+    if (hex.size() >= 2 && hex[0] == '"' && hex[hex.size() - 1] == '"') {
+        hex = hex.substr(1, hex.size() - 2);
+    }
+
+    if (!_cpEnabled || cid != BC95_EMU_NIDD_CID) {
+        _error(at, 3);
+        return;
+    }
+
+    if (hex.size() != len * 2 || len == 0 || len > 512 || rai < 0 || rai > 2) {
+        _error(at, 50);
+        return;
+    }
+
+    for (size_t i = 0 ; i < hex.size() ; i++) {
+        if (hexNibble(hex[i]) < 0) {
+            _error(at, 50);
+            return;
+        }
+    }
+
+    if (_sendErrors > 0) {
+        _sendErrors--;
+        _error(at, _sendErrorCode);
+        return;
+    }
+
+    _cpUplink.resize(len);
+
+    for (size_t i = 0 ; i < len ; i++) {
+        _cpUplink[i] = (hexNibble(hex[i * 2]) << 4) | hexNibble(hex[i * 2 + 1]);
+    }
+
+    _stats.cpDataSent++;
+
+    // RAI 1 and 2 release the connection like the matching AT+NSOSTF flags
+    _rrcActivity(at, true, (rai == 1) ? 0x200 : (rai == 2) ? 0x400 : 0);
+    _ok(at);
+
+    if (_psmAsleep) {
+        _psmAsleep = false;
+
+        if (_psmReport) {
+            _emitLine("+NPSMR:0", at);
+            _stats.urcs++;
+        }
+    }
+}
+
+// AT+NSORF=<socket>,<req_length>
+void BC95Emulator::_nsorf(const std::string &args, uint64_t at) {
+    std::vector<std::string> a = splitArgs(args);
+
+    if (a.size() < 2) {
+        _error(at, 50);
+        return;
+    }
+
+    int s = atoi(a[0].c_str());
+    size_t reqLen = strtoul(a[1].c_str(), NULL, 10);
+
+    if (s < 0 || s >= BC95_EMU_MAX_SOCKETS || !_sockets[s].open) {
+        _error(at, 50);
+        return;
+    }
+
+    socket_t *sock = &_sockets[s];
+
+    if (sock->rxQueue.empty() || reqLen == 0) {
+        _ok(at);
+        return;
+    }
+
+    datagram_t &dgram = sock->rxQueue.front();
+    size_t n = dgram.data.size() - dgram.offset;
+    if (n > reqLen) {
+        n = reqLen;
+    }
+
+    std::string line;
+    char buf[64];
+
+    snprintf(buf, sizeof(buf), "%d,%s,%u,%u,", s, dgram.remoteAddr.c_str(), dgram.remotePort, (unsigned int)n);
+    line = buf;
+
+    for (size_t i = 0 ; i < n ; i++) {
+        uint8_t b = dgram.data[dgram.offset + i];
+        line.push_back(HEXMAP[b >> 4]);
+        line.push_back(HEXMAP[b & 0x0F]);
+    }
+
+    dgram.offset += n;
+    size_t remaining = dgram.data.size() - dgram.offset;
+
+    snprintf(buf, sizeof(buf), ",%u", (unsigned int)remaining);
+    line += buf;
+
+    if (remaining == 0) {
+        sock->rxQueue.pop_front();
+        _stats.datagramsReceived++;
+    }
+
+    _emitLine(line, at);
+    _ok(at);
+}
+
+// AT+NPING=<ip>,<p_size>,<timeout>
+// AT+NUESTATS, B656 format
+void BC95Emulator::_nuestats(uint64_t at) {
+    char buf[32];
+    uint64_t now = hostMicros();
+
+    snprintf(buf, sizeof(buf), "Signal power:%d", _rsrp);
+    _emitLine(buf, at);
+    snprintf(buf, sizeof(buf), "Total power:%d", _rsrp + 80);
+    _emitLine(buf, at);
+    snprintf(buf, sizeof(buf), "TX power:%d", _txPower);
+    _emitLine(buf, at);
+    snprintf(buf, sizeof(buf), "TX time:%lu", (unsigned long)(_stats.datagramsSent * 50));
+    _emitLine(buf, at);
+    snprintf(buf, sizeof(buf), "RX time:%lu", (unsigned long)(now / 1000));
+    _emitLine(buf, at);
+    _emitLine("Cell ID:22536457", at);
+    snprintf(buf, sizeof(buf), "ECL:%u", _ecl);
+    _emitLine(buf, at);
+    snprintf(buf, sizeof(buf), "SNR:%d", _snr);
+    _emitLine(buf, at);
+    snprintf(buf, sizeof(buf), "EARFCN:%lu", (unsigned long)_cell.earfcn);
+    _emitLine(buf, at);
+    snprintf(buf, sizeof(buf), "PCI:%u", _cell.pci);
+    _emitLine(buf, at);
+    snprintf(buf, sizeof(buf), "RSRQ:%d", -108 - (_ecl * 20));
+    _emitLine(buf, at);
+    _emitLine("OPERATOR MODE:4", at);
+    _ok(at);
+}
+
+void BC95Emulator::_nping(const std::string &args, uint64_t at) {
+    std::vector<std::string> a = splitArgs(args);
+    char buf[64];
+
+    if (a.empty() || a[0].empty()) {
+        _error(at, 50);
+        return;
+    }
+
+    unsigned long timeout = (a.size() >= 3) ? strtoul(a[2].c_str(), NULL, 10) : 10000;
+
+    _ok(at);
+
+    if (_pingSuccess && _pingRtt <= timeout) {
+        snprintf(buf, sizeof(buf), "+NPING:%s,%u,%u", a[0].c_str(), _pingTtl, _pingRtt);
+        _emitLine(buf, at + (uint64_t)_pingRtt * 1000);
+    }
+    else {
+        _emitLine("+NPINGERR:1", at + (uint64_t)timeout * 1000);
+    }
+
+    _stats.urcs++;
+}
+
+// AT+NRB
+// AT+NEARFCN=0,<earfcn>[,<pci>], PCI in hex, only with the radio off
+void BC95Emulator::_nearfcn(const std::string &args, uint64_t at) {
+    std::vector<std::string> a = splitArgs(args);
+
+    if (_cfun != 0 || a.size() < 2 || a[0] != "0") {
+        _error(at, 4);
+        return;
+    }
+
+    _cell.lockEarfcn = strtoul(a[1].c_str(), NULL, 10);
+    _cell.lockPci = (a.size() > 2) ? strtoul(a[2].c_str(), NULL, 16) : 0xFFFF;
+    _ok(at);
+}
+
+// AT+NBAND? / AT+NBAND=? / AT+NBAND=<n>[,<n>...]
+void BC95Emulator::_nband(const std::string &args, uint64_t at) {
+    std::string line = "+NBAND:";
+    char buf[8];
+
+    if (args == "?") {
+        for (size_t i = 0 ; i < _bands.size() ; i++) {
+            snprintf(buf, sizeof(buf), (i == 0) ? "%u" : ",%u", _bands[i]);
+            line += buf;
+        }
+
+        _emitLine(line, at);
+        _ok(at);
+    }
+    else if (args == "=?") {
+        _emitLine("+NBAND:(1,3,5,8,20,28)", at);
+        _ok(at);
+    }
+    else if (args.size() > 1 && args[0] == '=') {
+        std::vector<std::string> a = splitArgs(args.substr(1));
+        std::vector<uint8_t> bands;
+
+        for (size_t i = 0 ; i < a.size() && i < BC95_EMU_MAX_BANDS ; i++) {
+            bands.push_back((uint8_t)atoi(a[i].c_str()));
+        }
+
+        if (bands != _bands) {
+            _bands = bands;
+            _nvramWrites++;
+        }
+        _ok(at);
+    }
+    else {
+        _error(at, 50);
+    }
+}
+
+void BC95Emulator::_nrb(uint64_t at) {
+    for (int i = 0 ; i < BC95_EMU_MAX_SOCKETS ; i++) {
+        _sockets[i].open = false;
+        _sockets[i].rxQueue.clear();
+    }
+
+    _cmee = 0;
+    _echo = false;
+    _cereg = 0;
+    _cscon = 0;
+    _nsonmi = 1;
+    _crtdcp = false;
+    _cfun = 1;
+    // numbered datagrams are lost without a report
+    _deliveries.clear();
+    _cell.lockEarfcn = 0;
+
+    // the connection is dropped with the radio
+    if (_rrc.connected && _rrc.releaseAt > at) {
+        _rrc.releaseAt = at;
+    }
+    _updateRRC(at);
+
+    _emitLine("REBOOTING", at);
+    // boots at the stored rate
+    _scheduleBaud(_baudSwitch.storedBaud, at + 1000000ULL, 0, false);
+    // boot banner after ~2 seconds
+    _emit("\r\nREBOOT_CAUSE_APPLICATION_AT\r\nNeul \r\nOK\r\n", at + 2000000ULL);
+
+    // AUTOCONNECT scans again once booted
+    if (_cell.fullScan > 0) {
+        _cell.searching = false;
+        _regStatus = 0;
+        _startSearch(at + 2000000ULL);
+    }
+}
+
+// AT+NATSPEED=<baud_rate>,<timeout>,<store>,<sync_mode>[,<stopbits>[,<parity>[,<xonxoff>]]]
+void BC95Emulator::_natspeed(const std::string &args, uint64_t at) {
+    std::vector<std::string> a = splitArgs(args);
+    unsigned long baud;
+    int timeout;
+
+    if (a.size() < 4) {
+        _error(at, 50);
+        return;
+    }
+
+    baud = strtoul(a[0].c_str(), NULL, 10);
+    timeout = atoi(a[1].c_str());
+
+    if ((baud != 4800 && baud != 9600 && baud != 57600 && baud != 115200 && baud != 230400 && baud != 460800) ||
+        timeout < 0 || timeout > 30)
+    {
+        _error(at, 50);
+        return;
+    }
+
+    _ok(at);
+    // after the OK has been sent at the current rate
+    _scheduleBaud(baud, at + 6 * _byteTime(), timeout, atoi(a[2].c_str()) == 1);
+}
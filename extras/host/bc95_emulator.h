@@ -0,0 +1,277 @@
+/**
+ * Scriptable Quectel BC95 emulator for host-side benchmarks.
+ *
+ * Implements the Stream interface and answers the AT subset used by
+ * QuectelBC95::Modem. Wire time is simulated from the configured baud
+ * rate (10 bits per byte) and a per-command processing delay, using the
+ * virtual clock of the host Arduino shim.
+ *
+ * Copyright (c) 2018 Sparkbit Co., Ltd. All rights reserved.
+ *
+ * This work is licensed under the terms of the MIT license.
+ * See LICENSE file in the project root for details.
+ */
+
+#ifndef BC95_EMULATOR_H
+#define BC95_EMULATOR_H
+
+#include <Arduino.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#define BC95_EMU_DEFAULT_BAUD              9600
+#define BC95_EMU_DEFAULT_COMMAND_DELAY_US  2000
+#define BC95_EMU_DEFAULT_SPIN_US           50
+#define BC95_EMU_MAX_SOCKETS               7
+#define BC95_EMU_TX_FIFO_LEN               64
+#define BC95_EMU_DEFAULT_INACTIVITY_US     20000000
+#define BC95_EMU_NIDD_CID                  1
+#define BC95_EMU_MAX_BANDS                 8
+
+typedef struct {
+    uint64_t txBytes;       // host -> modem
+    uint64_t rxBytes;       // modem -> host
+    uint64_t writeCalls;    // Stream::write() calls made by the host
+    uint32_t commands;
+    uint32_t errors;
+    uint32_t urcs;
+    uint32_t datagramsSent;
+    uint32_t datagramsReceived;
+    uint32_t cpDataSent;        // AT+CSODCP
+    uint32_t cpDataReceived;    // +CRTDCP
+    uint32_t rrcConnections;
+    uint64_t rrcConnectedMicros;  // of connections released so far
+} bc95_emu_stats_t;
+
+class BC95Emulator : public Stream {
+    public:
+        BC95Emulator();
+
+        // host UART side, mirrors HardwareSerial
+        void begin(unsigned long baud);
+        void end();
+
+        // scripting
+        void setBaudRate(unsigned long baud);
+        void setCommandDelay(unsigned long us);
+        void setSpinTime(unsigned long us);
+        void setRegistrationStatus(uint8_t status);
+        void setNotifications(bool enabled);
+        void setPingResponse(uint16_t rtt, uint16_t ttl, bool success = true);
+        // AT+NUESTATS radio conditions, powers in 0.1 dBm, SNR in 0.1 dB
+        void setRadioConditions(int16_t rsrp, int16_t snr, uint8_t ecl);
+        // the cell the modem camps on, also reported by AT+NUESTATS
+        void setServingCell(uint32_t earfcn, uint16_t pci, uint8_t band);
+        // Time until registration after power-up, AT+NRB and AT+CFUN=1, a
+        // full scan of the AT+NBAND bands or a search locked by AT+NEARFCN
+        // to the serving cell. A lock to another cell never registers. A
+        // non-zero full scan starts one right away, 0 (default) registers
+        // at once.
+        void setCellSearch(unsigned long fullScanUs, unsigned long lockedUs);
+        // AT+CGMR revision, newer firmware also has AT+NSONMI=<mode> (default B656 without)
+        void setFirmware(const char *revision, bool nsonmiModes);
+        // the next count AT+NSOST(F) / AT+CSODCP fail with +CME ERROR: code (plain ERROR with AT+CMEE=0)
+        void failSends(int code, unsigned int count = 1);
+        // AT+NSOSTF takes a sequence number, reported by +NSOSTR:<socket>,<sequence>,<status>
+        // delayUs after the datagram was accepted and listed by AT+NQSOS until then
+        void setDeliveryReports(bool enabled, unsigned long delayUs);
+        // the next count numbered datagrams are reported as not sent (status 0)
+        void failDeliveries(unsigned int count = 1);
+        // a NONIP PDN context on BC95_EMU_NIDD_CID, AT+CSODCP and AT+CRTDCP work on it
+        void setControlPlane(bool enabled);
+        // +CRTDCP, false unless AT+CRTDCP=1 is in effect
+        bool queueControlPlaneDownlink(const uint8_t *data, size_t len);
+        // data of the latest AT+CSODCP
+        const std::vector<uint8_t> &lastControlPlaneData() const { return _cpUplink; }
+        bool queueDownlink(uint8_t socket, const char *remoteAddr, uint16_t remotePort, const uint8_t *data, size_t len);
+        size_t pendingDownlink(uint8_t socket);
+        // emits an unsolicited line, e.g. "+CEREG:1", right away
+        void queueURC(const char *line);
+        // radio enters/leaves PSM, reported by +NPSMR when enabled, an uplink wakes it up
+        void setPowerSaving(bool asleep);
+        // network side RRC inactivity timer, restarted by every datagram
+        void setInactivityTimer(unsigned long us);
+        bool isConnected();
+        // AT+NCONFIG / AT+NBAND writes that changed a stored setting
+        uint32_t nvramWrites() const { return _nvramWrites; }
+
+        const bc95_emu_stats_t &stats() const { return _stats; }
+        void resetStats();
+
+        // Stream
+        int available();
+        int read();
+        int peek();
+        int availableForWrite();
+        size_t write(uint8_t b);
+        size_t write(const uint8_t *buffer, size_t size);
+        using Print::write;
+        void flush();
+
+    private:
+        typedef struct {
+            uint8_t b;
+            uint64_t readyAt;
+            unsigned long baud;
+        } rx_byte_t;
+
+        typedef struct {
+            std::string remoteAddr;
+            uint16_t remotePort;
+            std::vector<uint8_t> data;
+            size_t offset;
+        } datagram_t;
+
+        typedef struct {
+            uint8_t socket;
+            uint8_t sequence;
+            bool sent;
+            uint64_t dueAt;
+        } delivery_t;
+
+        typedef struct {
+            bool open;
+            bool recvMsg;
+            uint16_t port;
+            std::deque<datagram_t> rxQueue;
+        } socket_t;
+
+        unsigned long _hostBaud;
+        unsigned long _modemBaud;
+
+        // AT+NATSPEED, the new rate applies once OK has left the modem and
+        // reverts unless a command arrives at it before confirmBy
+        struct {
+            unsigned long storedBaud;
+            unsigned long pendingBaud;
+            unsigned long previousBaud;
+            uint64_t switchAt;
+            uint64_t confirmBy;
+            bool switchPending;
+            bool confirmPending;
+            bool store;
+        } _baudSwitch;
+
+        unsigned long _commandDelay;
+        unsigned long _spin;
+        uint8_t _regStatus;
+        uint8_t _cfun;
+        uint8_t _cereg;    // AT+CEREG=<n>
+        uint8_t _cscon;    // AT+CSCON=<n>
+        uint8_t _cmee;
+        bool _autoConnect;       // AT+NCONFIG=AUTOCONNECT, kept across reboots
+        uint32_t _nvramWrites;
+        bool _echo;
+        bool _notify;
+
+        std::string _revision;
+        bool _nsonmiModes;
+        uint8_t _nsonmi;   // AT+NSONMI=<mode>, 2 sends the datagram with the URC
+
+        // numbered datagrams waiting for their +NSOSTR, in order of dueAt
+        bool _deliveryReports;
+        unsigned long _deliveryDelay;
+        unsigned int _deliveryFailures;
+        std::deque<delivery_t> _deliveries;
+
+        // NIDD, AT+CRTDCP=<reporting>
+        bool _cpEnabled;
+        bool _crtdcp;
+        std::vector<uint8_t> _cpUplink;
+
+        // inside a ';'-joined line, only the last command reports OK and the
+        // first error ends the line
+        bool _inBatch;
+        bool _batchFailed;
+
+        // AT+CPSMS / AT+CEDRXS / AT+NPSMR
+        std::string _cpsms;
+        std::string _cedrxs;
+        bool _psmReport;
+        bool _psmAsleep;
+
+        // RRC connection, released by the inactivity timer or early on an
+        // AT+NSOSTF release assistance flag
+        struct {
+            bool connected;
+            bool releaseOnDownlink;
+            uint64_t since;
+            uint64_t releaseAt;
+        } _rrc;
+        unsigned long _inactivity;
+
+        // serving cell and the search for it, AT+NEARFCN lock (earfcn 0 for none)
+        struct {
+            uint32_t earfcn;
+            uint16_t pci;
+            uint8_t band;
+            unsigned long fullScan;
+            unsigned long locked;
+            bool searching;
+            uint64_t doneAt;
+            uint32_t lockEarfcn;
+            uint16_t lockPci;
+        } _cell;
+        std::vector<uint8_t> _bands;  // AT+NBAND, kept across reboots
+
+        uint16_t _pingRtt;
+        uint16_t _pingTtl;
+        bool _pingSuccess;
+
+        int16_t _rsrp;
+        int16_t _snr;
+        uint8_t _ecl;
+        int16_t _txPower;  // of the last uplink
+
+        int _sendErrorCode;
+        unsigned int _sendErrors;
+
+        std::string _line;
+        std::deque<rx_byte_t> _in;
+        uint64_t _inTail;
+        std::multimap<uint64_t, std::string> _scheduled;
+        std::deque<rx_byte_t> _out;
+        uint64_t _outTail;
+
+        socket_t _sockets[BC95_EMU_MAX_SOCKETS];
+        bc95_emu_stats_t _stats;
+
+        uint64_t _byteTime() const;
+        void _spinWait();
+        void _updateBaud(uint64_t now);
+        void _scheduleBaud(unsigned long baud, uint64_t at, uint8_t timeout, bool store);
+        void _updateRRC(uint64_t now);
+        void _rrcActivity(uint64_t at, bool uplink, uint16_t flag);
+        std::string _ceregStatus() const;
+        void _register(uint8_t status, uint64_t at);
+        void _startSearch(uint64_t at);
+        void _updateSearch(uint64_t now);
+        void _updateDeliveries(uint64_t now);
+
+        void _drainInput();
+        void _receive(const rx_byte_t &tb);
+
+        void _pump();
+        void _emit(const std::string &text, uint64_t at);
+        void _emitLine(const std::string &line, uint64_t at);
+        void _ok(uint64_t at);
+        void _error(uint64_t at, int code);
+
+        void _process(const std::string &cmd);
+        void _processBatch(const std::string &line);
+        void _nsocr(const std::string &args, uint64_t at);
+        void _nsost(const std::string &args, bool withFlag, uint64_t at);
+        void _nsorf(const std::string &args, uint64_t at);
+        void _nqsos(const std::string &args, uint64_t at);
+        void _csodcp(const std::string &args, uint64_t at);
+        void _nuestats(uint64_t at);
+        void _nping(const std::string &args, uint64_t at);
+        void _nearfcn(const std::string &args, uint64_t at);
+        void _nband(const std::string &args, uint64_t at);
+        void _nrb(uint64_t at);
+        void _natspeed(const std::string &args, uint64_t at);
+};
+
+#endif  /* BC95_EMULATOR_H */
@@ -0,0 +1,323 @@
+/**
+ * Replays a modem traffic log recorded by QuectelBC95::StreamRecorder.
+ *
+ * Copyright (c) 2018 Sparkbit Co., Ltd. All rights reserved.
+ *
+ * This work is licensed under the terms of the MIT license.
+ * See LICENSE file in the project root for details.
+ */
+
+#include "bc95_replay.h"
+#include "bc95/recorder.h"
+
+// ----------------------------------------
+//   HostLogFile
+// ----------------------------------------
+HostLogFile::HostLogFile() {
+    _file = NULL;
+}
+
+HostLogFile::~HostLogFile() {
+    close();
+}
+
+bool HostLogFile::open(const char *path) {
+    close();
+    _file = fopen(path, "wb");
+
+    return _file != NULL;
+}
+
+void HostLogFile::close() {
+    if (_file != NULL) {
+        fclose(_file);
+        _file = NULL;
+    }
+}
+
+size_t HostLogFile::write(uint8_t b) {
+    return write(&b, 1);
+}
+
+size_t HostLogFile::write(const uint8_t *buffer, size_t size) {
+    return (_file != NULL) ? fwrite(buffer, 1, size, _file) : 0;
+}
+
+// ----------------------------------------
+//   HostModemPort
+// ----------------------------------------
+HostModemPort::HostModemPort() {
+    _stream = NULL;
+    _emulator = NULL;
+}
+
+void HostModemPort::attach(BC95Emulator *emulator) {
+    _stream = emulator;
+    _emulator = emulator;
+}
+
+void HostModemPort::attach(BC95Replay *replay) {
+    _stream = replay;
+    _emulator = NULL;
+}
+
+// only the emulator models the UART rate
+void HostModemPort::begin(unsigned long baud) {
+    if (_emulator != NULL) {
+        _emulator->begin(baud);
+    }
+}
+
+// ----------------------------------------
+//   BC95Replay
+// ----------------------------------------
+BC95Replay::BC95Replay() {
+    _speed = 1.0;
+    _started = false;
+    _startMicros = 0;
+    _rxRecord = 0;
+    _rxOffset = 0;
+    _blockedSince = 0;
+    _txRecord = 0;
+    _txOffset = 0;
+    _txPos = 0;
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+bool BC95Replay::load(const char *path) {
+    FILE *f = fopen(path, "rb");
+    uint8_t header[5];
+    uint64_t at = 0;
+    uint64_t txBytes = 0;
+    int c;
+
+    if (f == NULL) {
+        return false;
+    }
+
+    if (fread(header, 1, sizeof(header), f) != sizeof(header) || memcmp(header, "BC95", 4) != 0 || header[4] != BC95_RECORDER_VERSION) {
+        fclose(f);
+        return false;
+    }
+
+    _records.clear();
+
+    while ((c = fgetc(f)) != EOF) {
+        record_t r;
+        uint64_t delta = 0;
+        int shift = 0;
+        int b;
+
+        r.rx = (c & BC95_RECORDER_TAG_RX) != 0;
+        r.data.resize((c & 0x7F) + 1);
+
+        do {
+            b = fgetc(f);
+            if (b == EOF || shift > 35) {
+                fclose(f);
+                return false;
+            }
+            delta |= (uint64_t)(b & 0x7F) << shift;
+            shift += 7;
+        } while (b & 0x80);
+
+        // a session cut short keeps the complete records
+        if (fread(r.data.data(), 1, r.data.size(), f) != r.data.size()) {
+            break;
+        }
+
+        at += delta;
+        r.at = at;
+        r.txBefore = txBytes;
+
+        if (!r.rx) {
+            txBytes += r.data.size();
+        }
+
+        _records.push_back(r);
+    }
+
+    fclose(f);
+
+    _rxRecord = 0;
+    _rxOffset = 0;
+    _txRecord = 0;
+    _txOffset = 0;
+    _txPos = 0;
+    _started = false;
+    memset(&_stats, 0, sizeof(_stats));
+
+    _skipTx();
+
+    return true;
+}
+
+void BC95Replay::setSpeed(double speed) {
+    _speed = speed;
+}
+
+bool BC95Replay::done() const {
+    for (size_t i = _rxRecord ; i < _records.size() ; i++) {
+        if (_records[i].rx) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint64_t BC95Replay::recordedMicros() const {
+    return _records.empty() ? 0 : _records.back().at;
+}
+
+void BC95Replay::begin(unsigned long baud) {
+    (void)baud;
+}
+
+void BC95Replay::end() {
+}
+
+// the clock starts with the first byte the host touches
+void BC95Replay::_start() {
+    if (!_started) {
+        _started = true;
+        _startMicros = hostMicros();
+    }
+}
+
+// moves the rx cursor to the next modem -> host record
+void BC95Replay::_skipTx() {
+    while (_rxRecord < _records.size() && !_records[_rxRecord].rx) {
+        _rxRecord++;
+        _rxOffset = 0;
+    }
+}
+
+bool BC95Replay::_rxReady() {
+    _start();
+    _skipTx();
+
+    if (_rxRecord >= _records.size()) {
+        return false;
+    }
+
+    const record_t &r = _records[_rxRecord];
+    uint64_t now = hostMicros();
+
+    // already partly read
+    if (_rxOffset > 0) {
+        return true;
+    }
+
+    if (_speed > 0 && now - _startMicros < (uint64_t)(r.at / _speed)) {
+        return false;
+    }
+
+    if (_txPos >= r.txBefore) {
+        _blockedSince = 0;
+        return true;
+    }
+
+    // the host went a different way, don't wait for it forever
+    if (_blockedSince == 0) {
+        _blockedSince = now;
+    }
+
+    if (now - _blockedSince >= BC95_REPLAY_STALL_US) {
+        _blockedSince = 0;
+        _stats.stalls++;
+        _advanceTx(NULL, r.txBefore - _txPos);
+        return true;
+    }
+
+    return false;
+}
+
+int BC95Replay::available() {
+    if (!_rxReady()) {
+        hostAdvanceMicros(BC95_REPLAY_SPIN_US);
+        return 0;
+    }
+
+    return _records[_rxRecord].data.size() - _rxOffset;
+}
+
+int BC95Replay::read() {
+    if (!_rxReady()) {
+        hostAdvanceMicros(BC95_REPLAY_SPIN_US);
+        return -1;
+    }
+
+    const record_t &r = _records[_rxRecord];
+    uint8_t b = r.data[_rxOffset++];
+
+    if (_rxOffset >= r.data.size()) {
+        _rxRecord++;
+        _rxOffset = 0;
+    }
+
+    _stats.rxBytes++;
+
+    return b;
+}
+
+int BC95Replay::peek() {
+    if (!_rxReady()) {
+        return -1;
+    }
+
+    return _records[_rxRecord].data[_rxOffset];
+}
+
+int BC95Replay::availableForWrite() {
+    return 64;
+}
+
+void BC95Replay::_advanceTx(const uint8_t *data, size_t n) {
+    for (size_t i = 0 ; i < n ; i++) {
+        while (_txRecord < _records.size() && (_records[_txRecord].rx || _txOffset >= _records[_txRecord].data.size())) {
+            _txRecord++;
+            _txOffset = 0;
+        }
+
+        if (_txRecord >= _records.size()) {
+            if (data != NULL) {
+                _stats.txExtra++;
+            }
+            continue;
+        }
+
+        const record_t &r = _records[_txRecord];
+
+        if (data != NULL && r.data[_txOffset] != data[i]) {
+            _stats.txMismatches++;
+        }
+
+        _txOffset++;
+        _txPos++;
+
+        // the UART takes as long as it took when recorded
+        if (data != NULL && _txOffset == r.data.size() && _speed > 0) {
+            uint64_t at = _startMicros + (uint64_t)(r.at / _speed);
+
+            if (at > hostMicros()) {
+                hostAdvanceMicros(at - hostMicros());
+            }
+        }
+    }
+}
+
+size_t BC95Replay::write(uint8_t b) {
+    return write(&b, 1);
+}
+
+size_t BC95Replay::write(const uint8_t *buffer, size_t size) {
+    _start();
+    _stats.txBytes += size;
+    _advanceTx(buffer, size);
+
+    return size;
+}
+
+void BC95Replay::flush() {
+}
@@ -0,0 +1,145 @@
+/**
+ * Replays a modem traffic log recorded by QuectelBC95::StreamRecorder.
+ *
+ * BC95Replay is a Stream that stands in for the modem UART. Modem -> host
+ * bytes become readable at their recorded time on the virtual clock,
+ * divided by the speed factor, and never before the host has written the
+ * bytes recorded ahead of them, so a response doesn't overtake its
+ * command. Host -> modem bytes are compared with the recording and take
+ * until their recorded time to write, like a UART. When the
+ * host writes less than the recording expects, the next bytes are
+ * released anyway after BC95_REPLAY_STALL_US.
+ *
+ * Copyright (c) 2018 Sparkbit Co., Ltd. All rights reserved.
+ *
+ * This work is licensed under the terms of the MIT license.
+ * See LICENSE file in the project root for details.
+ */
+
+#ifndef BC95_REPLAY_H
+#define BC95_REPLAY_H
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <vector>
+
+#include "bc95_emulator.h"
+
+#define BC95_REPLAY_SPIN_US   50
+#define BC95_REPLAY_STALL_US  2000000
+
+typedef struct {
+    uint64_t txBytes;       // written by the host
+    uint64_t txMismatches;  // written bytes that differ from the recording
+    uint64_t txExtra;       // written after the recorded ones ran out
+    uint64_t rxBytes;       // read by the host
+    uint32_t stalls;        // records released without the host's write
+} bc95_replay_stats_t;
+
+// Print that appends to a file, the host counterpart of an SD card File
+class HostLogFile : public Print {
+    public:
+        HostLogFile();
+        ~HostLogFile();
+
+        bool open(const char *path);
+        void close();
+
+        size_t write(uint8_t b);
+        size_t write(const uint8_t *buffer, size_t size);
+        using Print::write;
+
+    private:
+        FILE *_file;
+};
+
+class BC95Replay : public Stream {
+    public:
+        BC95Replay();
+
+        bool load(const char *path);
+        // 1 replays at the recorded pace, 10 ten times faster, 0 as fast as
+        // the host writes
+        void setSpeed(double speed);
+        // all recorded bytes have been read
+        bool done() const;
+
+        const bc95_replay_stats_t &stats() const { return _stats; }
+        // virtual time covered by the recording
+        uint64_t recordedMicros() const;
+
+        // host UART side, the recording sets the pace whatever the rate
+        void begin(unsigned long baud);
+        void end();
+
+        // Stream
+        int available();
+        int read();
+        int peek();
+        int availableForWrite();
+        size_t write(uint8_t b);
+        size_t write(const uint8_t *buffer, size_t size);
+        using Print::write;
+        void flush();
+
+    private:
+        typedef struct {
+            bool rx;
+            uint64_t at;         // since the start of the recording
+            uint64_t txBefore;   // host bytes recorded ahead of it
+            std::vector<uint8_t> data;
+        } record_t;
+
+        std::vector<record_t> _records;
+        double _speed;
+        bool _started;
+        uint64_t _startMicros;
+
+        // next modem -> host byte
+        size_t _rxRecord;
+        size_t _rxOffset;
+        uint64_t _blockedSince;
+
+        // next expected host -> modem byte, _txPos counts the recorded
+        // ones written or skipped over by a stall
+        size_t _txRecord;
+        size_t _txOffset;
+        uint64_t _txPos;
+
+        bc95_replay_stats_t _stats;
+
+        void _start();
+        void _skipTx();
+        bool _rxReady();
+        // data NULL skips n recorded bytes without comparing
+        void _advanceTx(const uint8_t *data, size_t n);
+};
+
+// The modem port of network.cpp on the host, built with
+// -DNET_MODEM_SERIAL_TYPE=HostModemPort -DNET_MODEM_SERIAL_PORT=<name>.
+// Forwards to an emulator or a replay.
+class HostModemPort : public Stream {
+    public:
+        HostModemPort();
+
+        void attach(BC95Emulator *emulator);
+        void attach(BC95Replay *replay);
+
+        void begin(unsigned long baud);
+
+        // Stream
+        int available() { return _stream->available(); }
+        int read() { return _stream->read(); }
+        int peek() { return _stream->peek(); }
+        int availableForWrite() { return _stream->availableForWrite(); }
+        size_t write(uint8_t b) { return _stream->write(b); }
+        size_t write(const uint8_t *buffer, size_t size) { return _stream->write(buffer, size); }
+        using Print::write;
+        void flush() { _stream->flush(); }
+
+    private:
+        Stream *_stream;
+        BC95Emulator *_emulator;
+};
+
+#endif  /* BC95_REPLAY_H */
@@ -0,0 +1,261 @@
+/**
+ * Records and replays modem traffic through the network layer.
+ *
+ * Runs netInitNetwork() and a request/reply exchange loop on top of
+ * netTaskTick(). With -r the modem is the emulator and the traffic is
+ * recorded by the NET_MODEM_RECORDER tap; otherwise a log (recorded here
+ * or on a device) is replayed and the host CPU time spent in the driver
+ * is reported, e.g. to compare parser changes on a production trace.
+ * With -c the last serving cell is kept in a file between runs.
+ *
+ * Copyright (c) 2018 Sparkbit Co., Ltd. All rights reserved.
+ *
+ * This work is licensed under the terms of the MIT license.
+ * See LICENSE file in the project root for details.
+ */
+
+#include <Arduino.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "bc95/network.h"
+#include "bc95_emulator.h"
+#include "bc95_replay.h"
+
+#define TRACE_REMOTE_ADDR       "52.220.84.189"
+#define TRACE_REMOTE_PORT       5683
+#define TRACE_REPLY_TIMEOUT     5000
+#define TRACE_EXCHANGE_PERIOD   10000
+// emulated search for the cached cell, -w sets the full scan
+#define TRACE_LOCKED_SEARCH_US  2000000UL
+
+HostModemPort tracePort;
+
+static uint32_t repliesReceived;
+static unsigned long initMillis;
+static const char *cellCachePath;
+
+static bool loadCell(net_cell_info_t *cell) {
+    FILE *f = fopen(cellCachePath, "r");
+    unsigned long earfcn;
+    unsigned int pci, band;
+    bool ok;
+
+    if (f == NULL) {
+        return false;
+    }
+
+    ok = (fscanf(f, "%lu %u %u", &earfcn, &pci, &band) == 3);
+    fclose(f);
+
+    cell->earfcn = earfcn;
+    cell->pci = pci;
+    cell->band = band;
+
+    return ok;
+}
+
+static bool saveCell(const net_cell_info_t *cell) {
+    FILE *f = fopen(cellCachePath, "w");
+
+    if (f == NULL) {
+        return false;
+    }
+
+    fprintf(f, "%lu %u %u\n", (unsigned long)cell->earfcn, cell->pci, cell->band);
+
+    return fclose(f) == 0;
+}
+
+static uint64_t cpuNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void onIncomingUDPPacket(const char *srcAddrStr, uint16_t srcPort, uint16_t dstPort, const uint8_t *payload, uint16_t payloadLen) {
+    (void)srcAddrStr;
+    (void)srcPort;
+    (void)dstPort;
+    (void)payload;
+    (void)payloadLen;
+
+    repliesReceived++;
+}
+
+static void tickFor(unsigned long ms) {
+    unsigned long start = millis();
+
+    while (millis() - start < ms) {
+        netTaskTick();
+        delay(1);
+    }
+}
+
+// the application side, identical while recording and replaying so the
+// driver writes what the log expects
+static bool runSession(BC95Emulator *emu, unsigned int count, size_t payloadLen, double speed) {
+    static uint8_t payload[NET_UDP_PAYLOAD_MAX_LEN];
+
+    for (size_t i = 0 ; i < payloadLen ; i++) {
+        payload[i] = (uint8_t)(i * 7 + 3);
+    }
+
+    netSetIncomingUDPPacketHandler(onIncomingUDPPacket);
+
+    if (cellCachePath != NULL) {
+        netSetCellCacheStorage(loadCell, saveCell);
+    }
+
+    unsigned long start = millis();
+
+    if (netInitNetwork() != true) {
+        return false;
+    }
+
+    initMillis = millis() - start;
+
+    for (unsigned int i = 0 ; i < count ; i++) {
+        uint32_t replies = repliesReceived;
+        unsigned long start = millis();
+
+        netSendUDPPacket(TRACE_REMOTE_ADDR, TRACE_REMOTE_PORT, 0, payload, payloadLen);
+
+        if (emu != NULL) {
+            while (!netGetModem()->isIdle()) {
+                netTaskTick();
+            }
+
+            emu->queueDownlink(0, TRACE_REMOTE_ADDR, TRACE_REMOTE_PORT, payload, payloadLen);
+        }
+
+        while (repliesReceived == replies && millis() - start < TRACE_REPLY_TIMEOUT) {
+            netTaskTick();
+        }
+
+        // the application keeps pace with the replay
+        unsigned long period = (speed > 0) ? TRACE_EXCHANGE_PERIOD / speed : 0;
+        unsigned long elapsed = millis() - start;
+
+        if (elapsed < period) {
+            tickFor(period - elapsed);
+        }
+    }
+
+    return true;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [-r] [-x speed] [-n count] [-s payload_size] [-c cell_file] [-w scan_seconds] log\n"
+        "  -r  record from the emulator into log instead of replaying it\n"
+        "  -x  replay speed factor, 0 as fast as the driver writes (default 1)\n"
+        "  -n  request/reply exchanges (default 5)\n"
+        "  -s  payload size in bytes (default 64)\n"
+        "  -c  keep the last serving cell in cell_file, a replay needs it as it was when recording\n"
+        "  -w  emulated full band scan while recording, the cached cell is found in 2 s (default 0)\n",
+        prog);
+}
+
+int main(int argc, char *argv[]) {
+    bool record = false;
+    double speed = 1.0;
+    unsigned int count = 5;
+    size_t payloadLen = 64;
+    double scan = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "rx:n:s:c:w:h")) != -1) {
+        switch (opt) {
+            case 'r': record = true; break;
+            case 'x': speed = strtod(optarg, NULL); break;
+            case 'n': count = strtoul(optarg, NULL, 10); break;
+            case 's': payloadLen = strtoul(optarg, NULL, 10); break;
+            case 'c': cellCachePath = optarg; break;
+            case 'w': scan = strtod(optarg, NULL); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc || payloadLen == 0 || payloadLen > NET_UDP_PAYLOAD_MAX_LEN) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *path = argv[optind];
+
+    if (record) {
+        static BC95Emulator emu;
+        HostLogFile log;
+
+        if (!log.open(path)) {
+            fprintf(stderr, "cannot create %s\n", path);
+            return 1;
+        }
+
+        if (scan > 0) {
+            emu.setCellSearch(scan * 1e6, TRACE_LOCKED_SEARCH_US);
+        }
+
+        tracePort.attach(&emu);
+        netSetModemTrafficLog(&log);
+        netInit();
+
+        bool ok = runSession(&emu, count, payloadLen, 1.0);
+
+        netSetModemTrafficLog(NULL);
+        log.close();
+
+        printf("record   ok=%d replies=%u init=%.2f s elapsed=%.2f s tx=%llu B rx=%llu B\n",
+            ok,
+            repliesReceived,
+            initMillis / 1000.0,
+            millis() / 1000.0,
+            (unsigned long long)emu.stats().txBytes,
+            (unsigned long long)emu.stats().rxBytes);
+
+        return ok ? 0 : 1;
+    }
+
+    static BC95Replay replay;
+
+    if (!replay.load(path)) {
+        fprintf(stderr, "cannot load %s\n", path);
+        return 1;
+    }
+
+    replay.setSpeed(speed);
+    tracePort.attach(&replay);
+    netInit();
+
+    uint64_t c0 = cpuNanos();
+    bool ok = runSession(NULL, count, payloadLen, speed);
+
+    // whatever the log holds beyond the session, e.g. a longer device trace
+    while (!replay.done() && millis() < replay.recordedMicros() / 1000 + BC95_REPLAY_STALL_US / 1000) {
+        netTaskTick();
+    }
+
+    uint64_t cpu = cpuNanos() - c0;
+    const bc95_replay_stats_t &s = replay.stats();
+
+    printf("replay   ok=%d done=%d replies=%u init=%.2f s recorded=%.2f s replayed=%.2f s tx=%llu B rx=%llu B "
+           "mismatches=%llu extra=%llu stalls=%u cpu=%.2f ms cpu/rx_byte=%.3f us\n",
+        ok,
+        replay.done(),
+        repliesReceived,
+        initMillis / 1000.0,
+        replay.recordedMicros() / 1e6,
+        millis() / 1000.0,
+        (unsigned long long)s.txBytes,
+        (unsigned long long)s.rxBytes,
+        (unsigned long long)s.txMismatches,
+        (unsigned long long)s.txExtra,
+        s.stalls,
+        cpu / 1e6,
+        s.rxBytes ? (cpu / 1000.0) / s.rxBytes : 0.0);
+
+    return (ok && s.txMismatches == 0) ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+/**
+ * In-memory byte pipe for host-side driver measurements.
+ *
+ * A Stream that answers the next command line written to it (up to its
+ * <CR>) with bytes given up front, output is counted and dropped. Everything is inline, so BasicModem<HostPipe> can inline the
+ * I/O and the cost left per byte is the driver's own. Polling an empty
+ * pipe advances the virtual clock, so driver timeouts still expire.
+ *
+ * Copyright (c) 2018 Sparkbit Co., Ltd. All rights reserved.
+ *
+ * This work is licensed under the terms of the MIT license.
+ * See LICENSE file in the project root for details.
+ */
+
+#ifndef HOST_PIPE_H
+#define HOST_PIPE_H
+
+#include <Arduino.h>
+#include <vector>
+
+#define HOST_PIPE_EMPTY_POLL_US  50
+
+class HostPipe : public Stream {
+    public:
+        HostPipe() : _pos(0), _written(0), _replyPending(false) {}
+
+        // readable once the next <CR> is written, replaces whatever was left unread
+        void setReply(const uint8_t *data, size_t len) {
+            _reply.assign(data, data + len);
+            _replyPending = true;
+        }
+
+        uint64_t bytesWritten() const { return _written; }
+
+        int available() {
+            if (_pos == _in.size()) {
+                hostAdvanceMicros(HOST_PIPE_EMPTY_POLL_US);
+            }
+
+            return (int)(_in.size() - _pos);
+        }
+
+        int read() { return (_pos < _in.size()) ? _in[_pos++] : -1; }
+        int peek() { return (_pos < _in.size()) ? _in[_pos] : -1; }
+        int availableForWrite() { return 256; }
+        size_t write(uint8_t b) {
+            _written++;
+
+            if (b == '\r' && _replyPending) {
+                _in.swap(_reply);
+                _pos = 0;
+                _replyPending = false;
+            }
+
+            return 1;
+        }
+
+        size_t write(const uint8_t *buffer, size_t size) {
+            for (size_t i = 0 ; i < size ; i++) {
+                write(buffer[i]);
+            }
+
+            return size;
+        }
+
+        using Print::write;
+        void flush() {}
+
+    private:
+        std::vector<uint8_t> _in;
+        size_t _pos;
+        uint64_t _written;
+        std::vector<uint8_t> _reply;
+        bool _replyPending;
+};
+
+#endif  /* HOST_PIPE_H */
@@ -333,6 +333,18 @@ bool ThingClass::reportStates(const char *json) {
     return tpSendClientAttributesWriteRequest(tpGetThingInfoById(TP_THING_ID), json);
 }
 
+bool ThingClass::setPowerSavingMode(bool enabled, unsigned long periodicTau, unsigned long activeTime) {
+    return netSetPowerSavingMode(enabled, periodicTau, activeTime);
+}
+
+bool ThingClass::setExtendedDRX(bool enabled, uint8_t edrxCycle) {
+    return netSetExtendedDRX(enabled, edrxCycle);
+}
+
+bool ThingClass::isSleeping() {
+    return netIsInPowerSavingMode();
+}
+
 void ThingClass::execTask() {
     tpTaskTick();
 }
@@ -74,6 +74,14 @@ class ThingClass {
         bool reportStates(const String &json);
         bool reportStates(const char *json);
 
+        // Power saving, the modem asks the network for the timers (in seconds)
+        // and sleeps between uplinks. Commands and desired state changes are
+        // only received after an uplink, e.g. reportState().
+        bool setPowerSavingMode(bool enabled, unsigned long periodicTau = 3600, unsigned long activeTime = 60);
+        // edrxCycle is one of BC95_EDRX_CYCLE_*
+        bool setExtendedDRX(bool enabled, uint8_t edrxCycle = BC95_EDRX_CYCLE_81_92_S);
+        bool isSleeping();
+
         // continuously call this method in loop()
         void execTask();
 };
@@ -15,7 +15,148 @@ static Sparkbit::Debug dbg("NET");
 // CoAP message ID
 static uint16_t coapMessageId;
 
-static int8_t defaultSocket = -1;
+// UDP sockets, the modem socket of each local port in use
+typedef struct {
+    int8_t socket;       // -1 until the modem has opened it
+    uint16_t localPort;  // 0 for a free entry
+    void (*handler)(const char *srcAddrStr, uint16_t srcPort, uint16_t dstPort, const uint8_t *payload, uint16_t payloadLen);
+} udp_socket_t;
+
+static udp_socket_t udpSockets[NET_MAX_UDP_SOCKETS];
+
+// incoming UDP data, filled asynchronously by the modem
+static uint8_t udpRxBuf[NET_UDP_PAYLOAD_MAX_LEN];
+static QuectelBC95::udp_rx_data_t udpRxData;
+static bool udpRxInProgress = false;
+static unsigned long lastUDPRxPollMillis = 0;
+// sockets the fallback poll has yet to read, one bit per udpSockets entry
+static uint8_t udpRxPollMask = 0;
+// where the next search for incoming data starts, so one busy socket can't starve the others
+static uint8_t udpRxNextSocket = 0;
+
+// set by the REBOOT_* URC, the modem lost its sockets
+static bool modemRebooted = false;
+
+// Only the first netInitNetwork() after netInit() may keep the modem as it
+// is or lock the search to the cached cell, a later one recovers from lost
+// connectivity and resets the modem to a full scan.
+static bool firstInitNetwork = false;
+
+// +CME ERROR handling of outgoing datagrams, the modem refused these
+// without transmitting anything
+static const net_error_policy_t defaultErrorPolicies[] = {
+    // transient, one more try is likely to go through
+    { QuectelBC95::CME_ERROR_UPLINK_BUSY,          NET_ERROR_ACTION_RETRY,         3, 1000 },
+    { QuectelBC95::CME_ERROR_MEMORY_FAILURE,       NET_ERROR_ACTION_RETRY,         3, 500 },
+    { QuectelBC95::CME_ERROR_NO_NETWORK_SERVICE,   NET_ERROR_ACTION_RETRY,         2, 2000 },
+    { QuectelBC95::CME_ERROR_AT_INTERNAL_ERROR,    NET_ERROR_ACTION_RETRY,         1, 200 },
+    { QuectelBC95::CME_ERROR_COMMAND_INTERRUPTED,  NET_ERROR_ACTION_RETRY,         1, 200 },
+    { QuectelBC95::CME_ERROR_UART_PARITY_ERROR,    NET_ERROR_ACTION_RETRY,         1, 0 },
+    { QuectelBC95::CME_ERROR_UART_FRAME_ERROR,     NET_ERROR_ACTION_RETRY,         1, 0 },
+    // the modem no longer knows the socket
+    { QuectelBC95::CME_ERROR_SOCKET_NOT_ALLOCATED, NET_ERROR_ACTION_REOPEN_SOCKET, 0, 0 },
+    // no PDN connection to send on
+    { QuectelBC95::CME_ERROR_TUP_NOT_REGISTERED,   NET_ERROR_ACTION_REATTACH,      0, 0 },
+    { QuectelBC95::CME_ERROR_CID_IS_NOT_ACTIVE,    NET_ERROR_ACTION_REATTACH,      0, 0 },
+    { QuectelBC95::CME_ERROR_MT_NOT_POWERED_ON,    NET_ERROR_ACTION_REATTACH,      0, 0 }
+    // anything else, e.g. CME_ERROR_INCORRECT_PARAMETERS, would fail again
+};
+
+static const net_error_policy_t *errorPolicies = defaultErrorPolicies;
+static uint8_t errorPolicyCount = sizeof(defaultErrorPolicies) / sizeof(defaultErrorPolicies[0]);
+
+// recovery asked for by the error policy, done once the modem queue is empty
+static uint8_t udpReopenMask = 0;
+static bool modemReattachPending = false;
+
+// A datagram that found the modem queue full or that the error policy sends
+// again, queued from netTaskTick() once there is room and delay has passed.
+typedef struct {
+    bool active;
+    char dstAddr[16];
+    uint16_t dstPort;
+    uint16_t srcPort;
+    uint16_t flag;        // BC95_NSOST_FLAG_*, the RAI for NIDD
+    uint8_t retries;      // 0 unless the error policy sends it again
+    uint8_t sequence;     // kept by a retry
+    unsigned long sinceMillis;
+    unsigned long delay;
+    uint16_t payloadLen;
+    uint8_t payload[BC95_ASYNC_DATA_BUF_LEN];
+} pending_udp_packet_t;
+
+static pending_udp_packet_t pendingUDPPacket;
+// retries of the one datagram being sent again, parked or queued, 0 for none
+static uint8_t udpTxRetries = 0;
+
+#ifdef NET_NIDD
+// cid of the NONIP PDN context, -1 without one
+static int16_t niddCid = -1;
+#endif
+
+#ifdef NET_UDP_DELIVERY_REPORTS
+static net_send_handle_t lastSendHandle = 0;
+static void (*hDelivery)(net_send_handle_t handle, uint8_t status) = NULL;
+#endif
+
+#ifdef NET_CELL_CACHE
+static bool (*cellCacheLoad)(net_cell_info_t *cell) = NULL;
+// AT+NEARFCN was set since netInit()
+static bool cellLockApplied = false;
+static bool (*cellCacheSave)(const net_cell_info_t *cell) = NULL;
+// what the storage holds, read once
+static net_cell_info_t cachedCell;
+static bool cachedCellValid = false;
+#endif
+
+// UART rate the modem is believed to run at, stored in the modem by
+// AT+NATSPEED so it survives _netResetModem()
+static uint32_t modemBaud = NET_MODEM_SERIAL_BAUD;
+
+// AT+NATSPEED candidates, fastest first
+static const uint32_t modemBaudRates[] = { 230400, 115200, 57600, NET_MODEM_SERIAL_BAUD };
+
+// power saving settings requested by the application, applied again after a reset
+typedef struct {
+    bool psmRequested;
+    bool psmEnabled;
+    uint32_t periodicTau;
+    uint32_t activeTime;
+    bool edrxRequested;
+    bool edrxEnabled;
+    uint8_t edrxCycle;
+} power_config_t;
+
+static power_config_t powerConfig;
+
+// CoAP ping in progress
+typedef struct {
+    bool active;
+    bool done;
+    bool success;
+    uint16_t messageId;
+    unsigned long startMillis;
+    unsigned long timeout;
+    void (*callback)(bool success);
+} coap_ping_t;
+
+static coap_ping_t coapPing;
+
+// AT+NPING in progress
+static QuectelBC95::ping_response_t hostPingRsp;
+static void (*hostPingCallback)(bool success, uint16_t rtt);
+
+// AT+NUESTATS sampler, sums feed the averages
+typedef struct {
+    int32_t sum;
+    uint16_t count;
+} radio_stat_sum_t;
+
+static net_radio_stats_t radioStats;
+static radio_stat_sum_t radioStatSums[5];  // rsrp, snr, rsrq, txPower, ecl
+static QuectelBC95::nuestats_t radioStatsSample;
+static bool radioStatsInProgress = false;
+static unsigned long radioStatsInterval = NET_RADIO_STATS_DEFAULT_INTERVAL;
 
 // CoAP message ID table
 #ifdef NET_COAP_IGNORE_DUPLICATE_INCOMING_MSG_ID
@@ -30,6 +171,20 @@ static recv_msg_id_t coapMsgTrackingList[NET_COAP_RECEIVED_MSG_ID_LIST_LEN];
 static uint8_t msgTrackingNewEntryPos = 0;
 #endif
 
+// confirmable messages sent and not yet answered
+#ifdef NET_COAP_RELEASE_ASSISTANCE
+typedef struct {
+    bool active;
+    uint16_t messageId;
+    unsigned long tsMillis;
+  #ifdef NET_UDP_DELIVERY_REPORTS
+    net_send_handle_t handle;
+  #endif
+} outstanding_con_t;
+
+static outstanding_con_t coapOutstandingList[NET_COAP_OUTSTANDING_CON_LIST_LEN];
+#endif
+
 // handlers
 static void (*hIncomingUDPPacket)(const char *srcAddrStr, uint16_t srcPort, uint16_t dstPort, const uint8_t *payload, uint16_t payloadLen) = NULL;
 static void (*hIncomingCoAPMessage)(const char *srcAddrStr, uint16_t srcPort, uint16_t dstPort, CoapPDU *message) = NULL;
@@ -37,7 +192,10 @@ static void (*hIncomingCoAPMessage)(const char *srcAddrStr, uint16_t srcPort, ui
 // ----------------------------------------
 //   Modem
 // ----------------------------------------
-#if defined(__AVR__)
+#if defined(NET_MODEM_SERIAL_TYPE) && defined(NET_MODEM_SERIAL_PORT)
+    extern NET_MODEM_SERIAL_TYPE NET_MODEM_SERIAL_PORT;
+    static NET_MODEM_SERIAL_TYPE &mdmPort = NET_MODEM_SERIAL_PORT;
+#elif defined(__AVR__)
     #include <SoftwareSerial.h>
     #warning "Using SoftwareSerial to communicate with the modem (RX=8, TX=9)"
     static SoftwareSerial mdmPort(8, 9);
@@ -55,15 +213,32 @@ static void (*hIncomingCoAPMessage)(const char *srcAddrStr, uint16_t srcPort, ui
     #error "Please define your modem serial port"
 #endif
 
-static QuectelBC95::Modem modem(&mdmPort);
+// bytes written or read outside the modem driver go through mdmStream too,
+// mdmPort is only used to set the UART rate
+#ifdef NET_MODEM_RECORDER
+    static QuectelBC95::StreamRecorder mdmTap(&mdmPort);
+    static Stream &mdmStream = mdmTap;
+#else
+    static Stream &mdmStream = mdmPort;
+#endif
+
+static QuectelBC95::Modem modem(&mdmStream);
 
 QuectelBC95::Modem *netGetModem() {
     return &modem;
 }
 
+#ifdef NET_MODEM_RECORDER
+void netSetModemTrafficLog(Print *log) {
+    mdmTap.setLog(log);
+}
+#endif
+
 // ----------------------------------------
 //   Initialization
 // ----------------------------------------
+void _netOnModemRebooted(const char *line, size_t lineLen, void *arg);
+
 void netInit() {
     coapMessageId = random(0xFFFF);
     
@@ -71,11 +246,55 @@ void netInit() {
     pinMode(NET_MODEM_RESET_PIN, OUTPUT);
     digitalWrite(NET_MODEM_RESET_PIN, LOW);
 
-    mdmPort.begin(NET_MODEM_SERIAL_BAUD);
+    mdmPort.begin(modemBaud);
+
+    modem.setURCHandler("REBOOT_", _netOnModemRebooted);
+
+    firstInitNetwork = true;
+
+    for (int i = 0 ; i < NET_MAX_UDP_SOCKETS ; i++) {
+        udpSockets[i].socket = -1;
+        udpSockets[i].localPort = 0;
+        udpSockets[i].handler = NULL;
+    }
+}
+
+void _netOnModemRebooted(const char *line, size_t lineLen, void *arg) {
+    (void)line;
+    (void)lineLen;
+    (void)arg;
+
+    modemRebooted = true;
+}
+
+// next slower rate the host supports, wraps around to the fastest one
+uint32_t _netNextModemBaud(uint32_t baud) {
+    uint8_t count = sizeof(modemBaudRates) / sizeof(modemBaudRates[0]);
+    uint8_t first = 0;
+
+    while (modemBaudRates[first] > NET_MODEM_SERIAL_MAX_BAUD) {
+        first++;
+    }
+
+    for (uint8_t i = first ; i < count - 1 ; i++) {
+        if (modemBaudRates[i] == baud) {
+            return modemBaudRates[i + 1];
+        }
+    }
+
+    return modemBaudRates[first];
 }
 
+bool _netConfigModem();
+void _netCancelUDPPackets();
+void _netOnDelivery(uint8_t socket, uint8_t sequence, uint8_t status, void *arg);
+
 bool _netResetModem() {
     unsigned long startMillis;
+    uint8_t attempts = 0;
+
+    // anything queued for the old session is meaningless after the reset
+    _netCancelUDPPackets();
 
     digitalWrite(NET_MODEM_RESET_PIN, HIGH);
     delay(100);
@@ -88,32 +307,153 @@ bool _netResetModem() {
             return false;
         }
 
+        // the modem may run at a rate stored by an earlier AT+NATSPEED,
+        // give every rate two chances while it boots
+        if (++attempts % 2 == 0) {
+            modemBaud = _netNextModemBaud(modemBaud);
+            mdmPort.begin(modemBaud);
+        }
+
         // purge any tx/rx buffer garbages
-        mdmPort.print("\r\r\r");
+        mdmStream.print("\r\r\r");
         delay(100);
 
-        while (mdmPort.read() != -1) {
+        while (mdmStream.read() != -1) {
             if (millis() - startMillis > NET_MODEM_RESET_TIMEOUT) {
                 return false;
             }
         }
+
+        modem.discardInput();
     }
 
-    if (modem.setErrorResponseFormat(0) != true) {
+    if (_netConfigModem() != true) {
         return false;
     }
 
-    if (modem.configAutoConnect(true) != true) {
+    // the reboot was ours
+    modemRebooted = false;
+
+    return true;
+}
+
+#ifdef NET_NIDD
+// NIDD goes over the first NONIP context, +CRTDCP reporting doesn't survive
+// a modem reset
+void _netConfigNIDD() {
+    niddCid = modem.readNonIPContextId();
+
+    // without BC95_INLINE_RX_BUF_LEN NIDD is uplink only
+    if (niddCid >= 0 && modem.setControlPlaneDataReporting(true) != true) {
+      #ifdef NET_DBG_INIT_NETWORK
+        dbg.println("NIDD downlink not available");
+      #endif
+    }
+}
+#else
+void _netConfigNIDD() {}
+#endif
+
+// Settings that don't survive a modem reset, plus AUTOCONNECT which does and
+// is only written when it differs (NVRAM).
+bool _netConfigModem() {
+    bool autoConnect;
+
+    // one line instead of a round trip per command
+    QuectelBC95::batch_command_t bringUp[] = {
+        // numeric +CME ERROR codes for the error policy table
+        { "AT+CMEE=1", NULL, 0, 0 },
+        // +NPSMR tells when downlink data cannot arrive, not fatal on firmware without it
+        { "AT+NPSMR=1", NULL, 0, 0 }
+    };
+
+    modem.sendCommandBatch(bringUp, sizeof(bringUp) / sizeof(bringUp[0]));
+
+    if (bringUp[0].rspType != BC95_RESPONSE_TYPE_OK) {
         return false;
     }
 
+    if (modem.readAutoConnect(&autoConnect) != true || autoConnect != true) {
+        if (modem.configAutoConnect(true) != true) {
+            return false;
+        }
+    }
+
+    // registration and radio state are kept up to date by URCs, netIsNetworkReady()
+    // polls AT+CEREG? instead if this fails
+    modem.enableStateReporting();
+
+    // datagrams come with +NSONMI where the firmware can, B656 keeps AT+NSORF
+    modem.probeCapabilities();
+
+    _netConfigNIDD();
+
+  #ifdef NET_UDP_DELIVERY_REPORTS
+    modem.setDeliveryCallback(_netOnDelivery);
+  #endif
+
+    if (powerConfig.psmRequested) {
+        modem.setPowerSavingMode(powerConfig.psmEnabled, powerConfig.periodicTau, powerConfig.activeTime);
+    }
+
+    if (powerConfig.edrxRequested) {
+        modem.setExtendedDRX(powerConfig.edrxEnabled, powerConfig.edrxCycle);
+    }
+
     return true;
 }
 
+// Moves the link to the fastest rate both ends support. The modem falls
+// back to the old rate by itself when AT doesn't get through at the new one.
+void _netNegotiateModemBaud() {
+    for (uint8_t i = 0 ; i < sizeof(modemBaudRates) / sizeof(modemBaudRates[0]) ; i++) {
+        uint32_t baud = modemBaudRates[i];
+
+        if (baud > NET_MODEM_SERIAL_MAX_BAUD) {
+            continue;
+        }
+
+        if (baud <= modemBaud) {
+            return;
+        }
+
+        if (modem.setUARTBaudRate(baud, NET_MODEM_BAUD_SWITCH_TIMEOUT, true) != true) {
+            continue;
+        }
+
+        mdmPort.begin(baud);
+        modem.discardInput();
+
+        for (uint8_t retry = 0 ; retry < 3 ; retry++) {
+            if (modem.pingModem() == true) {
+                modemBaud = baud;
+                return;
+            }
+        }
+
+        // wait for the modem to return to the old rate
+        mdmPort.begin(modemBaud);
+        delay(NET_MODEM_BAUD_SWITCH_TIMEOUT * 1000UL + 500);
+        modem.discardInput();
+
+        if (modem.pingModem() != true) {
+            return;
+        }
+    }
+}
+
 #ifdef NET_DBG_VERBOSE_MODEM_INFO
 void _netPrintModemInfo() {
     char rspBuf[64];
 
+    dbg
+        .print("Firmware: ")
+        .tagOff()
+        .print(modem.firmwareRevision())
+        .print(", capabilities=")
+        .hexByte(modem.capabilities(), true)
+        .tagOn();
+
     if (modem.readInternationalMobileStationEquipmentIdentity(rspBuf, sizeof(rspBuf)) == true) {
         dbg
             .print("IMEI: ")
@@ -167,15 +507,219 @@ void _netPrintNetworkInfo() {
 void _netPrintNetworkInfo() {}
 #endif
 
-bool _netConfigDefaultSocket() {
-    // create a default socket, enable data receiving
-    defaultSocket = modem.createSocket(NET_DEFAULT_SOCKET_LOCAL_PORT, true);
+udp_socket_t *_netReserveSocket(uint16_t localPort);
+bool _netReopenSockets();
+
+// the default socket and any other one opened before, after a modem reset
+bool _netConfigSockets() {
+    udp_socket_t *defaultSocket = _netReserveSocket(NET_DEFAULT_SOCKET_LOCAL_PORT);
+
+    _netReopenSockets();
+
+    return defaultSocket != NULL && defaultSocket->socket >= 0;
+}
+
+#ifdef NET_MODEM_WARM_START
+// Looks for the modem at every rate it may have stored, without a reset.
+bool _netProbeModem() {
+    uint8_t count = sizeof(modemBaudRates) / sizeof(modemBaudRates[0]);
+
+    for (int8_t i = -1 ; i < count ; i++) {
+        // the rate believed current first
+        uint32_t baud = (i < 0) ? modemBaud : modemBaudRates[i];
+
+        if (baud > NET_MODEM_SERIAL_MAX_BAUD || (i >= 0 && baud == modemBaud)) {
+            continue;
+        }
+
+        mdmPort.begin(baud);
+
+        // ends whatever half line the MCU reset left behind
+        mdmStream.print("\r");
+        delay(20);
+        modem.discardInput();
+
+        if (modem.pingModem() == true) {
+            modemBaud = baud;
+            return true;
+        }
+    }
+
+    mdmPort.begin(modemBaud);
+
+    return false;
+}
+
+// The MCU was reset on its own (watchdog, firmware update) while the modem
+// kept its registration, the reset pin is left alone. B656 can't list the
+// sockets of the previous session, they are closed when one is in the way.
+bool _netWarmStart() {
+    QuectelBC95::pdp_addr_t addr;
+
+    if (_netProbeModem() != true) {
+        return false;
+    }
+
+    // a no-op once the fastest rate is stored
+    _netNegotiateModemBaud();
+
+    // anything queued for the old session is meaningless now
+    _netCancelUDPPackets();
+    modemRebooted = false;
+
+    if (_netConfigModem() != true) {
+        return false;
+    }
+
+    if (netIsNetworkReady() != true || modem.readPDPAddress(0, &addr) != true || addr.addr.intVal == 0) {
+        return false;
+    }
+
+    if (_netConfigSockets() != true) {
+        for (uint8_t socket = 0 ; socket < BC95_MAX_SOCKETS ; socket++) {
+            modem.closeSocket(socket);
+        }
+
+        if (_netConfigSockets() != true) {
+            return false;
+        }
+    }
+
+    return true;
+}
+#endif
+
+#ifdef NET_CELL_CACHE
+bool _netLoadCachedCell() {
+    if (!cachedCellValid && cellCacheLoad != NULL) {
+        cachedCellValid = cellCacheLoad(&cachedCell);
+    }
+
+    return cachedCellValid;
+}
+
+// Restarts the search on the EARFCN of the cached cell, the modem is
+// searching all bands since the reset. Any cell on it will do, so the modem
+// can still reselect once attached. False when there is nothing to lock to.
+bool _netLockCachedCell() {
+    uint8_t bands[BC95_MAX_BANDS];
+    uint8_t count;
+    uint8_t i;
+    bool locked;
+
+    if (_netLoadCachedCell() != true) {
+        return false;
+    }
+
+    // the band was taken off the list (AT+NBAND) since the cell was saved,
+    // firmware that can't list them is trusted
+    count = modem.readBands(bands, sizeof(bands));
+
+    for (i = 0 ; i < count ; i++) {
+        if (bands[i] == cachedCell.band) {
+            break;
+        }
+    }
+
+    if (count > 0 && i == count) {
+        return false;
+    }
+
+    // AT+NEARFCN is refused with the radio on
+    if (modem.setPhoneFunctionality(BC95_CFUN_MINIMUM) != true) {
+        return false;
+    }
+
+    locked = modem.setEARFCNLock(cachedCell.earfcn);
+    cellLockApplied = cellLockApplied || locked;
 
-    return defaultSocket >= 0;
+    modem.setPhoneFunctionality(BC95_CFUN_FULL);
+    modem.attachPS();
+
+    return locked;
+}
+
+void _netUnlockCell() {
+    modem.setPhoneFunctionality(BC95_CFUN_MINIMUM);
+    modem.clearEARFCNLock();
+    modem.setPhoneFunctionality(BC95_CFUN_FULL);
+    modem.attachPS();
+
+    cellLockApplied = false;
+}
+
+// the reset should have dropped the lock already, the recovery must not
+// depend on it
+void _netClearCellLock() {
+    if (cellLockApplied) {
+        _netUnlockCell();
+    }
+}
+
+// stored only when it differs from the cached cell, storage may be flash
+void _netSaveServingCell() {
+    QuectelBC95::nuestats_t stats;
+    net_cell_info_t cell;
+
+    if (cellCacheSave == NULL || modem.readUEStatistics(&stats) != true) {
+        return;
+    }
+
+    cell.earfcn = stats.earfcn;
+    cell.pci = stats.pci;
+    cell.band = QuectelBC95::Modem::bandOfEARFCN(stats.earfcn);
+
+    if (cell.band == 0) {
+        return;
+    }
+
+    if (_netLoadCachedCell() == true &&
+        cachedCell.earfcn == cell.earfcn && cachedCell.pci == cell.pci && cachedCell.band == cell.band) {
+        return;
+    }
+
+    if (cellCacheSave(&cell) == true) {
+        cachedCell = cell;
+        cachedCellValid = true;
+
+      #ifdef NET_DBG_INIT_NETWORK
+        dbg.print("Cell saved").tagOff().print(", EARFCN=").print(cell.earfcn).print(", PCI=").print(cell.pci).print(", band=").println(cell.band).tagOn();
+      #endif
+    }
 }
 
+void netSetCellCacheStorage(bool (*load)(net_cell_info_t *cell), bool (*save)(const net_cell_info_t *cell)) {
+    cellCacheLoad = load;
+    cellCacheSave = save;
+    cachedCellValid = false;
+}
+#else
+bool _netLockCachedCell() { return false; }
+void _netUnlockCell() {}
+void _netClearCellLock() {}
+void _netSaveServingCell() {}
+#endif
+
 bool netInitNetwork() {
     unsigned long startMillis = millis();
+    unsigned long lockMillis;
+    bool cellLocked;
+
+    bool firstInit = firstInitNetwork;
+
+    firstInitNetwork = false;
+
+  #ifdef NET_MODEM_WARM_START
+    if (firstInit && _netWarmStart() == true) {
+      #ifdef NET_DBG_INIT_NETWORK
+        dbg.print("Modem still registered, UART: ").tagOff().print(modemBaud).println(" baud").tagOn();
+      #endif
+
+        _netSaveServingCell();
+
+        return true;
+    }
+  #endif
 
   #ifdef NET_DBG_INIT_NETWORK
     dbg.print("Resetting the modem ... ");
@@ -195,94 +739,768 @@ bool netInitNetwork() {
         return false;
     }
 
+    // stays at the current rate when the switch fails
+    _netNegotiateModemBaud();
+
+  #ifdef NET_DBG_INIT_NETWORK
+    dbg.print("Modem UART: ").tagOff().print(modemBaud).println(" baud").tagOn();
+  #endif
+
   #if defined(NET_DBG_INIT_NETWORK) && defined(NET_DBG_VERBOSE_MODEM_INFO)
     _netPrintModemInfo();
   #endif
     
+    // the cached cell may be the one connectivity was lost on
+    if (firstInit) {
+        cellLocked = _netLockCachedCell();
+    }
+    else {
+        cellLocked = false;
+        _netClearCellLock();
+    }
+
+    lockMillis = millis();
+
   #ifdef NET_DBG_INIT_NETWORK
+    if (cellLocked) {
+        dbg.println("Searching the cached cell");
+    }
+
     dbg.print("Connecting ");
   #endif
 
-    // wait for the network to be ready
-    while (1) {
-        if (netIsNetworkReady() == true) {
-            // TODO workaround, waiting for the modem to be ready
-            delay(3000);
+    // wait for the network to be ready
+    while (1) {
+        if (netIsNetworkReady() == true) {
+            // TODO workaround, waiting for the modem to be ready
+            delay(3000);
+
+          #ifdef NET_DBG_INIT_NETWORK
+            dbg.noTagOnce().println(" OK");
+          #endif
+
+            break;
+        }
+
+        if (labs(millis() - startMillis) >= NET_DEFAULT_INIT_NETWORK_TIMEOUT) {
+          #ifdef NET_DBG_INIT_NETWORK
+            dbg.noTagOnce().println(" Failed");
+          #endif
+            
+            return false;
+        }
+
+        if (cellLocked && labs(millis() - lockMillis) >= NET_CELL_LOCK_TIMEOUT) {
+            cellLocked = false;
+            _netUnlockCell();
+
+          #ifdef NET_DBG_INIT_NETWORK
+            dbg.noTagOnce().print(" (cached cell not found, scanning) ");
+          #endif
+        }
+
+      #ifdef NET_DBG_INIT_NETWORK
+        dbg.noTagOnce().print(".");
+      #endif
+        
+        delay(1000);
+    }
+
+  #if defined(NET_DBG_INIT_NETWORK) && defined(NET_DBG_VERBOSE_NETWORK_INFO)
+    _netPrintNetworkInfo();
+  #endif
+
+    _netSaveServingCell();
+
+    if (_netConfigSockets() != true) {
+        return false;
+    }
+
+    // all done
+    return true;
+}
+
+// answered from the modem state cache, no command is sent in steady state
+bool netIsNetworkReady() {
+    return modem.readNetworkRegistrationStatus() == BC95_NETWORK_STAT_REGISTERED;
+}
+
+// ----------------------------------------
+//   General
+// ----------------------------------------
+bool netPingHost(const char *ipAddress, unsigned long timeout) {
+    if (netStartPingHost(ipAddress, timeout, NULL) != true) {
+        return false;
+    }
+
+    while (modem.pingStatus() == BC95_PING_STATUS_IN_PROGRESS) {
+        netTaskTick();
+    }
+
+    return modem.pingStatus() == BC95_PING_STATUS_SUCCESS;
+}
+
+void _netOnPingDone(bool success, QuectelBC95::ping_response_t *rsp, void *arg) {
+    (void)arg;
+
+    if (hostPingCallback != NULL) {
+        hostPingCallback(success, success ? rsp->rtt : 0);
+    }
+}
+
+bool netStartPingHost(const char *ipAddress, unsigned long timeout, void (*callback)(bool success, uint16_t rtt)) {
+    if (modem.pingHostAsync(ipAddress, &hostPingRsp, _netOnPingDone, NULL, timeout) != true) {
+        return false;
+    }
+
+    hostPingCallback = callback;
+
+    return true;
+}
+
+// ----------------------------------------
+//   UDP
+// ----------------------------------------
+uint16_t _netLocalPort(uint16_t port) {
+    return (port == 0) ? NET_DEFAULT_SOCKET_LOCAL_PORT : port;
+}
+
+udp_socket_t *_netFindSocket(uint16_t localPort) {
+    for (int i = 0 ; i < NET_MAX_UDP_SOCKETS ; i++) {
+        if (udpSockets[i].localPort == localPort) {
+            return &udpSockets[i];
+        }
+    }
+
+    return NULL;
+}
+
+udp_socket_t *_netFindSocketById(uint8_t socket) {
+    for (int i = 0 ; i < NET_MAX_UDP_SOCKETS ; i++) {
+        if (udpSockets[i].localPort != 0 && udpSockets[i].socket == socket) {
+            return &udpSockets[i];
+        }
+    }
+
+    return NULL;
+}
+
+// table entry for localPort, the modem socket is not opened yet
+udp_socket_t *_netReserveSocket(uint16_t localPort) {
+    udp_socket_t *entry = _netFindSocket(localPort);
+
+    if (entry == NULL) {
+        entry = _netFindSocket(0);
+
+        if (entry == NULL) {
+            return NULL;
+        }
+
+        entry->socket = -1;
+        entry->localPort = localPort;
+        entry->handler = NULL;
+    }
+
+    return entry;
+}
+
+// table entry for localPort with its modem socket open, NULL when either fails
+udp_socket_t *_netOpenSocket(uint16_t localPort) {
+    udp_socket_t *entry = _netReserveSocket(localPort);
+
+    if (entry == NULL || entry->socket >= 0) {
+        return entry;
+    }
+
+    entry->socket = modem.createSocket(localPort, true);
+
+    if (entry->socket < 0) {
+      #ifdef NET_DBG_UDP_OUTGOING
+        dbg.print("UDP socket failed").tagOff().print(", port=").println(localPort).tagOn();
+      #endif
+
+        // the default socket keeps its entry, it is opened again after a reset
+        if (localPort != NET_DEFAULT_SOCKET_LOCAL_PORT) {
+            entry->localPort = 0;
+        }
+
+        return NULL;
+    }
+
+    return entry;
+}
+
+// the modem has no sockets after a reset or reboot, opens the ones in the table again
+bool _netReopenSockets() {
+    bool success = true;
+
+    udpRxPollMask = 0;
+    udpReopenMask = 0;
+
+    for (int i = 0 ; i < NET_MAX_UDP_SOCKETS ; i++) {
+        udp_socket_t *entry = &udpSockets[i];
+
+        if (entry->localPort == 0) {
+            continue;
+        }
+
+        entry->socket = modem.createSocket(entry->localPort, true);
+
+        if (entry->socket < 0) {
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+bool netOpenUDPSocket(uint16_t localPort, void (*handler)(const char *srcAddrStr, uint16_t srcPort, uint16_t dstPort, const uint8_t *payload, uint16_t payloadLen)) {
+    udp_socket_t *entry = _netOpenSocket(_netLocalPort(localPort));
+
+    if (entry == NULL) {
+        return false;
+    }
+
+    entry->handler = handler;
+
+    return true;
+}
+
+bool netCloseUDPSocket(uint16_t localPort) {
+    udp_socket_t *entry = _netFindSocket(_netLocalPort(localPort));
+
+    if (entry == NULL) {
+        return false;
+    }
+
+    // waits for datagrams still queued for it
+    if (entry->socket >= 0) {
+        modem.closeSocket(entry->socket);
+    }
+
+    entry->socket = -1;
+    entry->localPort = 0;
+    entry->handler = NULL;
+
+    return true;
+}
+
+void _netOnUDPPacketSent(int rspType, const char *rspBuf, size_t rspLen, void *arg);
+void _netCoAPDeliveryFailed(net_send_handle_t handle);
+const net_error_policy_t *_netApplyErrorPolicy(QuectelBC95::cme_error_t error, udp_socket_t *entry, uint8_t retries);
+bool _netSendUDPPacket(const char *dstAddrStr, uint16_t dstPort, uint16_t srcPort, const uint8_t *payload, uint16_t payloadLen, uint16_t flag);
+bool _netParkUDPPacket(const char *dstAddrStr, uint16_t dstPort, uint16_t srcPort, const uint8_t *payload, uint16_t payloadLen, uint16_t flag);
+
+bool netSendUDPPacket(const char *dstAddrStr, uint16_t dstPort, uint16_t srcPort, const uint8_t *payload, uint16_t payloadLen) {
+    return _netSendUDPPacket(dstAddrStr, dstPort, srcPort, payload, payloadLen, BC95_NSOST_FLAG_NONE);
+}
+
+#ifdef NET_UDP_DELIVERY_REPORTS
+net_send_handle_t netLastSendHandle() {
+    return lastSendHandle;
+}
+
+uint8_t netGetDeliveryStatus(net_send_handle_t handle) {
+    if (handle == 0) {
+        return BC95_DELIVERY_UNKNOWN;
+    }
+
+    return modem.deliveryStatus(handle >> 8, handle & 0xFF);
+}
+
+void netSetDeliveryHandler(void (*handler)(net_send_handle_t handle, uint8_t status)) {
+    hDelivery = handler;
+}
+
+// from modem.poll(), i.e. netTaskTick()
+void _netOnDelivery(uint8_t socket, uint8_t sequence, uint8_t status, void *arg) {
+    (void)arg;
+
+    net_send_handle_t handle = ((net_send_handle_t)socket << 8) | sequence;
+
+  #ifdef NET_DBG_UDP_OUTGOING
+    dbg.print("UDP DELIVERY").tagOff().print(", socket=").print(socket).print(", seq=").print(sequence).print(", status=").println(status).tagOn();
+  #endif
+
+    if (status == BC95_DELIVERY_FAILED) {
+        _netCoAPDeliveryFailed(handle);
+    }
+
+    if (hDelivery != NULL) {
+        hDelivery(handle, status);
+    }
+}
+#endif
+
+#ifdef NET_NIDD
+bool netIsNIDDAvailable() {
+    return niddCid >= 0;
+}
+
+// the release flags map to the AT+CSODCP release assistance indication
+bool _netSendNIDDPacket(const uint8_t *payload, uint16_t payloadLen, uint16_t flag) {
+    uint8_t rai = BC95_CSODCP_RAI_NONE;
+
+  #ifdef NET_DBG_UDP_OUTGOING
+    dbg
+        .print("NIDD SEND")
+        .tagOff()
+        .print(", cid=")
+        .print(niddCid)
+        .print(", flag=")
+        .hexShort(flag, true, false)
+        .print(", payload=")
+        .hexDump(payload, payloadLen)
+        .tagOn();
+  #endif
+
+    if (niddCid < 0) {
+        return false;
+    }
+
+    if (flag & BC95_NSOST_FLAG_RELEASE_AFTER_NEXT_MSG) {
+        rai = BC95_CSODCP_RAI_NO_UL_DL;
+    }
+    else if (flag & BC95_NSOST_FLAG_RELEASE_AFTER_REPLIED) {
+        rai = BC95_CSODCP_RAI_ONE_DL;
+    }
+
+    // the error policy applies as for UDP, without a socket to reopen
+    if (modem.sendControlPlaneDataAsync(niddCid, payload, payloadLen, _netOnUDPPacketSent, NULL, rai) == true) {
+        return true;
+    }
+
+    if (modem.isAsyncQueueFull()) {
+        return _netParkUDPPacket(NET_NIDD_ADDR, 0, 0, payload, payloadLen, rai);
+    }
+
+    // too large for the asynchronous queue, nothing may be queued ahead of it
+    if (!modem.isIdle()) {
+        return false;
+    }
+
+    if (modem.sendControlPlaneData(niddCid, payload, payloadLen, rai) == true) {
+        return true;
+    }
+
+    // can't be parked for a retry, the recovery still applies
+    _netApplyErrorPolicy(modem.lastError(), NULL, 0);
+
+    return false;
+}
+#endif
+
+void _netSetLastSendHandle(uint8_t socket, uint8_t sequence) {
+  #ifdef NET_UDP_DELIVERY_REPORTS
+    lastSendHandle = (sequence != 0) ? (((net_send_handle_t)socket << 8) | sequence) : 0;
+  #else
+    (void)socket;
+    (void)sequence;
+  #endif
+}
+
+// flag is one of BC95_NSOST_FLAG_*
+bool _netSendUDPPacket(const char *dstAddrStr, uint16_t dstPort, uint16_t srcPort, const uint8_t *payload, uint16_t payloadLen, uint16_t flag) {
+    uint8_t sequence = 0;
+
+  #ifdef NET_UDP_DELIVERY_REPORTS
+    lastSendHandle = 0;
+  #endif
+
+    // the one waiting for room in the modem queue goes first
+    if (pendingUDPPacket.active) {
+        return false;
+    }
+
+  #ifdef NET_NIDD
+    if (strcmp(dstAddrStr, NET_NIDD_ADDR) == 0) {
+        return _netSendNIDDPacket(payload, payloadLen, flag);
+    }
+  #endif
+
+  #ifdef NET_DBG_UDP_OUTGOING
+    dbg
+        .print("UDP SEND")
+        .tagOff()
+        .print(", fromPort=")
+        .print(srcPort)
+        .print(", to=")
+        .print(dstAddrStr)
+        .print(":")
+        .print(dstPort)
+        .print(", flag=")
+        .hexShort(flag, true, false)
+        .print(", payload=")
+        .hexDump(payload, payloadLen)
+        .tagOn();
+  #endif
+
+    // opened on first use
+    udp_socket_t *entry = _netOpenSocket(_netLocalPort(srcPort));
+
+    if (entry == NULL) {
+        return false;
+    }
+
+    // queued, the modem transmits it from netTaskTick()
+    if (modem.sendUDPDatagramAsync(entry->socket, dstAddrStr, dstPort, payload, payloadLen, _netOnUDPPacketSent, entry, flag, &sequence) == true) {
+        _netSetLastSendHandle(entry->socket, sequence);
+        return true;
+    }
+
+    // e.g. a reply sent from the callback of a receive
+    if (modem.isAsyncQueueFull()) {
+        return _netParkUDPPacket(dstAddrStr, dstPort, srcPort, payload, payloadLen, flag);
+    }
+
+    // too large for the asynchronous queue, nothing may be queued ahead of it
+    if (!modem.isIdle()) {
+        return false;
+    }
+
+    if (modem.sendUDPDatagram(entry->socket, dstAddrStr, dstPort, payload, payloadLen, flag, &sequence) == payloadLen) {
+        _netSetLastSendHandle(entry->socket, sequence);
+        return true;
+    }
+
+    // can't be parked for a retry, the recovery still applies
+    _netApplyErrorPolicy(modem.lastError(), entry, 0);
+
+    return false;
+}
+
+// Keeps one datagram until the modem queue has room, its delivery is not
+// tracked (netLastSendHandle() is 0). flag is the RAI for NIDD.
+bool _netParkUDPPacket(const char *dstAddrStr, uint16_t dstPort, uint16_t srcPort, const uint8_t *payload, uint16_t payloadLen, uint16_t flag) {
+    if (payloadLen > sizeof(pendingUDPPacket.payload) || strlen(dstAddrStr) >= sizeof(pendingUDPPacket.dstAddr)) {
+        return false;
+    }
+
+    strcpy(pendingUDPPacket.dstAddr, dstAddrStr);
+    pendingUDPPacket.dstPort = dstPort;
+    pendingUDPPacket.srcPort = srcPort;
+    pendingUDPPacket.flag = flag;
+    pendingUDPPacket.retries = 0;
+    pendingUDPPacket.sequence = 0;
+    pendingUDPPacket.sinceMillis = millis();
+    pendingUDPPacket.delay = 0;
+    memcpy(pendingUDPPacket.payload, payload, payloadLen);
+    pendingUDPPacket.payloadLen = payloadLen;
+    pendingUDPPacket.active = true;
+
+    return true;
+}
+
+void _netOnUDPPacketRetried(int rspType, const char *rspBuf, size_t rspLen, void *arg);
+
+void _netPendingUDPTaskTick() {
+    pending_udp_packet_t *pkt = &pendingUDPPacket;
+    // a retry reports to a callback of its own, which knows its retries
+    QuectelBC95::command_callback_t callback = (pkt->retries > 0) ? _netOnUDPPacketRetried : _netOnUDPPacketSent;
+
+    if (!pkt->active || modem.isAsyncQueueFull() || labs(millis() - pkt->sinceMillis) < pkt->delay) {
+        return;
+    }
+
+    pkt->active = false;
+
+  #ifdef NET_NIDD
+    if (strcmp(pkt->dstAddr, NET_NIDD_ADDR) == 0) {
+        if (niddCid < 0 || modem.sendControlPlaneDataAsync(niddCid, pkt->payload, pkt->payloadLen, callback, NULL, pkt->flag) != true) {
+            udpTxRetries = 0;
+        }
+        return;
+    }
+  #endif
+
+    udp_socket_t *entry = _netOpenSocket(_netLocalPort(pkt->srcPort));
+
+    if (entry == NULL || modem.sendUDPDatagramAsync(entry->socket, pkt->dstAddr, pkt->dstPort, pkt->payload, pkt->payloadLen, callback, entry, pkt->flag, &pkt->sequence) != true) {
+        udpTxRetries = 0;
+    }
+}
+
+// anything queued, with the modem or here, is dropped
+void _netCancelUDPPackets() {
+    modem.cancelAsync();
+    pendingUDPPacket.active = false;
+    udpTxRetries = 0;
+}
+
+// Applies the error policy to a datagram the modem refused and parks it when
+// it is to be sent again. One datagram is retried at a time.
+void _netOnUDPPacketDone(int rspType, const char *rspBuf, udp_socket_t *entry, uint8_t retries) {
+    QuectelBC95::async_datagram_t dgram;
+
+  #ifdef NET_DBG_UDP_OUTGOING
+    if (rspType != BC95_RESPONSE_TYPE_OK) {
+        dbg.print("UDP SEND failed").tagOff().print(", type=").print(rspType).print(", code=").println(rspBuf != NULL ? rspBuf : "-").tagOn();
+    }
+  #endif
+
+    // a timeout or a cancelled command is not a +CME ERROR
+    if (rspType != BC95_RESPONSE_TYPE_ERROR) {
+        return;
+    }
+
+    const net_error_policy_t *policy = _netApplyErrorPolicy(QuectelBC95::Modem::parseError(rspBuf), entry, retries);
+
+    if (policy == NULL || udpTxRetries > 0 || pendingUDPPacket.active || !modem.completedDatagram(&dgram)) {
+        return;
+    }
+
+  #ifdef NET_NIDD
+    if (dgram.remoteHost == NULL) {
+        dgram.remoteHost = NET_NIDD_ADDR;
+    }
+  #endif
+
+    _netParkUDPPacket(dgram.remoteHost, dgram.remotePort, (entry != NULL) ? entry->localPort : 0, dgram.dataBuf, dgram.dataLen, dgram.flag);
+    pendingUDPPacket.retries = retries + 1;
+    pendingUDPPacket.sequence = dgram.sequence;
+    pendingUDPPacket.delay = policy->retryDelay;
+    udpTxRetries = retries + 1;
+}
+
+void _netOnUDPPacketSent(int rspType, const char *rspBuf, size_t rspLen, void *arg) {
+    (void)rspLen;
+
+    _netOnUDPPacketDone(rspType, rspBuf, (udp_socket_t *)arg, 0);
+}
+
+// the retry queued from pendingUDPPacket
+void _netOnUDPPacketRetried(int rspType, const char *rspBuf, size_t rspLen, void *arg) {
+    uint8_t retries = udpTxRetries;
+
+    (void)rspLen;
+
+    udpTxRetries = 0;
+
+    _netOnUDPPacketDone(rspType, rspBuf, (udp_socket_t *)arg, retries);
+}
+
+// ----------------------------------------
+//   Error Policy
+// ----------------------------------------
+void netSetErrorPolicies(const net_error_policy_t *policies, uint8_t count) {
+    if (policies == NULL) {
+        policies = defaultErrorPolicies;
+        count = sizeof(defaultErrorPolicies) / sizeof(defaultErrorPolicies[0]);
+    }
+
+    errorPolicies = policies;
+    errorPolicyCount = count;
+}
+
+// Looks up what a datagram refused with error gets. Recovery is scheduled for
+// _netErrorTaskTick(). Returns the policy when the datagram is to be sent
+// again, NULL when it is dropped.
+const net_error_policy_t *_netApplyErrorPolicy(QuectelBC95::cme_error_t error, udp_socket_t *entry, uint8_t retries) {
+    const net_error_policy_t *policy = NULL;
+
+    for (uint8_t i = 0 ; i < errorPolicyCount ; i++) {
+        if (errorPolicies[i].error == error) {
+            policy = &errorPolicies[i];
+            break;
+        }
+    }
+
+    if (policy == NULL) {
+        return NULL;
+    }
+
+  #ifdef NET_DBG_UDP_OUTGOING
+    dbg.print("UDP SEND error").tagOff().print(", code=").print((uint16_t)error).print(", action=").print(policy->action).print(", retries=").println(retries).tagOn();
+  #endif
+
+    switch (policy->action) {
+        case NET_ERROR_ACTION_RETRY:
+            return (retries < policy->maxRetries) ? policy : NULL;
+
+        case NET_ERROR_ACTION_REOPEN_SOCKET:
+            if (entry != NULL) {
+                udpReopenMask |= (1 << (entry - udpSockets));
+            }
+            return NULL;
+
+        case NET_ERROR_ACTION_REATTACH:
+            modemReattachPending = true;
+            return NULL;
+
+        default:
+            return NULL;
+    }
+}
+
+// recovery the error policy asked for, the queued datagrams go first since
+// they still refer to the old sockets
+void _netErrorTaskTick() {
+    if ((udpReopenMask == 0 && !modemReattachPending) || udpRxInProgress || !modem.isIdle()) {
+        return;
+    }
 
-          #ifdef NET_DBG_INIT_NETWORK
-            dbg.noTagOnce().println(" OK");
-          #endif
+    if (modemReattachPending) {
+        modemReattachPending = false;
 
-            break;
+      #ifdef NET_DBG_INIT_NETWORK
+        dbg.println("Attaching PS again");
+      #endif
+
+        // CGATT fails while the radio is off
+        if (modem.attachPS() != true) {
+            modem.setPhoneFunctionality(BC95_CFUN_FULL);
+            modem.attachPS();
         }
+    }
 
-        if (labs(millis() - startMillis) >= NET_DEFAULT_INIT_NETWORK_TIMEOUT) {
-          #ifdef NET_DBG_INIT_NETWORK
-            dbg.noTagOnce().println(" Failed");
-          #endif
-            
-            return false;
+    for (int i = 0 ; i < NET_MAX_UDP_SOCKETS ; i++) {
+        udp_socket_t *entry = &udpSockets[i];
+
+        if (!(udpReopenMask & (1 << i))) {
+            continue;
+        }
+
+        udpReopenMask &= ~(1 << i);
+
+        if (entry->localPort == 0) {
+            continue;
         }
 
       #ifdef NET_DBG_INIT_NETWORK
-        dbg.noTagOnce().print(".");
+        dbg.print("Reopening UDP socket").tagOff().print(", port=").println(entry->localPort).tagOn();
       #endif
-        
-        delay(1000);
-    }
 
-  #if defined(NET_DBG_INIT_NETWORK) && defined(NET_DBG_VERBOSE_NETWORK_INFO)
-    _netPrintNetworkInfo();
-  #endif
+        if (entry->socket >= 0) {
+            modem.closeSocket(entry->socket);
+        }
 
-    if (_netConfigDefaultSocket() != true) {
-        return false;
+        entry->socket = modem.createSocket(entry->localPort, true);
     }
+}
 
-    // all done
-    return true;
+// ----------------------------------------
+//   Power Saving
+// ----------------------------------------
+bool netSetPowerSavingMode(bool enabled, uint32_t periodicTau, uint32_t activeTime) {
+    powerConfig.psmRequested = true;
+    powerConfig.psmEnabled = enabled;
+    powerConfig.periodicTau = periodicTau;
+    powerConfig.activeTime = activeTime;
+
+    return modem.setPowerSavingMode(enabled, periodicTau, activeTime);
 }
 
-bool netIsNetworkReady() {
-    return modem.readNetworkRegistrationStatus() == BC95_NETWORK_STAT_REGISTERED;
+bool netSetExtendedDRX(bool enabled, uint8_t edrxCycle) {
+    powerConfig.edrxRequested = true;
+    powerConfig.edrxEnabled = enabled;
+    powerConfig.edrxCycle = edrxCycle;
+
+    return modem.setExtendedDRX(enabled, edrxCycle);
 }
 
-// ----------------------------------------
-//   General
-// ----------------------------------------
-bool netPingHost(const char *ipAddress, unsigned long timeout) {
-    QuectelBC95::ping_response_t rsp;
+bool netIsInPowerSavingMode() {
+    return modem.powerSavingStatus() == BC95_PSM_STATUS_PSM;
+}
 
-    return modem.pingHost(ipAddress, &rsp, timeout);
+// false while the modem is in PSM, it is woken up by the next uplink
+bool netIsDownlinkReachable() {
+    return !netIsInPowerSavingMode();
 }
 
 // ----------------------------------------
-//   UDP
+//   Radio Statistics
 // ----------------------------------------
-bool netSendUDPPacket(const char *dstAddrStr, uint16_t dstPort, uint16_t srcPort, const uint8_t *payload, uint16_t payloadLen) {
-  #ifdef NET_DBG_UDP_OUTGOING
-    dbg
-        .print("UDP SEND")
-        .tagOff()
-        .print(", fromPort=")
-        .print(srcPort)
-        .print(", to=")
-        .print(dstAddrStr)
-        .print(":")
-        .print(dstPort)
-        .print(", payload=")
-        .hexDump(payload, payloadLen)
-        .tagOn();
+void netSetRadioStatsInterval(unsigned long interval) {
+    radioStatsInterval = interval;
+}
+
+bool netGetRadioStats(net_radio_stats_t *stats) {
+    *stats = radioStats;
+
+    return radioStats.samples > 0;
+}
+
+void netResetRadioStats() {
+    memset(&radioStats, 0, sizeof(radioStats));
+    memset(radioStatSums, 0, sizeof(radioStatSums));
+}
+
+void _netAddRadioStat(net_radio_stat_t *stat, radio_stat_sum_t *sum, int16_t value) {
+    if (sum->count == 0 || value < stat->min) {
+        stat->min = value;
+    }
+
+    if (sum->count == 0 || value > stat->max) {
+        stat->max = value;
+    }
+
+    // halving keeps the average moving with the radio conditions
+    if (sum->count >= NET_RADIO_STATS_AVG_SAMPLES) {
+        sum->sum /= 2;
+        sum->count /= 2;
+    }
+
+    sum->sum += value;
+    sum->count++;
+    stat->avg = sum->sum / sum->count;
+}
+
+void _netOnRadioStats(int rspType, const char *rspBuf, size_t rspLen, void *arg) {
+    (void)rspBuf;
+    (void)rspLen;
+    (void)arg;
+
+    radioStatsInProgress = false;
+    radioStats.lastMillis = millis();
+
+    if (rspType != BC95_RESPONSE_TYPE_OK) {
+        return;
+    }
+
+    QuectelBC95::nuestats_t *sample = &radioStatsSample;
+
+    radioStats.samples++;
+    radioStats.last = *sample;
+
+    _netAddRadioStat(&radioStats.rsrp, &radioStatSums[0], sample->signalPower);
+    _netAddRadioStat(&radioStats.snr, &radioStatSums[1], sample->snr);
+    _netAddRadioStat(&radioStats.rsrq, &radioStatSums[2], sample->rsrq);
+
+    if (sample->txPower != BC95_NUESTATS_TX_POWER_NONE) {
+        _netAddRadioStat(&radioStats.txPower, &radioStatSums[3], sample->txPower);
+    }
+
+    if (sample->ecl != BC95_NUESTATS_ECL_UNKNOWN) {
+        _netAddRadioStat(&radioStats.ecl, &radioStatSums[4], sample->ecl);
+    }
+
+  #ifdef NET_DBG_RADIO_STATS
+    dbg.print("Radio stats").tagOff()
+        .print(", rsrp=").print(sample->signalPower)
+        .print(", snr=").print(sample->snr)
+        .print(", rsrq=").print(sample->rsrq)
+        .print(", tx=").print(sample->txPower)
+        .print(", ecl=").print(sample->ecl)
+        .print(", cell=").println(sample->cellId).tagOn();
   #endif
+}
+
+void _netRadioStatsTaskTick() {
+    if (radioStatsInProgress || !modem.isIdle() || !netIsDownlinkReachable()) {
+        return;
+    }
 
-    // srcPort is not used
-    (void)srcPort;
+    unsigned long elapsed = labs(millis() - radioStats.lastMillis);
+    bool due = (radioStatsInterval > 0 && (radioStats.lastMillis == 0 || elapsed >= radioStatsInterval));
+
+    // a connected radio answers without a wake up, the cached state costs no command
+    if (!due && elapsed >= NET_RADIO_STATS_CONNECTED_INTERVAL && modem.isStateReported()) {
+        due = (modem.readRadioConnectionStatus() == BC95_CSCON_MODE_CONNECTED);
+    }
 
-    return modem.sendUDPDatagram(
-        defaultSocket,
-        dstAddrStr, dstPort,
-        payload, payloadLen
-    ) == payloadLen;
+    if (due) {
+        radioStatsInProgress = modem.readUEStatisticsAsync(&radioStatsSample, _netOnRadioStats);
+    }
 }
 
 // ----------------------------------------
@@ -338,6 +1556,108 @@ bool netIsCoAPMessageIdDuplicate(uint32_t srcAddress, uint16_t srcPort, uint16_t
 }
 #endif
 
+// Release assistance: while no confirmable message is awaiting its ACK/RST,
+// a CON expects exactly one reply and anything else expects none.
+void _netCoAPTrackConfirmable(uint16_t messageId) {
+  #ifdef NET_COAP_RELEASE_ASSISTANCE
+    outstanding_con_t *pEntry = &coapOutstandingList[0];
+
+    // a free slot, otherwise the oldest one
+    for (int i = 0 ; i < NET_COAP_OUTSTANDING_CON_LIST_LEN ; i++) {
+        if (!coapOutstandingList[i].active) {
+            pEntry = &coapOutstandingList[i];
+            break;
+        }
+
+        if ((long)(coapOutstandingList[i].tsMillis - pEntry->tsMillis) < 0) {
+            pEntry = &coapOutstandingList[i];
+        }
+    }
+
+    pEntry->active = true;
+    pEntry->messageId = messageId;
+    pEntry->tsMillis = millis();
+  #ifdef NET_UDP_DELIVERY_REPORTS
+    pEntry->handle = lastSendHandle;
+  #endif
+  #else
+    (void)messageId;
+  #endif
+}
+
+// the radio never sent it, so no reply is coming
+void _netCoAPDeliveryFailed(net_send_handle_t handle) {
+  #if defined(NET_COAP_RELEASE_ASSISTANCE) && defined(NET_UDP_DELIVERY_REPORTS)
+    for (int i = 0 ; i < NET_COAP_OUTSTANDING_CON_LIST_LEN ; i++) {
+        if (coapOutstandingList[i].active && coapOutstandingList[i].handle == handle) {
+            coapOutstandingList[i].active = false;
+        }
+    }
+  #else
+    (void)handle;
+  #endif
+}
+
+void _netCoAPExchangeDone(uint16_t messageId) {
+  #ifdef NET_COAP_RELEASE_ASSISTANCE
+    for (int i = 0 ; i < NET_COAP_OUTSTANDING_CON_LIST_LEN ; i++) {
+        if (coapOutstandingList[i].active && coapOutstandingList[i].messageId == messageId) {
+            coapOutstandingList[i].active = false;
+        }
+    }
+  #else
+    (void)messageId;
+  #endif
+}
+
+uint16_t _netCoAPReleaseFlag(CoapPDU::Type type) {
+  #ifdef NET_COAP_RELEASE_ASSISTANCE
+    uint8_t outstanding = 0;
+
+    for (int i = 0 ; i < NET_COAP_OUTSTANDING_CON_LIST_LEN ; i++) {
+        outstanding_con_t *pEntry = &coapOutstandingList[i];
+
+        // unanswered for too long, not waiting for it anymore
+        if (pEntry->active && labs(millis() - pEntry->tsMillis) >= NET_COAP_OUTSTANDING_CON_TIMEOUT) {
+            pEntry->active = false;
+        }
+
+        if (pEntry->active) {
+            outstanding++;
+        }
+    }
+
+    // more replies are on their way
+    if (outstanding > 0) {
+        return BC95_NSOST_FLAG_NONE;
+    }
+
+    if (type == CoapPDU::COAP_CONFIRMABLE) {
+        return BC95_NSOST_FLAG_RELEASE_AFTER_REPLIED;
+    }
+
+    return BC95_NSOST_FLAG_RELEASE_AFTER_NEXT_MSG;
+  #else
+    (void)type;
+
+    return BC95_NSOST_FLAG_NONE;
+  #endif
+}
+
+bool _netSendCoAPPDU(const char *dstAddrStr, uint16_t dstPort, uint16_t srcPort, CoapPDU *message) {
+    uint16_t flag = _netCoAPReleaseFlag(message->getType());
+
+    if (_netSendUDPPacket(dstAddrStr, dstPort, srcPort, message->getPDUPointer(), message->getPDULength(), flag) != true) {
+        return false;
+    }
+
+    if (message->getType() == CoapPDU::COAP_CONFIRMABLE) {
+        _netCoAPTrackConfirmable(message->getMessageID());
+    }
+
+    return true;
+}
+
 bool netSendCoAPMessage(const char *dstAddrStr, uint16_t dstPort, CoapPDU *message) {
     return netSendCoAPMessage(dstAddrStr, dstPort, 0, message);
 }
@@ -378,7 +1698,7 @@ bool netSendCoAPMessage(const char *dstAddrStr, uint16_t dstPort, uint16_t srcPo
     dbg.println().tagOn();
   #endif  /* NET_DBG_COAP_OUTGOING */
 
-    return netSendUDPPacket(dstAddrStr, dstPort, srcPort, message->getPDUPointer(), message->getPDULength());
+    return _netSendCoAPPDU(dstAddrStr, dstPort, srcPort, message);
 }
 
 bool netSendCoAPEmptyAckMessage(const char *dstAddrStr, uint16_t dstPort, uint16_t messageId) {
@@ -411,7 +1731,8 @@ bool netSendCoAPEmptyAckMessage(const char *dstAddrStr, uint16_t dstPort, uint16
     ack.setCode(CoapPDU::COAP_EMPTY);
     ack.setMessageID(messageId);
 
-    return netSendUDPPacket(dstAddrStr, dstPort, srcPort, ack.getPDUPointer(), ack.getPDULength()); 
+    // answers a request, the application's response may still follow
+    return _netSendUDPPacket(dstAddrStr, dstPort, srcPort, ack.getPDUPointer(), ack.getPDULength(), BC95_NSOST_FLAG_NONE);
 }
 
 bool netSendCoAPResetMessage(const char *dstAddrStr, uint16_t dstPort, uint16_t messageId) {
@@ -444,18 +1765,21 @@ bool netSendCoAPResetMessage(const char *dstAddrStr, uint16_t dstPort, uint16_t
     rst.setCode(CoapPDU::COAP_EMPTY);
     rst.setMessageID(messageId);
 
-    return netSendUDPPacket(dstAddrStr, dstPort, srcPort, rst.getPDUPointer(), rst.getPDULength()); 
+    // answers a message, the peer may still have more to send
+    return _netSendUDPPacket(dstAddrStr, dstPort, srcPort, rst.getPDUPointer(), rst.getPDULength(), BC95_NSOST_FLAG_NONE);
 }
 
-bool netSendCoAPPing(const char *dstAddrStr, uint16_t dstPort, unsigned long timeout) {
+bool netStartCoAPPing(const char *dstAddrStr, uint16_t dstPort, unsigned long timeout, void (*callback)(bool success)) {
     uint8_t coapBuf[4];
     CoapPDU message(coapBuf, sizeof(coapBuf));
 
-    uint8_t rxBuf[32];
-    QuectelBC95::udp_rx_data_t rx;
+    uint16_t messageId;
 
-    uint16_t messageId = netGetNextCoAPMessageId();
-    unsigned long startMillis;
+    if (coapPing.active) {
+        return false;
+    }
+
+    messageId = netGetNextCoAPMessageId();
 
     message.reset();
     message.setVersion(1);
@@ -474,7 +1798,7 @@ bool netSendCoAPPing(const char *dstAddrStr, uint16_t dstPort, unsigned long tim
         .tagOn();
   #endif
 
-    if (netSendUDPPacket(dstAddrStr, dstPort, 0, message.getPDUPointer(), message.getPDULength()) != true) {
+    if (_netSendCoAPPDU(dstAddrStr, dstPort, 0, &message) != true) {
       #ifdef NET_DBG_COAP_PING
         dbg.println("CoAP Ping, failed to send request");
       #endif
@@ -482,45 +1806,94 @@ bool netSendCoAPPing(const char *dstAddrStr, uint16_t dstPort, unsigned long tim
         return false;
     }
 
-    startMillis = millis();
-    while (labs(millis() - startMillis) < timeout) {
-        bool rxOK = modem.receiveUDPDatagram(defaultSocket, rxBuf, sizeof(rxBuf), &rx) > 0;
-        
-        if  (rxOK && sizeof(coapBuf) >= rx.dataLen) {
-            message.reset();
-            memcpy(coapBuf, rx.dataBuf, rx.dataLen);
-
-            if (message.validate() && 
-                message.getType() == CoapPDU::COAP_RESET &&
-                message.getCode() == CoapPDU::COAP_EMPTY &&
-                message.getMessageID() == messageId)
-            {
-              #ifdef NET_DBG_COAP_PING
-                dbg
-                    .print("CoAP Pong")
-                    .tagOff()
-                    .print(", from=")
-                    .print(rx.remoteAddr.strVal)
-                    .print(":")
-                    .print(rx.remotePort)
-                    .print(", time=")
-                    .print(millis() - startMillis)
-                    .println(" ms")
-                    .tagOn();
-              #endif
-                
-                return true;
-            }
-        }
+    coapPing.active = true;
+    coapPing.done = false;
+    coapPing.success = false;
+    coapPing.messageId = messageId;
+    coapPing.startMillis = millis();
+    coapPing.timeout = timeout;
+    coapPing.callback = callback;
+
+    return true;
+}
+
+bool netSendCoAPPing(const char *dstAddrStr, uint16_t dstPort, unsigned long timeout) {
+    if (netStartCoAPPing(dstAddrStr, dstPort, timeout, NULL) != true) {
+        return false;
+    }
+
+    while (coapPing.active) {
+        netTaskTick();
+    }
+
+    return coapPing.success;
+}
+
+// marks the pending ping as answered if data is its empty RESET
+bool _netCheckCoAPPong(QuectelBC95::udp_rx_data_t *data) {
+    uint8_t coapBuf[4];
+    CoapPDU message(coapBuf, sizeof(coapBuf));
+
+    if (!coapPing.active || coapPing.done || data->dataLen > sizeof(coapBuf)) {
+        return false;
+    }
+
+    message.reset();
+    memcpy(coapBuf, data->dataBuf, data->dataLen);
+
+    if (message.validate() && 
+        message.getType() == CoapPDU::COAP_RESET &&
+        message.getCode() == CoapPDU::COAP_EMPTY &&
+        message.getMessageID() == coapPing.messageId)
+    {
+      #ifdef NET_DBG_COAP_PING
+        dbg
+            .print("CoAP Pong")
+            .tagOff()
+            .print(", from=")
+            .print(data->remoteAddr.strVal)
+            .print(":")
+            .print(data->remotePort)
+            .print(", time=")
+            .print(millis() - coapPing.startMillis)
+            .println(" ms")
+            .tagOn();
+      #endif
+
+        coapPing.done = true;
+        coapPing.success = true;
+        _netCoAPExchangeDone(coapPing.messageId);
+
+        return true;
     }
 
-  #ifdef NET_DBG_COAP_PING
-    dbg.println("CoAP Ping, request timeout");
-  #endif
-    
     return false;
 }
 
+void _netCoAPPingTaskTick() {
+    if (!coapPing.active) {
+        return;
+    }
+
+    if (!coapPing.done && labs(millis() - coapPing.startMillis) >= coapPing.timeout) {
+      #ifdef NET_DBG_COAP_PING
+        dbg.println("CoAP Ping, request timeout");
+      #endif
+
+        coapPing.done = true;
+        coapPing.success = false;
+        _netCoAPExchangeDone(coapPing.messageId);
+    }
+
+    if (coapPing.done) {
+        coapPing.active = false;
+
+        if (coapPing.callback != NULL) {
+            coapPing.callback(coapPing.success);
+        }
+    }
+}
+
 // ----------------------------------------
 //   Packet handler
 // ----------------------------------------
@@ -535,30 +1908,146 @@ void netSetIncomingCoAPMessageHandler(void (*handler)(const char *srcAddrStr, ui
 // ----------------------------------------
 //   Task processor
 // ----------------------------------------
+void _onModemIncomingUDPData(QuectelBC95::udp_rx_data_t *data, void *arg);
 void _handleModemIncomingUDPData(QuectelBC95::udp_rx_data_t *data);
+void _handleIncomingData(QuectelBC95::udp_rx_data_t *data, uint16_t dstPort);
+void _netNIDDTaskTick();
+void _netPendingUDPTaskTick();
 void _dispatchUDPPacket(const char *srcAddrStr, uint16_t srcPort, uint16_t dstPort, const uint8_t *payload, uint16_t payloadLen);
 void _dispatchCoAPMessage(const char *srcAddrStr, uint32_t srcAddrInt, uint16_t srcPort, uint16_t dstPort, const uint8_t *udpPayload, uint16_t udpPayloadLen);
 
 void netTaskTick() {
-    uint8_t udpDataBuf[NET_UDP_PAYLOAD_MAX_LEN];
-    QuectelBC95::udp_rx_data_t udpData;
+    // drive queued modem commands, never blocks
+    modem.poll();
+
+    // the modem rebooted on its own (watchdog, brownout), the sockets are gone
+    if (modemRebooted && _netFindSocket(NET_DEFAULT_SOCKET_LOCAL_PORT) != NULL) {
+        modemRebooted = false;
+
+      #ifdef NET_DBG_INIT_NETWORK
+        dbg.println("Modem rebooted, recreating the sockets");
+      #endif
+
+        _netCancelUDPPackets();
+        modem.probeCapabilities();
+        _netConfigNIDD();
+        _netReopenSockets();
+    }
+
+    _netPendingUDPTaskTick();
+
+    // every socket is read once in a while in case a +NSONMI got lost,
+    // nothing new can arrive while the radio sleeps in PSM
+    if (netIsDownlinkReachable() && labs(millis() - lastUDPRxPollMillis) >= NET_UDP_RX_FALLBACK_POLL_INTERVAL) {
+        lastUDPRxPollMillis = millis();
 
-    // check for any incoming UDP data
-    if (modem.receiveUDPDatagram(defaultSocket, udpDataBuf, sizeof(udpDataBuf), &udpData) > 0) {
-        _handleModemIncomingUDPData(&udpData);
+        for (int i = 0 ; i < NET_MAX_UDP_SOCKETS ; i++) {
+            if (udpSockets[i].socket >= 0) {
+                udpRxPollMask |= (1 << i);
+            }
+        }
+    }
+
+    // read incoming UDP data announced by +NSONMI, queued outgoing commands go first
+    if (!udpRxInProgress && modem.isIdle()) {
+        for (int n = 0 ; n < NET_MAX_UDP_SOCKETS ; n++) {
+            uint8_t i = (udpRxNextSocket + n) % NET_MAX_UDP_SOCKETS;
+            udp_socket_t *entry = &udpSockets[i];
+
+            if (entry->socket < 0 || (modem.pendingUDPDataLength(entry->socket) == 0 && !(udpRxPollMask & (1 << i)))) {
+                continue;
+            }
+
+            udpRxPollMask &= ~(1 << i);
+            udpRxNextSocket = (i + 1) % NET_MAX_UDP_SOCKETS;
+            udpRxInProgress = modem.receiveUDPDatagramAsync(entry->socket, udpRxBuf, sizeof(udpRxBuf), &udpRxData, _onModemIncomingUDPData);
+            break;
+        }
+    }
+
+    _netNIDDTaskTick();
+
+    _netCoAPPingTaskTick();
+
+    _netErrorTaskTick();
+
+    // once the network is up, the statistics queue behind the traffic
+    if (!udpRxInProgress && _netFindSocket(NET_DEFAULT_SOCKET_LOCAL_PORT) != NULL) {
+        _netRadioStatsTaskTick();
     }
     
     // TODO process another modem events
 }
 
+void _onModemIncomingUDPData(QuectelBC95::udp_rx_data_t *data, void *arg) {
+    (void)arg;
+
+    if (data->dataLen > 0) {
+        _handleModemIncomingUDPData(data);
+    }
+
+    // udpRxBuf is free again
+    udpRxInProgress = false;
+}
+
 void _handleModemIncomingUDPData(QuectelBC95::udp_rx_data_t *data) {
+    const char *srcAddrStr = data->remoteAddr.strVal;
+    uint16_t srcPort = data->remotePort;
+    const uint8_t *udpPayload = data->dataBuf;
+    uint16_t udpPayloadLen = data->dataLen;
+
+    // the socket was closed while the data was read
+    udp_socket_t *entry = _netFindSocketById(data->socket);
+
+    if (entry == NULL) {
+        return;
+    }
+
+    uint16_t dstPort = entry->localPort;
+
+    // a socket with a handler of its own, no CoAP processing
+    if (entry->handler != NULL) {
+        entry->handler(srcAddrStr, srcPort, dstPort, udpPayload, udpPayloadLen);
+        return;
+    }
+
+    _handleIncomingData(data, dstPort);
+}
+
+#ifdef NET_NIDD
+// +CRTDCP data is already decoded by the driver, no command to wait for
+void _netNIDDTaskTick() {
+    if (niddCid < 0 || udpRxInProgress || modem.pendingControlPlaneDataLength() == 0) {
+        return;
+    }
+
+    udpRxData.dataBuf = udpRxBuf;
+    udpRxData.dataLen = modem.receiveControlPlaneData(udpRxBuf, sizeof(udpRxBuf));
+    strcpy(udpRxData.remoteAddr.strVal, NET_NIDD_ADDR);
+    udpRxData.remoteAddr.intVal = 0;
+    udpRxData.remotePort = 0;
+
+    if (udpRxData.dataLen > 0) {
+        _handleIncomingData(&udpRxData, 0);
+    }
+}
+#else
+void _netNIDDTaskTick() {}
+#endif
+
+// UDP datagrams and NIDD data alike
+void _handleIncomingData(QuectelBC95::udp_rx_data_t *data, uint16_t dstPort) {
     const char *srcAddrStr = data->remoteAddr.strVal;
     uint32_t srcAddrInt = data->remoteAddr.intVal;
     uint16_t srcPort = data->remotePort;
-    uint16_t dstPort = NET_DEFAULT_SOCKET_LOCAL_PORT;  // TODO resolve to match the local port associated with the data->sockId
     const uint8_t *udpPayload = data->dataBuf;
     uint16_t udpPayloadLen = data->dataLen;
 
+    // the pong is consumed here, like the blocking ping used to
+    if (_netCheckCoAPPong(data) == true) {
+        return;
+    }
+
     _dispatchUDPPacket(srcAddrStr, srcPort, dstPort, udpPayload, udpPayloadLen);
 
   #ifdef NET_PROCESS_COAP_INCOMING_MESSAGE
@@ -646,10 +2135,15 @@ void _dispatchCoAPMessage(const char *srcAddrStr, uint32_t srcAddrInt, uint16_t
     dbg.println().tagOn();
   #endif  /* NET_DBG_COAP_INCOMING */
 
+    // the reply to one of our confirmable messages
+    if (coap.getType() == CoapPDU::COAP_ACKNOWLEDGEMENT || coap.getType() == CoapPDU::COAP_RESET) {
+        _netCoAPExchangeDone(coap.getMessageID());
+    }
+
   #ifdef NET_COAP_AUTO_RESPONSE_CONFIRMABLE_MSG_WITH_EMPTY_ACK
     // send empty ACK back if needed
     if (coap.getType() == CoapPDU::COAP_CONFIRMABLE) {
-        netSendCoAPEmptyAckMessage(srcAddrStr, srcPort, 0, coap.getMessageID());
+        netSendCoAPEmptyAckMessage(srcAddrStr, srcPort, dstPort, coap.getMessageID());
     }
   #endif
 
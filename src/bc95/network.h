@@ -12,6 +12,7 @@
 
 #include "coap/cantcoap.h"
 #include "quectel_bc95.h"
+#include "recorder.h"
 
 // ----------------------------------------
 //   Debugging Switches
@@ -24,21 +25,100 @@
 // #define NET_DBG_COAP_OUTGOING
 // #define NET_DBG_COAP_INCOMING
 // #define NET_DBG_COAP_PING
+// #define NET_DBG_RADIO_STATS
 // TODO implement logging for CoAP message ID table
 // #define NET_DBG_COAP_MSG_ID_TABLE
 // #define NET_DBG_COAP_MSG_ID_STATUS
 // ----------------------------------------
 
+// modem factory default, the link starts here
 #define NET_MODEM_SERIAL_BAUD  9600
 
+// The modem port is picked per board in network.cpp. Defining both of these
+// replaces it, the type needs begin(baud), e.g. a replay stream on the host:
+//   -DNET_MODEM_SERIAL_TYPE=BC95Replay -DNET_MODEM_SERIAL_PORT=replayPort
+// #define NET_MODEM_SERIAL_TYPE
+// #define NET_MODEM_SERIAL_PORT
+
+// tap the modem stream, netSetModemTrafficLog() then records the traffic
+// #define NET_MODEM_RECORDER
+
+// fastest rate negotiated with AT+NATSPEED, SoftwareSerial stays at the default
+#if defined(__SAM3X8E__) || defined(__SAMD21G18A__)
+    #define NET_MODEM_SERIAL_MAX_BAUD  115200
+#elif defined(ESP32)
+    #define NET_MODEM_SERIAL_MAX_BAUD  230400
+#else
+    #define NET_MODEM_SERIAL_MAX_BAUD  NET_MODEM_SERIAL_BAUD
+#endif
+
+// seconds the modem waits for AT at a new rate before falling back
+#define NET_MODEM_BAUD_SWITCH_TIMEOUT  3
+
 #define NET_MODEM_RESET_PIN      4
 #define NET_MODEM_RESET_TIMEOUT  10000
 
+// The first netInitNetwork() after netInit() looks for a modem that is still
+// registered from before an MCU-only reset and keeps its registration instead
+// of resetting it. Later calls, e.g. after lost connectivity, always reset.
+#define NET_MODEM_WARM_START
+
 #define NET_DEFAULT_SOCKET_LOCAL_PORT  56830
 
+// UDP sockets including the default one, the modem has 7 at most
+#if defined(__SAM3X8E__) || defined(__SAMD21G18A__) || defined(ESP32)
+    #define NET_MAX_UDP_SOCKETS  4
+#elif defined (__AVR_ATmega2560__)
+    #define NET_MAX_UDP_SOCKETS  3
+#else
+    #define NET_MAX_UDP_SOCKETS  2
+#endif
+
+// Non-IP data delivery (NIDD) over the control plane with AT+CSODCP/+CRTDCP,
+// available when the modem has a NONIP PDN context (netIsNIDDAvailable()).
+// Packets and CoAP messages sent to NET_NIDD_ADDR go that way instead of
+// a UDP socket, the port is ignored. Incoming NIDD data reaches the UDP and
+// CoAP handlers as sent from NET_NIDD_ADDR, port 0. +CRTDCP is only decoded
+// into the modem's inline buffer (BC95_INLINE_RX_BUF_LEN, SAMD/SAM3X/ESP32),
+// on other boards NIDD is uplink only and downlink data is not reported.
+#define NET_NIDD
+
+#ifdef NET_NIDD
+    #define NET_NIDD_ADDR  "nidd"
+#endif
+
+// The serving cell is remembered in storage given to netSetCellCacheStorage()
+// and the next cold start searches only its EARFCN (AT+NEARFCN) instead of
+// scanning every band. A cell not found within the timeout is given up on
+// and the modem scans as usual. The lock leaves the PCI open, so cells on
+// that EARFCN can still be reselected, and lasts until the modem reboots.
+// A netInitNetwork() after lost connectivity scans without it.
+#define NET_CELL_CACHE
+
+#ifdef NET_CELL_CACHE
+    #define NET_CELL_LOCK_TIMEOUT  30000
+#endif
+
+// incoming data is read when +NSONMI announces it, this is a safety net
+// in case a notification is lost (1 minute)
+#define NET_UDP_RX_FALLBACK_POLL_INTERVAL  60000
+
 // 2 minutes
 #define NET_DEFAULT_INIT_NETWORK_TIMEOUT  120000
 
+// what a datagram the modem refused with +CME ERROR gets, per error code
+#define NET_ERROR_ACTION_GIVE_UP        0
+#define NET_ERROR_ACTION_RETRY          1  // sent again after retryDelay, one datagram at a time
+#define NET_ERROR_ACTION_REOPEN_SOCKET  2  // dropped, the socket is opened again
+#define NET_ERROR_ACTION_REATTACH       3  // dropped, the PS domain is attached again
+
+// AT+NUESTATS sampling, every 10 minutes by default and every 30 seconds at
+// most while the radio is connected anyway
+#define NET_RADIO_STATS_DEFAULT_INTERVAL    600000
+#define NET_RADIO_STATS_CONNECTED_INTERVAL  30000
+// averages follow the latest samples, older ones lose weight
+#define NET_RADIO_STATS_AVG_SAMPLES  64
+
 #if defined(__SAM3X8E__) || defined(__SAMD21G18A__) || defined(ESP32)
     #define NET_UDP_PAYLOAD_MAX_LEN  512
 #elif defined (__AVR_ATmega2560__)
@@ -59,6 +139,24 @@
 // don't send empty ACK message to netSetIncomingCoAPMessageHandler
 #define NET_COAP_IGNORE_INCOMING_EMPTY_ACK_MSG
 
+// tag outgoing CoAP messages with AT+NSOSTF release assistance flags, so the
+// radio leaves RRC connected state once no more downlink is expected
+#define NET_COAP_RELEASE_ASSISTANCE
+
+#ifdef NET_COAP_RELEASE_ASSISTANCE
+    // confirmable messages awaiting ACK/RST, one that is never answered
+    // stops holding the connection after the timeout
+    #define NET_COAP_OUTSTANDING_CON_TIMEOUT   10000
+    #define NET_COAP_OUTSTANDING_CON_LIST_LEN  4
+#endif
+
+// Datagrams are numbered (AT+NSOSTF) where the firmware reports whether the
+// radio sent them (+NSOSTR). A send is then named by netLastSendHandle(), its
+// state is polled with netGetDeliveryStatus() or handed to the delivery
+// handler. A confirmable CoAP message that failed to go out stops holding
+// the release assistance flags right away.
+#define NET_UDP_DELIVERY_REPORTS
+
 #ifdef NET_COAP_IGNORE_DUPLICATE_INCOMING_MSG_ID
     #define NET_COAP_RECEIVED_MSG_ID_ENTRY_TIMEOUT  30000
 
@@ -72,17 +170,106 @@
 
 #endif
 
+typedef struct {
+    uint32_t earfcn;
+    uint16_t pci;
+    uint8_t band;
+} net_cell_info_t;
+
+// modem socket in the high byte, sequence number in the low one, 0 for none
+typedef uint16_t net_send_handle_t;
+
+typedef struct {
+    QuectelBC95::cme_error_t error;
+    uint8_t action;       // NET_ERROR_ACTION_*
+    uint8_t maxRetries;   // NET_ERROR_ACTION_RETRY, the datagram is dropped after that
+    uint16_t retryDelay;  // ms
+} net_error_policy_t;
+
+typedef struct {
+    int16_t min;
+    int16_t max;
+    int16_t avg;
+} net_radio_stat_t;
+
+typedef struct {
+    uint32_t samples;
+    unsigned long lastMillis;       // millis() of the latest sample
+    QuectelBC95::nuestats_t last;
+    net_radio_stat_t rsrp;          // 0.1 dBm
+    net_radio_stat_t snr;           // 0.1 dB
+    net_radio_stat_t rsrq;          // 0.1 dB
+    net_radio_stat_t txPower;       // 0.1 dBm, once something was sent
+    net_radio_stat_t ecl;
+} net_radio_stats_t;
+
 
 QuectelBC95::Modem *netGetModem();
 
+#ifdef NET_MODEM_RECORDER
+// every byte to and from the modem goes to log (see recorder.h), NULL stops
+void netSetModemTrafficLog(Print *log);
+#endif
+
 void netInit();
 bool netInitNetwork();
 bool netIsNetworkReady();
 
+// AT+NPING, downlink keeps being handled while it waits
 bool netPingHost(const char *ipAddress, unsigned long timeout);
+// non-blocking ping, callback is called from netTaskTick() with the result,
+// rtt in ms is only valid on success
+bool netStartPingHost(const char *ipAddress, unsigned long timeout, void (*callback)(bool success, uint16_t rtt));
 
+// power saving, kept across netInitNetwork(), timers are in seconds
+bool netSetPowerSavingMode(bool enabled, uint32_t periodicTau, uint32_t activeTime);
+bool netSetExtendedDRX(bool enabled, uint8_t edrxCycle);
+bool netIsInPowerSavingMode();
+bool netIsDownlinkReachable();
+
+// radio statistics sampled from netTaskTick(), interval 0 only samples while
+// the radio is connected, netGetRadioStats() is false before the first sample
+void netSetRadioStatsInterval(unsigned long interval);
+bool netGetRadioStats(net_radio_stats_t *stats);
+void netResetRadioStats();
+
+// UDP sockets by local port, port 0 is NET_DEFAULT_SOCKET_LOCAL_PORT. Sending
+// from a port without a socket opens one. Packets arriving at a socket with a
+// handler of its own go there only, the rest to the incoming UDP and CoAP
+// handlers. Sockets are opened again after the modem reboots.
+bool netOpenUDPSocket(uint16_t localPort, void (*handler)(const char *srcAddrStr, uint16_t srcPort, uint16_t dstPort, const uint8_t *payload, uint16_t payloadLen) = NULL);
+bool netCloseUDPSocket(uint16_t localPort);
+
+// Queued and sent from netTaskTick(). A packet that finds the modem queue full
+// waits for room, one at a time, further sends fail until it is queued.
 bool netSendUDPPacket(const char *dstAddrStr, uint16_t dstPort, uint16_t srcPort, const uint8_t *payload, uint16_t payloadLen);
 
+#ifdef NET_UDP_DELIVERY_REPORTS
+// the datagram of the latest successful send, 0 when its delivery isn't
+// reported (firmware without +NSOSTR, NIDD, waiting for a full modem queue)
+net_send_handle_t netLastSendHandle();
+// one of BC95_DELIVERY_*, UNKNOWN once the modem tracks newer datagrams
+uint8_t netGetDeliveryStatus(net_send_handle_t handle);
+// called from netTaskTick() once a datagram was sent or failed
+void netSetDeliveryHandler(void (*handler)(net_send_handle_t handle, uint8_t status));
+#endif
+
+#ifdef NET_NIDD
+// a NONIP PDN context was found when the modem was configured
+bool netIsNIDDAvailable();
+#endif
+
+#ifdef NET_CELL_CACHE
+// non-volatile storage for the last serving cell (EEPROM, flash, a file),
+// load returns false when nothing valid is stored, save is only called when
+// the cell changed. NULL, the default, disables the cache.
+void netSetCellCacheStorage(bool (*load)(net_cell_info_t *cell), bool (*save)(const net_cell_info_t *cell));
+#endif
+
+// Replaces the built-in error policy table, codes not in it are given up on.
+// The table is not copied, NULL restores the built-in one.
+void netSetErrorPolicies(const net_error_policy_t *policies, uint8_t count);
+
 uint16_t netGetNextCoAPMessageId();
 void netGetRandomCoAPToken(uint8_t *buf, size_t len);
 bool netIsCoAPMessageIdDuplicate(uint32_t srcAddress, uint16_t srcPort, uint16_t messageId);
@@ -94,6 +281,8 @@ bool netSendCoAPEmptyAckMessage(const char *dstAddrStr, uint16_t dstPort, uint16
 bool netSendCoAPResetMessage(const char *dstAddrStr, uint16_t dstPort, uint16_t messageId);
 bool netSendCoAPResetMessage(const char *dstAddrStr, uint16_t dstPort, uint16_t srcPort, uint16_t messageId);
 bool netSendCoAPPing(const char *dstAddrStr, uint16_t dstPort, unsigned long timeout);
+// non-blocking ping, callback is called from netTaskTick() with the result
+bool netStartCoAPPing(const char *dstAddrStr, uint16_t dstPort, unsigned long timeout, void (*callback)(bool success));
 
 void netSetIncomingUDPPacketHandler(void (*handler)(const char *srcAddrStr, uint16_t srcPort, uint16_t dstPort, const uint8_t *payload, uint16_t payloadLen));
 void netSetIncomingCoAPMessageHandler(void (*handler)(const char *srcAddrStr, uint16_t srcPort, uint16_t dstPort, CoapPDU *message));
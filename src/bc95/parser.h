@@ -0,0 +1,240 @@
+/**
+ * Allocation-free response parser for the Quectel BC95 driver.
+ *
+ * A response format is declared as a list of fields and the compiler
+ * generates a parser specialised for it, e.g.
+ *
+ *     uint8_t rssi, ber;
+ *     Parser::parse(rspBuf, "+CSQ:", &rssi, ",", &ber);
+ *
+ * Fields:
+ *   const char *               literal text, must match exactly
+ *   uint8_t* / uint16_t* /
+ *   uint32_t*                  unsigned decimal, fails on overflow of the target type
+ *   int16_t* / int32_t*        decimal with an optional '-', same overflow check
+ *   Parser::skip()             unsigned decimal, value discarded
+ *   Parser::hex(uint32_t*)     1 to 8 hexadecimal digits, either case
+ *   Parser::string(buf, len,   text up to (not including) stop or the end of the
+ *                  stop)       input, null-terminated, fails if empty or too long
+ *
+ * Leading spaces before numbers are skipped. Text after the last field is
+ * ignored.
+ *
+ * Copyright (c) 2018 Sparkbit Co., Ltd. All rights reserved.
+ *
+ * This work is licensed under the terms of the MIT license.
+ * See LICENSE file in the project root for details.
+ */
+
+#ifndef QUECTEL_BC95_PARSER_H
+#define QUECTEL_BC95_PARSER_H
+
+#include <Arduino.h>
+
+namespace QuectelBC95 {
+namespace Parser {
+
+typedef struct {
+    char *buf;
+    size_t bufLen;
+    char stop;
+} string_field_t;
+
+typedef struct {
+} skip_field_t;
+
+typedef struct {
+    uint32_t *out;
+} hex_field_t;
+
+inline string_field_t string(char *buf, size_t bufLen, char stop = '\0') {
+    string_field_t f = { buf, bufLen, stop };
+    return f;
+}
+
+inline skip_field_t skip() {
+    return skip_field_t();
+}
+
+inline hex_field_t hex(uint32_t *out) {
+    hex_field_t f = { out };
+    return f;
+}
+
+// ----------------------------------------
+//   Field parsers, return the position after the field or NULL
+// ----------------------------------------
+inline const char *parseField(const char *p, const char *literal) {
+    while (*literal != '\0') {
+        if (*p++ != *literal++) {
+            return NULL;
+        }
+    }
+
+    return p;
+}
+
+template<typename T>
+inline const char *parseUnsigned(const char *p, T *out, T max) {
+    T value = 0;
+    const char *start;
+
+    while (*p == ' ') {
+        p++;
+    }
+
+    start = p;
+
+    while (*p >= '0' && *p <= '9') {
+        uint8_t digit = *p - '0';
+
+        if (value > (max - digit) / 10) {
+            return NULL;
+        }
+
+        value = (value * 10) + digit;
+        p++;
+    }
+
+    if (p == start) {
+        return NULL;
+    }
+
+    if (out != NULL) {
+        *out = value;
+    }
+
+    return p;
+}
+
+inline const char *parseField(const char *p, uint8_t *out) {
+    return parseUnsigned<uint8_t>(p, out, UINT8_MAX);
+}
+
+inline const char *parseField(const char *p, uint16_t *out) {
+    return parseUnsigned<uint16_t>(p, out, UINT16_MAX);
+}
+
+inline const char *parseField(const char *p, uint32_t *out) {
+    return parseUnsigned<uint32_t>(p, out, UINT32_MAX);
+}
+
+template<typename T, typename U>
+inline const char *parseSigned(const char *p, T *out, U max) {
+    U magnitude;
+    bool negative;
+
+    while (*p == ' ') {
+        p++;
+    }
+
+    negative = (*p == '-');
+
+    if (negative) {
+        p++;
+    }
+
+    // one more on the negative side, e.g. -32768
+    p = parseUnsigned<U>(p, &magnitude, negative ? max + 1 : max);
+
+    if (p != NULL) {
+        *out = negative ? (T)(0 - magnitude) : (T)magnitude;
+    }
+
+    return p;
+}
+
+inline const char *parseField(const char *p, int16_t *out) {
+    return parseSigned<int16_t, uint16_t>(p, out, INT16_MAX);
+}
+
+inline const char *parseField(const char *p, int32_t *out) {
+    return parseSigned<int32_t, uint32_t>(p, out, INT32_MAX);
+}
+
+inline const char *parseField(const char *p, skip_field_t) {
+    return parseUnsigned<uint32_t>(p, NULL, UINT32_MAX);
+}
+
+inline const char *parseField(const char *p, hex_field_t f) {
+    uint32_t value = 0;
+    uint8_t digits = 0;
+
+    while (true) {
+        uint8_t nibble;
+
+        if (*p >= '0' && *p <= '9') {
+            nibble = *p - '0';
+        }
+        else if (*p >= 'A' && *p <= 'F') {
+            nibble = *p - 'A' + 10;
+        }
+        else if (*p >= 'a' && *p <= 'f') {
+            nibble = *p - 'a' + 10;
+        }
+        else {
+            break;
+        }
+
+        if (++digits > 8) {
+            return NULL;
+        }
+
+        value = (value << 4) | nibble;
+        p++;
+    }
+
+    if (digits == 0) {
+        return NULL;
+    }
+
+    *f.out = value;
+
+    return p;
+}
+
+inline const char *parseField(const char *p, string_field_t f) {
+    size_t len = 0;
+
+    while (*p != '\0' && *p != f.stop) {
+        if (len >= f.bufLen - 1) {
+            return NULL;
+        }
+
+        f.buf[len++] = *p++;
+    }
+
+    f.buf[len] = '\0';
+
+    return (len > 0) ? p : NULL;
+}
+
+// ----------------------------------------
+//   Field list
+// ----------------------------------------
+inline const char *parseFields(const char *p) {
+    return p;
+}
+
+template<typename Field, typename... Fields>
+inline const char *parseFields(const char *p, Field field, Fields... fields) {
+    p = parseField(p, field);
+
+    if (p == NULL) {
+        return NULL;
+    }
+
+    return parseFields(p, fields...);
+}
+
+// Returns true when every field matched, output fields may be partially
+// written otherwise.
+template<typename... Fields>
+inline bool parse(const char *str, Fields... fields) {
+    return parseFields(str, fields...) != NULL;
+}
+
+}  // namespace Parser
+}  // namespace QuectelBC95
+
+#endif /* QUECTEL_BC95_PARSER_H */
@@ -8,691 +8,3328 @@
  */
 
 #include "quectel_bc95.h"
+#include "parser.h"
 #include "debug.h"
 
 static Sparkbit::Debug dbg("BC95");
 
 static const char HEXMAP[] = "0123456789ABCDEF";
 
+// unsolicited result codes dropped when no handler takes them, other lines
+// are queued for the command in flight
+static const char *const KNOWN_URC_PREFIXES[] = {
+    "+CEREG:",
+    "+CSCON:",
+    "+NPSMR:",
+    "+NSOCLI:",
+    "+CRTDCP:"
+};
+
 // ----------------------------------------
 //   Utility Functions
 // ----------------------------------------
+// ASCII hex digit -> nibble value, 0xFF for anything else
+#ifdef __AVR__
+static const uint8_t HEX_DECODE_TABLE[256] PROGMEM = {
+#else
+static const uint8_t HEX_DECODE_TABLE[256] = {
+#endif
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+#ifdef __AVR__
+  #define HEX_DECODE(c)  pgm_read_byte(&HEX_DECODE_TABLE[(uint8_t)(c)])
+#else
+  #define HEX_DECODE(c)  HEX_DECODE_TABLE[(uint8_t)(c)]
+#endif
+
 uint8_t hexCharToInt(const char c) {
-    if (c >= '0' && c <= '9') {
-        return c - '0';
-    }
-    else if (c >= 'A' && c <= 'F') {
-        return 10 + c - 'A';
+    uint8_t v = HEX_DECODE(c);
+
+    return (v == 0xFF) ? 0 : v;
+}
+
+// Writes n in decimal without null-terminator, returns the number of characters.
+static size_t formatUInt(char *buf, uint16_t n) {
+    char digits[5];
+    size_t len = 0, i;
+
+    do {
+        digits[len++] = '0' + (n % 10);
+        n /= 10;
+    } while (n > 0);
+
+    for (i = 0 ; i < len ; i++) {
+        buf[i] = digits[len - i - 1];
     }
-    else if (c >= 'a' && c <= 'f') {
-        return 10 + c - 'a';
+
+    return len;
+}
+
+// ",<n>" with null-terminator, written after the hex data, returns the length.
+static size_t formatTrailer(char *buf, uint16_t n) {
+    size_t len = 0;
+
+    buf[len++] = ',';
+    len += formatUInt(buf + len, n);
+    buf[len] = '\0';
+
+    return len;
+}
+
+// AT+NSOST=<socket>,<remote_addr>,<remote_port>,<length>,
+// AT+NSOSTF=<socket>,<remote_addr>,<remote_port>,<flag>,<length>,
+// AT+NSOSTF also without a flag when nsostf is set, e.g. to number the datagram.
+// Writes at most 46 characters for a remoteHost of up to 15, no null-terminator.
+static size_t formatNSOSTHeader(char *buf, uint8_t socket, const char *remoteHost, uint16_t remotePort, bool nsostf, uint16_t flag, size_t dataLen) {
+    size_t len;
+
+    nsostf = nsostf || flag;
+
+    if (!nsostf) {
+        memcpy(buf, "AT+NSOST=", 9);
+        len = 9;
     }
     else {
-        return 0;
+        memcpy(buf, "AT+NSOSTF=", 10);
+        len = 10;
+    }
+
+    len += formatUInt(buf + len, socket);
+    buf[len++] = ',';
+
+    while (*remoteHost != '\0') {
+        buf[len++] = *remoteHost++;
     }
+    buf[len++] = ',';
+
+    len += formatUInt(buf + len, remotePort);
+    buf[len++] = ',';
+
+    if (nsostf) {
+        // 0x%03X
+        buf[len++] = '0';
+        buf[len++] = 'x';
+        buf[len++] = HEXMAP[(flag >> 8) & 0x0F];
+        buf[len++] = HEXMAP[(flag >> 4) & 0x0F];
+        buf[len++] = HEXMAP[flag & 0x0F];
+        buf[len++] = ',';
+    }
+
+    len += formatUInt(buf + len, dataLen);
+    buf[len++] = ',';
+
+    return len;
+}
+
+// AT+CSODCP=<cid>,<cpdata_length>, with null-terminator, returns the length.
+static size_t formatCSODCPHeader(char *buf, uint8_t cid, size_t dataLen) {
+    size_t len;
+
+    memcpy(buf, "AT+CSODCP=", 10);
+    len = 10;
+
+    len += formatUInt(buf + len, cid);
+    buf[len++] = ',';
+    len += formatUInt(buf + len, dataLen);
+    buf[len++] = ',';
+    buf[len] = '\0';
+
+    return len;
 }
 
 uint32_t ipv4AddressStringToInt(const char *addrStr) {
     uint8_t oct1, oct2, oct3, oct4;
     
-    if (sscanf(
-            addrStr, "%u.%u.%u.%u",
-            (unsigned int *)&oct1, 
-            (unsigned int *)&oct2, 
-            (unsigned int *)&oct3, 
-            (unsigned int *)&oct4
-        ) == 4) 
-    {
+    if (QuectelBC95::Parser::parse(addrStr, &oct1, ".", &oct2, ".", &oct3, ".", &oct4)) {
         return ((uint32_t)oct1 << 24) + ((uint32_t)oct2 << 16) + ((uint32_t)oct3 << 8) + (uint32_t)oct4;
     }
 
     return 0;
 }
 
-// ----------------------------------------
-//   QuectelBC95::Modem
-// ----------------------------------------
-QuectelBC95::Modem::Modem(Stream *stream) {
-    _stream = stream;
-    _stream->setTimeout(BC95_DEFAULT_STREAM_READ_TIMEOUT);
+// GPRS Timer 3 (T3412 extended, periodic TAU) and GPRS Timer 2 (T3324,
+// active time) units in seconds, indexed by the 3 unit bits, 3GPP TS 24.008
+static const uint32_t T3412_UNITS[] = { 600, 3600, 36000, 2, 30, 60, 1152000 };
+static const uint32_t T3324_UNITS[] = { 2, 60, 360 };
+
+// Encodes seconds as "uuuvvvvv", the smallest timer value not shorter than
+// seconds, or the longest one.
+static void encodeGPRSTimer(char *buf, uint32_t seconds, const uint32_t *units, uint8_t unitCount) {
+    uint8_t bestUnit = 0;
+    uint8_t bestValue = 31;
+    uint32_t bestSeconds = UINT32_MAX;
+
+    for (uint8_t u = 0 ; u < unitCount ; u++) {
+        uint32_t value = (seconds + units[u] - 1) / units[u];
+
+        if (value <= 31 && value * units[u] < bestSeconds) {
+            bestUnit = u;
+            bestValue = value;
+            bestSeconds = value * units[u];
+        }
+        else if (bestSeconds == UINT32_MAX && units[u] > units[bestUnit]) {
+            bestUnit = u;
+        }
+    }
+
+    uint8_t timer = (bestUnit << 5) | bestValue;
+
+    for (int i = 0 ; i < 8 ; i++) {
+        buf[i] = (timer & (0x80 >> i)) ? '1' : '0';
+    }
+    buf[8] = '\0';
 }
 
-void QuectelBC95::Modem::writeCommand(const char *command) {
-  #ifdef BC95_DBG_WRITE_FRAME
-    dbg.print("WRITE: ").noTagOnce().println(command);
-  #endif
-    
-    _stream->print(command);
-    _stream->print('\r');
+static uint32_t decodeGPRSTimer(const char *bits, const uint32_t *units, uint8_t unitCount) {
+    uint8_t timer = 0;
+
+    for (int i = 0 ; i < 8 ; i++) {
+        if (bits[i] != '0' && bits[i] != '1') {
+            return BC95_PSM_TIMER_DEACTIVATED;
+        }
+
+        timer = (timer << 1) | (bits[i] - '0');
+    }
+
+    // unit 0b111 is deactivated, others are reserved when beyond the table
+    if ((timer >> 5) >= unitCount) {
+        return BC95_PSM_TIMER_DEACTIVATED;
+    }
+
+    return (timer & 0x1F) * units[timer >> 5];
 }
 
-int QuectelBC95::Modem::readResponse(char *rspBuf, size_t rspBufLen, size_t *rspLen, unsigned long timeout) {
-    ParserState parserState = ParserState::StartCR;
-    size_t parsedLen = 0;
-    int b;
-    
-    if (rspLen != NULL) {
-        *rspLen = 0;
+// "+NAME=..." / "+NAME?" / "+NAME;..." -> length of "+NAME", 0 for anything
+// that isn't an extended command
+static size_t commandNameLength(const char *command) {
+    size_t len = 0;
+
+    if (command[0] != '+') {
+        return 0;
     }
 
-    unsigned long lastReceivedByteMillis = millis();
+    while (command[len] != '\0' && command[len] != '=' && command[len] != '?' && command[len] != ';') {
+        len++;
+    }
 
-    do {
-        b = _stream->read();
-        if (b == -1) { continue; }
-
-        switch (parserState) {
-            case ParserState::StartCR:
-                if (b == '\r') {
-                  #ifdef BC95_DBG_READ_FRAME
-                    dbg.println("READ: FOUND <CR>");
-                  #endif
-                    
-                    parserState = ParserState::StartLF;
-                    lastReceivedByteMillis = millis();
-                }
-                else {
-                  #ifdef BC95_DBG_READ_FRAME
-                    dbg.print("READ: WAIT <CR>, FOUND [").tagOff().write(b).print("] (").hexByte(b, true, false).println(")").tagOn();
-                  #endif
-                }
-                break;
+    return len;
+}
 
-            case ParserState::StartLF:
-                if (b == '\n') {
-                  #ifdef BC95_DBG_READ_FRAME
-                    dbg.println("READ: FOUND <LF>");
-                  #endif
+// <stat>[,"<tac>","<ci>"[,<AcT>]], the part after +CEREG: of a URC or after
+// <n>, of the AT+CEREG? response
+static bool parseCEREGStatus(const char *p, QuectelBC95::cereg_t *rsp) {
+    uint32_t tac, ci;
 
-                    parserState = ParserState::Payload;
-                    lastReceivedByteMillis = millis();
-                }
-                else if (b == '\r') {
-                  #ifdef BC95_DBG_READ_FRAME
-                    dbg.println("READ: FOUND <CR>");
-                  #endif
-                }
-                else {
-                  #ifdef BC95_DBG_READ_FRAME
-                    dbg.print("READ: INVALID [").tagOff().write(b).print("] (").hexByte(b, true, false).println(")").tagOn();
-                  #endif
+    p = QuectelBC95::Parser::parseFields(p, &(rsp->status));
 
-                    parserState = ParserState::StartCR;
-                    parsedLen = 0;
-                }
-                break;
-            
-            case ParserState::Payload:
-                if (b == '\r') {
-                  #ifdef BC95_DBG_READ_FRAME
-                    dbg.println("READ: FOUND <CR>");
-                  #endif
-
-                    parserState = ParserState::StopLF;
-                    lastReceivedByteMillis = millis();
-                }
-                else if (parsedLen >= rspBufLen-1) {  // excluding null-terminate
-                  #ifdef BC95_DBG_READ_FRAME
-                    dbg.println("READ: OVERFLOW");
-                  #endif
+    if (p == NULL) {
+        return false;
+    }
 
-                    parserState = ParserState::StartCR;
-                    parsedLen = 0;
-                }
-                else {
-                  #ifdef BC95_DBG_READ_FRAME
-                    dbg.print("READ: PYLD [").tagOff().write(b).print("] (").hexByte(b, true, false).println(")").tagOn();
-                  #endif
+    rsp->tac = 0;
+    rsp->cellId = 0;
+    rsp->accessTech = BC95_CEREG_ACT_UNKNOWN;
 
-                    rspBuf[parsedLen++] = b;
-                    lastReceivedByteMillis = millis();
-                }
-                break;
-            
-            case ParserState::StopLF:
-                if (b == '\n') {
-                    // null-terminate
-                    rspBuf[parsedLen] = '\0';
-
-                    // copy parsedLen to rspLen
-                    if (rspLen != NULL) {
-                        *rspLen = parsedLen;
-                    }
-
-                    if (parsedLen == 2 && rspBuf[0] == 'O' && rspBuf[1] == 'K') {
-                      #ifdef BC95_DBG_READ_FRAME
-                        dbg.println("READ: FOUND <LF>, DONE (type=OK)");
-                      #endif
-
-                        return BC95_RESPONSE_TYPE_OK;
-                    }
-                    else if (strcmp(rspBuf, "ERROR") == 0) {
-                      #ifdef BC95_DBG_READ_FRAME
-                        dbg.println("READ: FOUND <LF>, DONE (type=ERROR)");
-                      #endif
-
-                        return BC95_RESPONSE_TYPE_ERROR;
-                    }
-                    else if (strncmp(rspBuf, "+CME ERROR: ", 12) == 0) {
-                      #ifdef BC95_DBG_READ_FRAME
-                        dbg.println("READ: FOUND <LF>, DONE (type=ERROR)");
-                      #endif
-
-                        // don't include "+CME ERROR: " prefix
-                        parsedLen = parsedLen - 12;
-                        // move error code to the begining, including null-terminator
-                        memmove(rspBuf, rspBuf+12, parsedLen+1);
-                        // update the new rspLen
-                        if (rspLen != NULL) {
-                            *rspLen = parsedLen;
-                        }
-
-                        return BC95_RESPONSE_TYPE_ERROR;
-                    }
-                    else {
-                      #ifdef BC95_DBG_READ_FRAME
-                        dbg.print("READ: FOUND <LF>, DONE (type=DATA, len=").tagOff().print(parsedLen).println(")").tagOn();
-                      #endif
-
-                        return BC95_RESPONSE_TYPE_DATA;
-                    }
-                }
-                else {
-                  #ifdef BC95_DBG_READ_FRAME
-                    dbg.print("READ: INVALID [").tagOff().write(b).print("] (").hexByte(b, true, false).println(")").tagOn();
-                  #endif
+    if (QuectelBC95::Parser::parse(p, ",\"", QuectelBC95::Parser::hex(&tac), "\",\"", QuectelBC95::Parser::hex(&ci), "\"")) {
+        rsp->tac = tac;
+        rsp->cellId = ci;
 
-                    parserState = ParserState::StartCR;
-                    parsedLen = 0;
-                }
-                break;
+        QuectelBC95::Parser::parse(p, ",\"", QuectelBC95::Parser::hex(&tac), "\",\"", QuectelBC95::Parser::hex(&ci), "\",", &(rsp->accessTech));
+    }
+
+    return true;
+}
+
+// +CEREG:<n>,<stat>[,"<tac>","<ci>"[,<AcT>]]
+static bool parseCEREGResponse(const char *rspBuf, QuectelBC95::cereg_t *rsp) {
+    const char *p = QuectelBC95::Parser::parseFields(rspBuf, "+CEREG:", &(rsp->urc), ",");
+
+    return p != NULL && parseCEREGStatus(p, rsp);
+}
+
+// one "<label>:<value>" line of AT+NUESTATS, unknown labels are skipped
+static bool parseNUESTATSLine(const char *line, QuectelBC95::nuestats_t *rsp) {
+    return QuectelBC95::Parser::parse(line, "Signal power:", &(rsp->signalPower)) ||
+           QuectelBC95::Parser::parse(line, "Total power:", &(rsp->totalPower)) ||
+           QuectelBC95::Parser::parse(line, "TX power:", &(rsp->txPower)) ||
+           QuectelBC95::Parser::parse(line, "TX time:", &(rsp->txTime)) ||
+           QuectelBC95::Parser::parse(line, "RX time:", &(rsp->rxTime)) ||
+           QuectelBC95::Parser::parse(line, "Cell ID:", &(rsp->cellId)) ||
+           QuectelBC95::Parser::parse(line, "ECL:", &(rsp->ecl)) ||
+           QuectelBC95::Parser::parse(line, "SNR:", &(rsp->snr)) ||
+           QuectelBC95::Parser::parse(line, "EARFCN:", &(rsp->earfcn)) ||
+           QuectelBC95::Parser::parse(line, "PCI:", &(rsp->pci)) ||
+           QuectelBC95::Parser::parse(line, "RSRQ:", &(rsp->rsrq));
+}
+
+// "(0,1,2,3)" or "(0-3)" of a test command, true when value is in it
+static bool rangeListContains(const char *p, uint16_t value) {
+    uint16_t first, last;
+
+    while (*p != '\0') {
+        const char *next = QuectelBC95::Parser::parseFields(p, &first);
+
+        if (next == NULL) {
+            p++;
+            continue;
         }
 
-    } while (labs(millis() - lastReceivedByteMillis) < timeout);
+        last = first;
 
-  #if defined(BC95_DBG_READ_FRAME) && defined(BC95_DBG_READ_TIMEOUT)
-    dbg.println("READ: TOUT");
-  #endif
+        if (*next == '-') {
+            const char *end = QuectelBC95::Parser::parseFields(next + 1, &last);
 
-    // nothing copied to the buffer
-    return BC95_RESPONSE_TYPE_TIMEOUT;
+            if (end != NULL) {
+                next = end;
+            }
+        }
+
+        if (value >= first && value <= last) {
+            return true;
+        }
+
+        p = next;
+    }
+
+    return false;
 }
 
-bool QuectelBC95::Modem::readSimpleDataResponse(char *rspBuf, size_t rspBufLen, size_t *rspLen, unsigned long timeout) {
-    return readResponse(rspBuf, rspBufLen, rspLen, timeout) == BC95_RESPONSE_TYPE_DATA && waitForOK() == true;
+// +CSCON:<n>,<mode>, <state> and <access> are not yet supported
+static bool parseCSCONResponse(const char *rspBuf, QuectelBC95::cscon_t *rsp) {
+    memset(rsp, 0, sizeof(QuectelBC95::cscon_t));
+
+    return QuectelBC95::Parser::parse(rspBuf, "+CSCON:", &(rsp->urc), ",", &(rsp->mode));
 }
 
-bool QuectelBC95::Modem::waitForOK(unsigned long timeout) {
-    char rspBuf[BC95_MIN_RSP_BUF_LEN];
-    
-    return readResponse(rspBuf, sizeof(rspBuf), NULL, timeout) == BC95_RESPONSE_TYPE_OK;
+// ----------------------------------------
+//   QuectelBC95::BasicModem
+// ----------------------------------------
+// Stream access. The calls name TStream::, so a concrete stream class is
+// called directly (and inlined where its definition is visible) instead of
+// through the vtable. BasicModem<Stream> keeps the virtual calls.
+template<typename TStream>
+int QuectelBC95::BasicModem<TStream>::_streamAvailable() {
+    return _stream->TStream::available();
 }
 
-// AT
-bool QuectelBC95::Modem::pingModem() {
-    writeCommand("AT");
-    return waitForOK();
+template<typename TStream>
+int QuectelBC95::BasicModem<TStream>::_streamRead() {
+    return _stream->TStream::read();
 }
 
-// AT+CGMI
-bool QuectelBC95::Modem::readManufacturerIdentification(char *rspBuf, size_t rspBufLen) {
-    writeCommand("AT+CGMI");
-    return readSimpleDataResponse(rspBuf, rspBufLen) == true;
+template<typename TStream>
+int QuectelBC95::BasicModem<TStream>::_streamAvailableForWrite() {
+    return _stream->TStream::availableForWrite();
 }
 
-// AT+CGMM
-bool QuectelBC95::Modem::readModelIdentification(char *rspBuf, size_t rspBufLen) {
-    writeCommand("AT+CGMM");
-    return readSimpleDataResponse(rspBuf, rspBufLen) == true;
+template<typename TStream>
+size_t QuectelBC95::BasicModem<TStream>::_streamWrite(uint8_t b) {
+    return _stream->TStream::write(b);
 }
 
-// AT+CGMR
-bool QuectelBC95::Modem::readRevisionIdentification(char *rspBuf, size_t rspBufLen) {
-    writeCommand("AT+CGMR");
-    return readSimpleDataResponse(rspBuf, rspBufLen) == true;
+template<typename TStream>
+size_t QuectelBC95::BasicModem<TStream>::_streamWrite(const uint8_t *buf, size_t len) {
+    return _stream->TStream::write(buf, len);
 }
 
-// AT+CGSN=1 (IMEI)
-bool QuectelBC95::Modem::readInternationalMobileStationEquipmentIdentity(char *rspBuf, size_t rspBufLen) {
-    writeCommand("AT+CGSN=1");
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_streamFlush() {
+    _stream->TStream::flush();
+}
 
-    // +CGSN:xxxxxxxxxxxxxxx
-    return readSimpleDataResponse(rspBuf, rspBufLen) == true
-        && memmove(rspBuf, rspBuf+6, 16);
+template<>
+int QuectelBC95::BasicModem<Stream>::_streamAvailable() {
+    return _stream->available();
 }
 
-// AT+CEREG?
-bool QuectelBC95::Modem::readNetworkRegistrationStatus(cereg_t *rsp) {
-    char rspBuf[BC95_MIN_RSP_BUF_LEN];
+template<>
+int QuectelBC95::BasicModem<Stream>::_streamRead() {
+    return _stream->read();
+}
 
-    writeCommand("AT+CEREG?");
+template<>
+int QuectelBC95::BasicModem<Stream>::_streamAvailableForWrite() {
+    return _stream->availableForWrite();
+}
 
-    if (readSimpleDataResponse(rspBuf, sizeof(rspBuf)) == true 
-        && sscanf(rspBuf, "+CEREG:%u,%u", (unsigned int *)&(rsp->urc), (unsigned int *)&(rsp->status)) == 2)
-    {
-        return true;
-    }
+template<>
+size_t QuectelBC95::BasicModem<Stream>::_streamWrite(uint8_t b) {
+    return _stream->write(b);
+}
 
-    return false;
+template<>
+size_t QuectelBC95::BasicModem<Stream>::_streamWrite(const uint8_t *buf, size_t len) {
+    return _stream->write(buf, len);
 }
 
-uint8_t QuectelBC95::Modem::readNetworkRegistrationStatus() {
-    cereg_t rsp;
+template<>
+void QuectelBC95::BasicModem<Stream>::_streamFlush() {
+    _stream->flush();
+}
 
-    if (readNetworkRegistrationStatus(&rsp) == true) {
-        return rsp.status;
-    }
+template<typename TStream>
+QuectelBC95::BasicModem<TStream>::BasicModem(TStream *stream) {
+    _stream = stream;
+    _stream->setTimeout(BC95_DEFAULT_STREAM_READ_TIMEOUT);
 
-    // otherwise
-    return BC95_NETWORK_STAT_UNKNOWN;
+    _rxState = ParserState::StartCR;
+    _rxLen = 0;
+    _rxStreamed = false;
+    _rxInline = false;
+    _rxControlPlane = false;
+    _rxRingHead = 0;
+    _rxRingCount = 0;
+    _rxCommandName[0] = '\0';
+    _rebooted = false;
+    _lastError = CME_ERROR_NONE;
+    _psmStatus = BC95_PSM_STATUS_UNKNOWN;
+    _nsorf.armed = false;
+
+    _caps = BC95_CAP_DEFAULT;
+    _fwRevision[0] = '\0';
+    _inlineRx = false;
+
+  #ifdef BC95_INLINE_RX_BUF_LEN
+    _inlineRxLen = 0;
+    _nsonmi.armed = false;
+  #endif
+
+    memset(&_state, 0, sizeof(_state));
+
+    memset(_urcHandlers, 0, sizeof(_urcHandlers));
+
+    _asyncState = AsyncState::Idle;
+    _asyncHead = 0;
+    _asyncCount = 0;
+    _asyncTxSpaceKnown = false;
+    _asyncRetryable = false;
+    _asyncRetried = false;
+    _asyncRx.active = false;
+    memset(&_ping, 0, sizeof(_ping));
+
+    memset(_pendingRxLen, 0, sizeof(_pendingRxLen));
+
+    memset(_tracked, 0, sizeof(_tracked));
+    _trackedNext = 0;
+    _lastSequence = 0;
+    _deliveryCallback = NULL;
+    _deliveryArg = NULL;
+
+  #ifdef BC95_COMMAND_STATS
+    resetStats();
+  #endif
 }
 
-// AT+CSCON
-bool QuectelBC95::Modem::readRadioConnectionStatus(cscon_t *rsp) {
-    char rspBuf[24];
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::writeCommand(const char *command) {
+    // a synchronous command must not interleave with a queued one
+    _drainAsync();
+    _beginCommand(command);
+
+  #ifdef BC95_DBG_WRITE_FRAME
+    dbg.print("WRITE: ").noTagOnce().println(command);
+  #endif
+    
+    _streamWrite((const uint8_t *)command, strlen(command));
+    _streamWrite('\r');
 
-    memset(rsp, 0, sizeof(cscon_t));
+  #ifdef BC95_COMMAND_STATS
+    _statsTx(strlen(command) + 1);
+  #endif
+}
 
-    writeCommand("AT+CSCON?");
+// Feeds one byte into the <CR><LF>payload<CR><LF> framer.
+// Returns true when a complete, null-terminated line is in rspBuf (_rxLen long).
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::_frameByte(uint8_t b, char *rspBuf, size_t rspBufLen) {
+    switch (_rxState) {
+        case ParserState::StartCR:
+            if (b == '\r') {
+              #ifdef BC95_DBG_READ_FRAME
+                dbg.println("READ: FOUND <CR>");
+              #endif
+                
+                _rxState = ParserState::StartLF;
+            }
+            else {
+              #ifdef BC95_DBG_READ_FRAME
+                dbg.print("READ: WAIT <CR>, FOUND [").tagOff().write(b).print("] (").hexByte(b, true, false).println(")").tagOn();
+              #endif
+            }
+            break;
 
-    if (readSimpleDataResponse(rspBuf, sizeof(rspBuf)) == true
-        && sscanf(rspBuf, "+CSCON:%u,%u", (unsigned int *)&(rsp->urc), (unsigned int *)&(rsp->mode)) == 2) 
-    {
-        // <state> and <access> are not yet supported
-        return true;
+        case ParserState::StartLF:
+            if (b == '\n') {
+              #ifdef BC95_DBG_READ_FRAME
+                dbg.println("READ: FOUND <LF>");
+              #endif
+
+                _rxState = ParserState::Payload;
+                _rxLen = 0;
+                _rxStreamed = false;
+                _rxInline = false;
+                _rxControlPlane = false;
+            }
+            else if (b == '\r') {
+              #ifdef BC95_DBG_READ_FRAME
+                dbg.println("READ: FOUND <CR>");
+              #endif
+            }
+            else {
+              #ifdef BC95_DBG_READ_FRAME
+                dbg.print("READ: INVALID [").tagOff().write(b).print("] (").hexByte(b, true, false).println(")").tagOn();
+              #endif
+
+                _rxState = ParserState::StartCR;
+            }
+            break;
+        
+        case ParserState::Payload:
+            if (b == '\r') {
+              #ifdef BC95_DBG_READ_FRAME
+                dbg.println("READ: FOUND <CR>");
+              #endif
+
+                if (_rxStreamed) {
+                    _nsorfEnd();
+                }
+              #ifdef BC95_INLINE_RX_BUF_LEN
+                else if (_rxControlPlane) {
+                    _crtdcpEnd();
+                }
+                else if (_rxInline) {
+                    _nsonmiEnd();
+                }
+              #endif
+
+                _rxState = ParserState::StopLF;
+            }
+            else if (_rxStreamed || (_rxLen == 0 && _nsorf.armed && b >= '0' && b <= '9')) {
+                // NSORF response, decoded on the fly instead of being buffered
+                _rxStreamed = true;
+                _nsorfFeed(&_nsorf, b);
+            }
+          #ifdef BC95_INLINE_RX_BUF_LEN
+            else if (_rxInline) {
+                _nsorfFeed(&_nsonmi, b);
+            }
+          #endif
+            else if (_rxLen >= rspBufLen-1) {  // excluding null-terminate
+              #ifdef BC95_DBG_READ_FRAME
+                dbg.println("READ: OVERFLOW");
+              #endif
+
+                // skip the rest of this line, don't take its <CR><LF> as a new start
+                _rxState = ParserState::Discard;
+            }
+            else {
+              #ifdef BC95_DBG_READ_FRAME
+                dbg.print("READ: PYLD [").tagOff().write(b).print("] (").hexByte(b, true, false).println(")").tagOn();
+              #endif
+
+                rspBuf[_rxLen++] = b;
+
+              #ifdef BC95_INLINE_RX_BUF_LEN
+                // the datagram of an inline +NSONMI goes straight to the inline buffer
+                if (_inlineRx && _rxLen == 8 && memcmp(rspBuf, "+NSONMI:", 8) == 0) {
+                    _rxInline = true;
+                    _nsonmiArm();
+                }
+                // and so does control plane data
+                else if (_rxLen == 8 && memcmp(rspBuf, "+CRTDCP:", 8) == 0) {
+                    _rxInline = true;
+                    _rxControlPlane = true;
+                    _nsonmiArm();
+                    _nsonmi.field = NSORFField::Cid;
+                }
+              #endif
+            }
+            break;
+        
+        case ParserState::StopLF:
+            _rxState = ParserState::StartCR;
+
+            if (b == '\n') {
+                // null-terminate
+                rspBuf[_rxLen] = '\0';
+                return true;
+            }
+            else {
+              #ifdef BC95_DBG_READ_FRAME
+                dbg.print("READ: INVALID [").tagOff().write(b).print("] (").hexByte(b, true, false).println(")").tagOn();
+              #endif
+            }
+            break;
+
+        case ParserState::Discard:
+            if (b == '\r') {
+                _rxState = ParserState::StartCR;
+            }
+            break;
     }
 
     return false;
 }
 
-uint8_t QuectelBC95::Modem::readRadioConnectionStatus() {
-    cscon_t rsp;
+// Classifies a framed line, the "+CME ERROR: " prefix is stripped from rspBuf.
+// A final result also sets lastError().
+template<typename TStream>
+int QuectelBC95::BasicModem<TStream>::_classifyResponse(char *rspBuf, size_t *rspLen) {
+    if (*rspLen == 2 && rspBuf[0] == 'O' && rspBuf[1] == 'K') {
+      #ifdef BC95_DBG_READ_FRAME
+        dbg.println("READ: FOUND <LF>, DONE (type=OK)");
+      #endif
 
-    if (readRadioConnectionStatus(&rsp) == true) {
-        return rsp.mode;
+        _lastError = CME_ERROR_NONE;
+
+        return BC95_RESPONSE_TYPE_OK;
     }
+    else if (strcmp(rspBuf, "ERROR") == 0) {
+      #ifdef BC95_DBG_READ_FRAME
+        dbg.println("READ: FOUND <LF>, DONE (type=ERROR)");
+      #endif
 
-    // otherwise
-    return BC95_CSCON_MODE_IDLE;
+        _lastError = CME_ERROR_UNKNOWN;
+
+        return BC95_RESPONSE_TYPE_ERROR;
+    }
+    else if (strncmp(rspBuf, "+CME ERROR: ", 12) == 0) {
+      #ifdef BC95_DBG_READ_FRAME
+        dbg.println("READ: FOUND <LF>, DONE (type=ERROR)");
+      #endif
+
+        // don't include "+CME ERROR: " prefix
+        *rspLen = *rspLen - 12;
+        // move error code to the begining, including null-terminator
+        memmove(rspBuf, rspBuf+12, *rspLen+1);
+
+        _lastError = parseError(rspBuf);
+
+        return BC95_RESPONSE_TYPE_ERROR;
+    }
+    else {
+      #ifdef BC95_DBG_READ_FRAME
+        dbg.print("READ: FOUND <LF>, DONE (type=DATA, len=").tagOff().print(*rspLen).println(")").tagOn();
+      #endif
+
+        return BC95_RESPONSE_TYPE_DATA;
+    }
 }
 
-// AT+CSQ
-bool QuectelBC95::Modem::readSignalQuality(csq_t *rsp) {
-    char rspBuf[32];
-    uint8_t rssi, ber;
+// Reads whatever has arrived, never waits for more. Every complete line is
+// either handled as a URC or queued for the pending command.
+// Returns true when anything was read.
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::_pumpRx() {
+    bool received = false;
+    int b;
 
-    memset(rsp, 0, sizeof(csq_t));
+    while (_streamAvailable() > 0 && (b = _streamRead()) != -1) {
+        received = true;
 
-    writeCommand("AT+CSQ");
+      #ifdef BC95_COMMAND_STATS
+        if (_statsClass >= 0) {
+            _stats.commands[_statsClass].rxBytes++;
+        }
+        else {
+            _stats.idleRxBytes++;
+        }
+      #endif
 
-    if (readSimpleDataResponse(rspBuf, sizeof(rspBuf)) == true && sscanf(rspBuf, "+CSQ:%u,%u", (unsigned int *)&rssi, (unsigned int *)&ber) == 2) {
-        rsp->rssi.value = rssi;
-        rsp->rssi.dBm = (rsp->rssi.value < 99) ? (-113 + (rsp->rssi.value * 2)) : INT16_MIN;
-        rsp->ber = ber;
+        if (!_frameByte(b, _rxLineBuf, sizeof(_rxLineBuf))) {
+            continue;
+        }
 
-        return true;
+        if (_rxStreamed) {
+            // NSORF data is already in the receive buffer
+            _pushLine(NULL, 0);
+        }
+        else if (_rxInline) {
+            // handled by _nsonmiEnd() or _crtdcpEnd()
+        }
+        else if (_rxLen > 0) {
+            _dispatchLine(_rxLineBuf, _rxLen);
+        }
     }
 
-    return false;
+    return received;
 }
 
-// AT+CGPADDR=<cid>
-bool QuectelBC95::Modem::readPDPAddress(uint8_t cid, pdp_addr_t *rsp) {
-    char command[32];
-    char rspBuf[32];
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_dispatchLine(const char *line, size_t lineLen) {
+    // the final result ends the command, anything after it is unsolicited
+    if (strcmp(line, "OK") == 0 || strcmp(line, "ERROR") == 0 || strncmp(line, "+CME ERROR: ", 12) == 0) {
+        _rxCommandName[0] = '\0';
 
-    memset(rsp, 0, sizeof(pdp_addr_t));
+      #ifdef BC95_COMMAND_STATS
+        _statsEnd(line[0] == 'O');
+      #endif
+    }
+    // +NAME: line of the command in flight
+    else if (_isResponseName(line)) {
+        // response
+    }
+    else if (_handleURC(line, lineLen)) {
+        return;
+    }
 
-    sprintf(command, "AT+CGPADDR=%u", cid);
-    writeCommand(command);
+    if (!_pushLine(line, lineLen)) {
+      #ifdef BC95_DBG_READ_FRAME
+        dbg.print("READ: RING FULL, DROPPED [").tagOff().print(line).println("]").tagOn();
+      #endif
+    }
+}
 
-    if (readSimpleDataResponse(rspBuf, sizeof(rspBuf)) == true) {
-        if (sscanf(rspBuf, "+CGPADDR:%u,%s", (unsigned int *)&(rsp->cid), rsp->addr.strVal) == 2) {
-            rsp->addr.intVal = ipv4AddressStringToInt(rsp->addr.strVal);
-            return true;
+// Returns true when line is an unsolicited result code.
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::_handleURC(const char *line, size_t lineLen) {
+    bool found = false;
+    uint8_t socket;
+    uint16_t len;
+
+    // +NSONMI:<socket>,<length>, an inline one the driver didn't ask for
+    // has more fields and is not taken for a length
+    if (strncmp(line, "+NSONMI:", 8) == 0) {
+        const char *end = Parser::parseFields(line + 8, &socket, ",", &len);
+
+        if (end != NULL && *end == '\0' && socket < BC95_MAX_SOCKETS) {
+            _pendingRxLen[socket] += len;
         }
+
+        found = true;
     }
+    // +NPSMR:<mode>
+    else if (strncmp(line, "+NPSMR:", 7) == 0) {
+        uint8_t mode;
+
+        if (Parser::parse(line + 7, &mode)) {
+            _psmStatus = mode;
+        }
+
+        found = true;
+    }
+    // +CEREG:<stat>[,"<tac>","<ci>"[,<AcT>]]
+    else if (strncmp(line, "+CEREG:", 7) == 0) {
+        cereg_t cereg = _state.cereg;
+
+        if (_state.valid && parseCEREGStatus(line + 7, &cereg)) {
+            // a new registration may come with a new address
+            if (cereg.status != _state.cereg.status) {
+                _state.addrValid = false;
+            }
+
+            _state.cereg = cereg;
+        }
+
+        found = true;
+    }
+    // +CSCON:<mode>
+    else if (strncmp(line, "+CSCON:", 7) == 0) {
+        uint8_t mode;
+
+        if (_state.valid && Parser::parse(line + 7, &mode)) {
+            _state.cscon.mode = mode;
+        }
+
+        found = true;
+    }
+    // +NSOSTR:<socket>,<sequence>,<status>
+    else if (strncmp(line, "+NSOSTR:", 8) == 0) {
+        uint8_t sequence;
+        uint8_t status;
+
+        if (Parser::parse(line + 8, &socket, ",", &sequence, ",", &status)) {
+            _deliveryEnd(socket, sequence, (status == 1) ? BC95_DELIVERY_SENT : BC95_DELIVERY_FAILED);
+        }
+
+        found = true;
+    }
+    // +NPING:<ip>,<ttl>,<rtt> or +NPINGERR:<err>
+    else if (strncmp(line, "+NPING", 6) == 0) {
+        _pingURC(line);
+        found = true;
+    }
+    // REBOOT_<cause>, sockets and URC settings don't survive the reboot
+    else if (strncmp(line, "REBOOT_", 7) == 0) {
+        memset(_pendingRxLen, 0, sizeof(_pendingRxLen));
+        _rebooted = true;
+        _psmStatus = BC95_PSM_STATUS_UNKNOWN;
+        _state.valid = false;
+        _state.addrValid = false;
+        _state.imsi[0] = '\0';
+        // back to +NSONMI:<socket>,<length>
+        _inlineRx = false;
+        found = true;
+
+      #ifdef BC95_INLINE_RX_BUF_LEN
+        _inlineRxLen = 0;
+      #endif
+
+        if (_ping.status == BC95_PING_STATUS_IN_PROGRESS) {
+            _pingEnd(false);
+        }
+
+        // whatever the modem still held is gone
+        for (uint8_t i = 0 ; i < BC95_MAX_TRACKED_DATAGRAMS ; i++) {
+            if (_tracked[i].sequence != 0 && _tracked[i].status == BC95_DELIVERY_PENDING) {
+                _deliveryEnd(_tracked[i].socket, _tracked[i].sequence, BC95_DELIVERY_FAILED);
+            }
+        }
+    }
+
+    for (size_t i = 0 ; !found && i < sizeof(KNOWN_URC_PREFIXES) / sizeof(KNOWN_URC_PREFIXES[0]) ; i++) {
+        found = strncmp(line, KNOWN_URC_PREFIXES[i], strlen(KNOWN_URC_PREFIXES[i])) == 0;
+    }
+
+    for (int i = 0 ; i < BC95_MAX_URC_HANDLERS ; i++) {
+        urc_entry_t *entry = &_urcHandlers[i];
+
+        if (entry->handler != NULL && strncmp(line, entry->prefix, entry->prefixLen) == 0) {
+            entry->handler(line, lineLen, entry->arg);
+            found = true;
+        }
+    }
+
+  #ifdef BC95_DBG_READ_FRAME
+    if (found) {
+        dbg.print("URC: ").tagOff().println(line).tagOn();
+    }
+  #endif
+
+    return found;
+}
+
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::_pushLine(const char *line, size_t lineLen) {
+    if (_rxRingCount + lineLen + 1 > sizeof(_rxRing)) {
+        return false;
+    }
+
+    size_t pos = (_rxRingHead + _rxRingCount) % sizeof(_rxRing);
+
+    _rxRing[pos] = lineLen;
+
+    for (size_t i = 0 ; i < lineLen ; i++) {
+        pos = (pos + 1) % sizeof(_rxRing);
+        _rxRing[pos] = line[i];
+    }
+
+    _rxRingCount += lineLen + 1;
+
+    return true;
+}
+
+// Pops the oldest queued line. It is copied to buf only if it fits, callers
+// compare lineLen against bufLen. lineLen is zero for a streamed NSORF line.
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::_popLine(char *buf, size_t bufLen, size_t *lineLen) {
+    if (_rxRingCount == 0) {
+        return false;
+    }
+
+    size_t len = _rxRing[_rxRingHead];
+    size_t pos = _rxRingHead;
+
+    if (len < bufLen) {
+        for (size_t i = 0 ; i < len ; i++) {
+            pos = (pos + 1) % sizeof(_rxRing);
+            buf[i] = _rxRing[pos];
+        }
+
+        buf[len] = '\0';
+    }
+
+    _rxRingHead = (_rxRingHead + len + 1) % sizeof(_rxRing);
+    _rxRingCount -= len + 1;
+    *lineLen = len;
+
+    return true;
+}
+
+// Drops lines nobody is waiting for, e.g. the rest of a timed out response.
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_flushLines() {
+  #ifdef BC95_DBG_READ_FRAME
+    if (_rxRingCount > 0) {
+        dbg.print("READ: DISCARD ").tagOff().print(_rxRingCount).println(" bytes").tagOn();
+    }
+  #endif
+
+    _rxRingHead = 0;
+    _rxRingCount = 0;
+}
+
+// Called right before a command is written.
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_beginCommand(const char *command) {
+    size_t len = 0;
+
+    // URCs that arrived in the meantime are handled, stale responses dropped
+    _pumpRx();
+    _flushLines();
+
+    _lastError = CME_ERROR_NONE;
+
+  #ifdef BC95_COMMAND_STATS
+    _statsBegin(command);
+  #endif
+
+    // AT+NAME=...;+NAME2? -> +NAME;+NAME2
+    if (strncmp(command, "AT", 2) == 0) {
+        command += 2;
+
+        while (command != NULL) {
+            size_t nameLen = commandNameLength(command);
+
+            if (nameLen > 0 && len + nameLen + 1 < sizeof(_rxCommandName)) {
+                if (len > 0) {
+                    _rxCommandName[len++] = ';';
+                }
+
+                memcpy(_rxCommandName + len, command, nameLen);
+                len += nameLen;
+            }
+
+            command = strchr(command, ';');
+
+            if (command != NULL) {
+                command++;
+            }
+        }
+    }
+
+    _rxCommandName[len] = '\0';
+}
+
+// true for a "+NAME:" line of a command in flight
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::_isResponseName(const char *line) {
+    const char *name = _rxCommandName;
+
+    while (*name != '\0') {
+        size_t nameLen = strcspn(name, ";");
+
+        if (strncmp(line, name, nameLen) == 0 && line[nameLen] == ':') {
+            return true;
+        }
+
+        name += nameLen;
+
+        if (*name == ';') {
+            name++;
+        }
+    }
+
+    return false;
+}
+
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::setURCHandler(const char *prefix, urc_handler_t handler, void *arg) {
+    urc_entry_t *freeEntry = NULL;
+
+    for (int i = 0 ; i < BC95_MAX_URC_HANDLERS ; i++) {
+        urc_entry_t *entry = &_urcHandlers[i];
+
+        if (entry->handler != NULL && strcmp(entry->prefix, prefix) == 0) {
+            freeEntry = entry;
+            break;
+        }
+
+        if (entry->handler == NULL && freeEntry == NULL) {
+            freeEntry = entry;
+        }
+    }
+
+    if (freeEntry == NULL) {
+        return handler == NULL;
+    }
+
+    freeEntry->prefix = prefix;
+    freeEntry->prefixLen = strlen(prefix);
+    freeEntry->handler = handler;
+    freeEntry->arg = arg;
+
+    return true;
+}
+
+template<typename TStream>
+int QuectelBC95::BasicModem<TStream>::readResponse(char *rspBuf, size_t rspBufLen, size_t *rspLen, unsigned long timeout) {
+    size_t parsedLen;
+    
+    if (rspLen != NULL) {
+        *rspLen = 0;
+    }
+
+    unsigned long lastReceivedByteMillis = millis();
+
+    do {
+        while (_popLine(rspBuf, rspBufLen, &parsedLen)) {
+            if (parsedLen >= rspBufLen) {
+              #ifdef BC95_DBG_READ_FRAME
+                dbg.println("READ: OVERFLOW");
+              #endif
+
+                continue;
+            }
+
+            int rspType = _classifyResponse(rspBuf, &parsedLen);
+
+            // copy parsedLen to rspLen
+            if (rspLen != NULL) {
+                *rspLen = parsedLen;
+            }
+
+            return rspType;
+        }
+
+        if (_pumpRx()) {
+            lastReceivedByteMillis = millis();
+        }
+
+    } while (labs(millis() - lastReceivedByteMillis) < timeout);
+
+  #if defined(BC95_DBG_READ_FRAME) && defined(BC95_DBG_READ_TIMEOUT)
+    dbg.println("READ: TOUT");
+  #endif
+
+  #ifdef BC95_COMMAND_STATS
+    _statsEnd(false);
+  #endif
+
+    // nothing copied to the buffer
+    return BC95_RESPONSE_TYPE_TIMEOUT;
+}
+
+template<typename TStream>
+QuectelBC95::cme_error_t QuectelBC95::BasicModem<TStream>::lastError() {
+    return _lastError;
+}
+
+template<typename TStream>
+QuectelBC95::cme_error_t QuectelBC95::BasicModem<TStream>::parseError(const char *rspBuf) {
+    uint16_t code;
+
+    if (rspBuf != NULL && Parser::parse(rspBuf, &code) && code != CME_ERROR_NONE) {
+        return (cme_error_t)code;
+    }
+
+    return CME_ERROR_UNKNOWN;
+}
+
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::discardInput() {
+    while (_streamAvailable() > 0) {
+        _streamRead();
+    }
+
+    _rxState = ParserState::StartCR;
+    _rxLen = 0;
+    _rxStreamed = false;
+    _flushLines();
+}
+
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::sendCommandBatch(batch_command_t commands[], uint8_t count, unsigned long timeout) {
+    char line[BC95_BATCH_LINE_LEN];
+    uint8_t first = 0;
+    bool allOK = true;
+
+    while (first < count) {
+        const char *command = commands[first].command;
+        size_t len = strlen(command);
+        uint8_t n = 1;
+
+        // join the following extended commands as ";+NAME..." while they fit
+        if (strncmp(command, "AT+", 3) == 0 && len < sizeof(line)) {
+            strcpy(line, command);
+
+            while (first + n < count) {
+                const char *next = commands[first + n].command;
+
+                if (strncmp(next, "AT+", 3) != 0 || len + strlen(next) - 1 >= sizeof(line)) {
+                    break;
+                }
+
+                line[len++] = ';';
+                strcpy(line + len, next + 2);
+                len += strlen(next + 2);
+                n++;
+            }
+
+            if (n > 1) {
+                command = line;
+            }
+        }
+
+        // which of the commands failed is unknown, ask them one by one
+        if (_runCommandLine(command, &commands[first], n, timeout) != BC95_RESPONSE_TYPE_OK && n > 1) {
+            for (uint8_t i = 0 ; i < n ; i++) {
+                _runCommandLine(commands[first + i].command, &commands[first + i], 1, timeout);
+            }
+        }
+
+        for (uint8_t i = 0 ; i < n ; i++) {
+            if (commands[first + i].rspType != BC95_RESPONSE_TYPE_OK) {
+                allOK = false;
+            }
+        }
+
+        first += n;
+    }
+
+    return allOK;
+}
+
+// Sends one line carrying count commands. A data line goes to the next
+// command that still waits for it in its response buffer, "+NAME:" lines only
+// to a command of that name (or, with none waiting, are dropped). Every
+// command gets the final result of the line.
+template<typename TStream>
+int QuectelBC95::BasicModem<TStream>::_runCommandLine(const char *line, batch_command_t commands[], uint8_t count, unsigned long timeout) {
+    char rspBuf[64];
+    size_t rspLen;
+    uint8_t pos = 0;
+    int rspType;
+
+    for (uint8_t i = 0 ; i < count ; i++) {
+        commands[i].rspType = BC95_RESPONSE_TYPE_TIMEOUT;
+    }
+
+    writeCommand(line);
+
+    while ((rspType = readResponse(rspBuf, sizeof(rspBuf), &rspLen, timeout)) == BC95_RESPONSE_TYPE_DATA) {
+        // responses come in command order
+        for (uint8_t i = pos ; i < count ; i++) {
+            batch_command_t *cmd = &commands[i];
+            const char *name = (strncmp(cmd->command, "AT", 2) == 0) ? cmd->command + 2 : cmd->command;
+            size_t nameLen = commandNameLength(name);
+            bool named = nameLen > 0 && strncmp(rspBuf, name, nameLen) == 0 && rspBuf[nameLen] == ':';
+
+            if (cmd->rspBuf == NULL || cmd->rspType == BC95_RESPONSE_TYPE_DATA || (rspBuf[0] == '+' && !named)) {
+                continue;
+            }
+
+            // the first data line is kept
+            if (rspLen < cmd->rspBufLen) {
+                memcpy(cmd->rspBuf, rspBuf, rspLen + 1);
+            }
+
+            cmd->rspType = BC95_RESPONSE_TYPE_DATA;
+            pos = i + 1;
+            break;
+        }
+    }
+
+    for (uint8_t i = 0 ; i < count ; i++) {
+        commands[i].rspType = rspType;
+    }
+
+    // +CME ERROR code of a single command
+    if (count == 1 && rspType == BC95_RESPONSE_TYPE_ERROR && commands[0].rspBuf != NULL && rspLen < commands[0].rspBufLen) {
+        memcpy(commands[0].rspBuf, rspBuf, rspLen + 1);
+    }
+
+    return rspType;
+}
+
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::readSimpleDataResponse(char *rspBuf, size_t rspBufLen, size_t *rspLen, unsigned long timeout) {
+    return readResponse(rspBuf, rspBufLen, rspLen, timeout) == BC95_RESPONSE_TYPE_DATA && waitForOK() == true;
+}
+
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::waitForOK(unsigned long timeout) {
+    char rspBuf[BC95_MIN_RSP_BUF_LEN];
+    
+    return readResponse(rspBuf, sizeof(rspBuf), NULL, timeout) == BC95_RESPONSE_TYPE_OK;
+}
+
+// ----------------------------------------
+//   Statistics
+// ----------------------------------------
+#ifdef BC95_COMMAND_STATS
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::readStats(modem_stats_t *stats) {
+    *stats = _stats;
+}
+
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::resetStats() {
+    memset(&_stats, 0, sizeof(_stats));
+    _statsClass = -1;
+}
+
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_statsBegin(const char *command) {
+    // the previous command never got its final result
+    _statsEnd(false);
+
+    if (strncmp(command, "AT+NSOST", 8) == 0) {
+        _statsClass = BC95_STATS_CLASS_NSOST;
+    }
+    else if (strncmp(command, "AT+NSORF", 8) == 0) {
+        _statsClass = BC95_STATS_CLASS_NSORF;
+    }
+    else if (strncmp(command, "AT+NSOCR", 8) == 0 || strncmp(command, "AT+NSOCL", 8) == 0) {
+        _statsClass = BC95_STATS_CLASS_SOCKET;
+    }
+    else if (strncmp(command, "AT+NPING", 8) == 0) {
+        _statsClass = BC95_STATS_CLASS_NPING;
+    }
+    else {
+        _statsClass = BC95_STATS_CLASS_OTHER;
+    }
+
+    _statsStartMicros = micros();
+}
+
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_statsEnd(bool success) {
+    if (_statsClass < 0) {
+        return;
+    }
+
+    command_stats_t *stats = &_stats.commands[_statsClass];
+    uint32_t elapsed = (micros() - _statsStartMicros) / 1000;
+    uint8_t bucket = 0;
+
+    while (bucket < BC95_STATS_HISTOGRAM_LEN - 1 && (elapsed >> bucket) > 0) {
+        bucket++;
+    }
+
+    stats->count++;
+    stats->totalMillis += elapsed;
+
+    if (!success) {
+        stats->failures++;
+    }
+
+    if (elapsed > stats->maxMillis) {
+        stats->maxMillis = elapsed;
+    }
+
+    if (stats->histogram[bucket] < UINT16_MAX) {
+        stats->histogram[bucket]++;
+    }
+
+    _statsClass = -1;
+}
+
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_statsTx(size_t len) {
+    if (_statsClass >= 0) {
+        _stats.commands[_statsClass].txBytes += len;
+    }
+}
+#endif
+
+// ----------------------------------------
+//   Asynchronous command engine
+// ----------------------------------------
+template<typename TStream>
+typename QuectelBC95::BasicModem<TStream>::async_command_t *QuectelBC95::BasicModem<TStream>::_asyncReserve() {
+    // only poll() makes room, it can't be called from here as this may run
+    // from one of its callbacks
+    if (_asyncCount >= BC95_ASYNC_QUEUE_LEN) {
+        return NULL;
+    }
+
+    async_command_t *cmd = &_asyncQueue[(_asyncHead + _asyncCount) % BC95_ASYNC_QUEUE_LEN];
+    cmd->dataLen = 0;
+    cmd->nsorf = false;
+    cmd->nuestats = NULL;
+    cmd->nsost = false;
+    cmd->sequence = 0;
+    cmd->trailer[0] = '\0';
+
+    // the slot may be the one completedDatagram() would hand back
+    _asyncRetryable = false;
+
+    return cmd;
+}
+
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::sendCommandAsync(const char *command, command_callback_t callback, void *arg, unsigned long timeout) {
+    if (strlen(command) >= BC95_ASYNC_COMMAND_BUF_LEN) {
+        return false;
+    }
+
+    async_command_t *cmd = _asyncReserve();
+
+    if (cmd == NULL) {
+        return false;
+    }
+
+    strcpy(cmd->command, command);
+    cmd->timeout = timeout;
+    cmd->callback = callback;
+    cmd->arg = arg;
+
+    _asyncCount++;
+
+    return true;
+}
+
+// AT+NSOST=<socket>,<remote_addr>,<remote_port>,<length>,<data> - Send UDP datagram
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::sendUDPDatagramAsync(uint8_t socket, const char *remoteHost, uint16_t remotePort, const uint8_t *dataBuf, size_t dataLen, command_callback_t callback, void *arg, uint16_t flag, uint8_t *sequence) {
+    if (dataLen > BC95_ASYNC_DATA_BUF_LEN || dataLen > BC95_NSOST_MAX_DATA_LEN || strlen(remoteHost) > 15) {
+        return false;
+    }
+
+    async_command_t *cmd = _asyncReserve();
+
+    if (cmd == NULL) {
+        return false;
+    }
+
+    if (sequence != NULL) {
+        tracked_datagram_t *tracked = _findTracked(socket, *sequence);
+
+        // still pending since completedDatagram() handed it back
+        if (tracked == NULL || tracked->status != BC95_DELIVERY_PENDING) {
+            *sequence = _trackDatagram(socket);
+        }
+
+        if (*sequence != 0) {
+            cmd->sequence = *sequence;
+            formatTrailer(cmd->trailer, *sequence);
+        }
+    }
+
+    cmd->nsost = true;
+    cmd->socket = socket;
+    strcpy(cmd->remoteHost, remoteHost);
+    cmd->remotePort = remotePort;
+    cmd->flag = flag;
+    memcpy(cmd->data, dataBuf, dataLen);
+    cmd->dataLen = dataLen;
+    cmd->timeout = BC95_DEFAULT_READ_RESPONSE_TIMEOUT;
+    cmd->callback = callback;
+    cmd->arg = arg;
+
+    _asyncCount++;
+
+    return true;
+}
+
+// AT+NUESTATS
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::readUEStatisticsAsync(nuestats_t *rsp, command_callback_t callback, void *arg) {
+    async_command_t *cmd = _asyncReserve();
+
+    if (cmd == NULL) {
+        return false;
+    }
+
+    strcpy(cmd->command, "AT+NUESTATS");
+    memset(rsp, 0, sizeof(nuestats_t));
+    rsp->ecl = BC95_NUESTATS_ECL_UNKNOWN;
+    cmd->nuestats = rsp;
+    cmd->timeout = BC95_DEFAULT_READ_RESPONSE_TIMEOUT;
+    cmd->callback = callback;
+    cmd->arg = arg;
+
+    _asyncCount++;
+
+    return true;
+}
+
+// The completed command is still in its slot just behind the head, nothing
+// has been queued over it while _asyncRetryable is set.
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::completedDatagram(async_datagram_t *dgram) {
+    async_command_t *cmd = &_asyncQueue[(_asyncHead + BC95_ASYNC_QUEUE_LEN - 1) % BC95_ASYNC_QUEUE_LEN];
+
+    // only AT+NSOST(F) and AT+CSODCP carry data
+    if (!_asyncRetryable || cmd->nsorf || cmd->dataLen == 0) {
+        return false;
+    }
+
+    _asyncRetryable = false;
+    _asyncRetried = true;
+
+    dgram->socket = cmd->socket;
+    dgram->remoteHost = cmd->nsost ? cmd->remoteHost : NULL;
+    dgram->remotePort = cmd->remotePort;
+    dgram->flag = cmd->flag;
+    dgram->sequence = cmd->sequence;
+    dgram->dataBuf = cmd->data;
+    dgram->dataLen = cmd->dataLen;
+
+    return true;
+}
+
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::isIdle() {
+    return _asyncState == AsyncState::Idle && _asyncCount == 0;
+}
+
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::isAsyncQueueFull() {
+    return _asyncCount >= BC95_ASYNC_QUEUE_LEN;
+}
+
+// Drops all queued commands, callbacks get BC95_RESPONSE_TYPE_CANCELLED.
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::cancelAsync() {
+    while (_asyncCount > 0) {
+        _asyncComplete(BC95_RESPONSE_TYPE_CANCELLED, NULL, 0);
+    }
+
+    _asyncRx.active = false;
+}
+
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_drainAsync() {
+    while (!isIdle()) {
+        poll();
+    }
+}
+
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::poll() {
+    if (_asyncState == AsyncState::Idle && _asyncCount > 0) {
+        if (_asyncQueue[_asyncHead].nsost) {
+            _asyncFormatNSOST(&_asyncQueue[_asyncHead]);
+        }
+
+        _asyncState = AsyncState::Write;
+        _asyncTxPos = 0;
+        _beginCommand(_asyncQueue[_asyncHead].command);
+
+        if (_asyncQueue[_asyncHead].nsorf) {
+            _nsorfArm(&_nsorf, _asyncRx.rsp, _asyncRx.dataBuf, _asyncRx.dataBufLen);
+        }
+
+      #ifdef BC95_DBG_WRITE_FRAME
+        async_command_t *cmd = &_asyncQueue[_asyncHead];
+
+        dbg.print("WRITE: ").tagOff().print(cmd->command);
+        if (cmd->dataLen > 0) {
+            dbg.hexString(cmd->data, cmd->dataLen, false, false);
+        }
+        dbg.print(cmd->trailer).println().tagOn();
+      #endif
+    }
+
+    if (_asyncState == AsyncState::Write) {
+        _asyncTransmit();
+    }
+    else if (_asyncState == AsyncState::WaitResponse) {
+        _asyncReceive();
+    }
+    else {
+        _asyncReadURCs();
+    }
+
+    // a receive served from the inline buffer
+    if (_asyncRx.active && _asyncRx.served) {
+        _asyncRx.active = false;
+        _asyncRx.served = false;
+
+        if (_asyncRx.callback != NULL) {
+            _asyncRx.callback(_asyncRx.rsp, _asyncRx.arg);
+        }
+    }
+
+    _deliveryTask();
+    _pingTask();
+}
+
+// Formats the header of a queued datagram right before it is written, so
+// datagrams queued after it are known. Releasing the RRC connection is only
+// asked for when nothing else is waiting to go out on the same socket.
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_asyncFormatNSOST(async_command_t *cmd) {
+    // AT+NSOST without flags on firmware that has no AT+NSOSTF
+    uint16_t flag = (_caps & BC95_CAP_NSOSTF) ? cmd->flag : BC95_NSOST_FLAG_NONE;
+
+    for (uint8_t i = 1 ; i < _asyncCount && (flag & BC95_NSOST_RELEASE_FLAGS) ; i++) {
+        async_command_t *next = &_asyncQueue[(_asyncHead + i) % BC95_ASYNC_QUEUE_LEN];
+
+        if (next->nsost && next->socket == cmd->socket) {
+            flag &= ~BC95_NSOST_RELEASE_FLAGS;
+        }
+    }
+
+    cmd->command[formatNSOSTHeader(cmd->command, cmd->socket, cmd->remoteHost, cmd->remotePort, cmd->sequence != 0, flag, cmd->dataLen)] = '\0';
+}
+
+// Nothing in flight, anything arriving now that is not a URC is left over
+// from an earlier command.
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_asyncReadURCs() {
+    _pumpRx();
+    _flushLines();
+}
+
+// Writes the next slice of <command><hex data><trailer><CR> to the stream.
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_asyncTransmit() {
+    async_command_t *cmd = &_asyncQueue[_asyncHead];
+    size_t commandLen = strlen(cmd->command);
+    size_t hexEnd = commandLen + (cmd->dataLen * 2);
+    size_t totalLen = hexEnd + strlen(cmd->trailer) + 1;
+
+    char txBuf[BC95_ASYNC_TX_CHUNK_LEN];
+    size_t txLen = 0;
+    size_t budget = _streamAvailableForWrite();
+
+    // Print::availableForWrite() returns 0 unless the stream overrides it,
+    // only a stream that has reported free space before is really full
+    if (budget > 0) {
+        _asyncTxSpaceKnown = true;
+    }
+    else if (_asyncTxSpaceKnown) {
+        return;
+    }
+
+    if (budget == 0 || budget > BC95_ASYNC_TX_CHUNK_LEN) {
+        budget = BC95_ASYNC_TX_CHUNK_LEN;
+    }
+
+    while (txLen < budget && _asyncTxPos < totalLen) {
+        if (_asyncTxPos < commandLen) {
+            txBuf[txLen++] = cmd->command[_asyncTxPos];
+        }
+        else if (_asyncTxPos < hexEnd) {
+            size_t i = _asyncTxPos - commandLen;
+            uint8_t b = cmd->data[i / 2];
+
+            txBuf[txLen++] = (i & 1) ? HEXMAP[b & 0x0F] : HEXMAP[(b & 0xF0) >> 4];
+        }
+        else if (_asyncTxPos < totalLen - 1) {
+            txBuf[txLen++] = cmd->trailer[_asyncTxPos - hexEnd];
+        }
+        else {
+            txBuf[txLen++] = '\r';
+        }
+
+        _asyncTxPos++;
+    }
+
+    _streamWrite((const uint8_t *)txBuf, txLen);
+
+  #ifdef BC95_COMMAND_STATS
+    _statsTx(txLen);
+  #endif
+
+    if (_asyncTxPos >= totalLen) {
+        _asyncState = AsyncState::WaitResponse;
+        _asyncRspLen = 0;
+        _asyncHasData = false;
+        _asyncLastActivityMillis = millis();
+    }
+}
+
+// Consumes whatever has arrived, never waits for more.
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_asyncReceive() {
+    // lines after the first data line, only the final result fits
+    char finalBuf[BC95_MIN_RSP_BUF_LEN];
+    size_t lineLen;
+
+    if (_pumpRx()) {
+        _asyncLastActivityMillis = millis();
+    }
+
+    nuestats_t *nuestats = _asyncQueue[_asyncHead].nuestats;
+
+    while (true) {
+        // the first data line goes to the result slot, later lines are only inspected for OK/ERROR,
+        // every NUESTATS line is parsed in the result slot
+        char *lineBuf = (_asyncHasData && nuestats == NULL) ? finalBuf : _asyncRspBuf;
+        size_t lineBufLen = (_asyncHasData && nuestats == NULL) ? sizeof(finalBuf) : sizeof(_asyncRspBuf);
+
+        if (!_popLine(lineBuf, lineBufLen, &lineLen)) {
+            break;
+        }
+
+        if (lineLen >= lineBufLen) {
+          #ifdef BC95_DBG_READ_FRAME
+            dbg.println("READ: OVERFLOW");
+          #endif
+
+            continue;
+        }
+
+        int rspType = _classifyResponse(lineBuf, &lineLen);
+
+        if (rspType == BC95_RESPONSE_TYPE_DATA) {
+            if (nuestats != NULL) {
+                parseNUESTATSLine(lineBuf, nuestats);
+                continue;
+            }
+
+            // a streamed NSORF line is already in the receive buffer
+            if (!_asyncHasData) {
+                _asyncRspLen = lineLen;
+                _asyncHasData = true;
+            }
+            continue;
+        }
+
+        if (rspType == BC95_RESPONSE_TYPE_OK) {
+            _asyncComplete(rspType, _asyncHasData ? _asyncRspBuf : NULL, _asyncRspLen);
+        }
+        else {
+            _asyncComplete(rspType, lineBuf, lineLen);
+        }
+
+        return;
+    }
+
+    if (labs(millis() - _asyncLastActivityMillis) >= _asyncQueue[_asyncHead].timeout) {
+      #if defined(BC95_DBG_READ_FRAME) && defined(BC95_DBG_READ_TIMEOUT)
+        dbg.println("READ: TOUT");
+      #endif
+
+      #ifdef BC95_COMMAND_STATS
+        _statsEnd(false);
+      #endif
+
+        _asyncComplete(BC95_RESPONSE_TYPE_TIMEOUT, NULL, 0);
+    }
+}
+
+// Pops the head command and reports the result. The engine is back to idle
+// before the callback runs, so the callback may queue further commands.
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_asyncComplete(int rspType, const char *rspBuf, size_t rspLen) {
+    async_command_t *cmd = &_asyncQueue[_asyncHead];
+    command_callback_t callback = cmd->callback;
+    void *arg = cmd->arg;
+    // the callback may queue a command into the freed slot
+    bool nsost = cmd->nsost;
+    uint8_t socket = cmd->socket;
+    uint8_t sequence = cmd->sequence;
+    // of an outer completion whose callback drove the engine
+    bool outerRetried = _asyncRetried;
+
+    _asyncHead = (_asyncHead + 1) % BC95_ASYNC_QUEUE_LEN;
+    _asyncCount--;
+    _asyncState = AsyncState::Idle;
+    _nsorf.armed = false;
+    _asyncRetried = false;
+
+    if (callback != NULL) {
+        _asyncRetryable = (rspType != BC95_RESPONSE_TYPE_OK && rspType != BC95_RESPONSE_TYPE_CANCELLED);
+        callback(rspType, rspBuf, rspLen, arg);
+        _asyncRetryable = false;
+    }
+
+    // a numbered datagram the modem never took, unless completedDatagram() handed it back
+    if (nsost && sequence != 0 && rspType != BC95_RESPONSE_TYPE_OK && !_asyncRetried) {
+        _deliveryEnd(socket, sequence, BC95_DELIVERY_FAILED);
+    }
+
+    _asyncRetried = outerRetried;
+}
+
+// AT
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::pingModem() {
+    writeCommand("AT");
+    return waitForOK();
+}
+
+// AT+CGMI
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::readManufacturerIdentification(char *rspBuf, size_t rspBufLen) {
+    writeCommand("AT+CGMI");
+    return readSimpleDataResponse(rspBuf, rspBufLen) == true;
+}
+
+// AT+CGMM
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::readModelIdentification(char *rspBuf, size_t rspBufLen) {
+    writeCommand("AT+CGMM");
+    return readSimpleDataResponse(rspBuf, rspBufLen) == true;
+}
+
+// AT+CGMR
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::readRevisionIdentification(char *rspBuf, size_t rspBufLen) {
+    writeCommand("AT+CGMR");
+    return readSimpleDataResponse(rspBuf, rspBufLen) == true;
+}
+
+// AT+CGSN=1 (IMEI)
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::readInternationalMobileStationEquipmentIdentity(char *rspBuf, size_t rspBufLen) {
+    if (_state.imei[0] != '\0') {
+        if (strlen(_state.imei) >= rspBufLen) {
+            return false;
+        }
+
+        strcpy(rspBuf, _state.imei);
+        return true;
+    }
+
+    writeCommand("AT+CGSN=1");
+
+    // +CGSN:xxxxxxxxxxxxxxx
+    if (readSimpleDataResponse(rspBuf, rspBufLen) == true
+        && memmove(rspBuf, rspBuf+6, 16))
+    {
+        if (strlen(rspBuf) < sizeof(_state.imei)) {
+            strcpy(_state.imei, rspBuf);
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+// AT+CEREG=2 / AT+CSCON=1
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::enableStateReporting() {
+    char ceregBuf[48];
+    char csconBuf[24];
+
+    batch_command_t commands[] = {
+        { "AT+CEREG=2", NULL, 0, 0 },
+        { "AT+CSCON=1", NULL, 0, 0 },
+        // the current state, URCs report the changes from here on
+        { "AT+CEREG?", ceregBuf, sizeof(ceregBuf), 0 },
+        { "AT+CSCON?", csconBuf, sizeof(csconBuf), 0 }
+    };
+
+    _state.valid = false;
+
+    if (sendCommandBatch(commands, sizeof(commands) / sizeof(commands[0])) != true ||
+        parseCEREGResponse(ceregBuf, &(_state.cereg)) != true ||
+        parseCSCONResponse(csconBuf, &(_state.cscon)) != true)
+    {
+        return false;
+    }
+
+    _state.addrValid = false;
+    _state.valid = true;
+
+    return true;
+}
+
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::isStateReported() {
+    // apply the URCs received so far, a reboot turns reporting off
+    if (_state.valid) {
+        _pumpRx();
+    }
+
+    return _state.valid;
+}
+
+// AT+CEREG?
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::readNetworkRegistrationStatus(cereg_t *rsp) {
+    if (isStateReported()) {
+        *rsp = _state.cereg;
+        return true;
+    }
+
+    return _queryNetworkRegistrationStatus(rsp);
+}
+
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::_queryNetworkRegistrationStatus(cereg_t *rsp) {
+    char rspBuf[48];
+
+    writeCommand("AT+CEREG?");
+
+    return readSimpleDataResponse(rspBuf, sizeof(rspBuf)) == true && parseCEREGResponse(rspBuf, rsp);
+}
+
+template<typename TStream>
+uint8_t QuectelBC95::BasicModem<TStream>::readNetworkRegistrationStatus() {
+    cereg_t rsp;
+
+    if (readNetworkRegistrationStatus(&rsp) == true) {
+        return rsp.status;
+    }
+
+    // otherwise
+    return BC95_NETWORK_STAT_UNKNOWN;
+}
+
+// AT+CSCON
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::readRadioConnectionStatus(cscon_t *rsp) {
+    if (isStateReported()) {
+        *rsp = _state.cscon;
+        return true;
+    }
+
+    return _queryRadioConnectionStatus(rsp);
+}
+
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::_queryRadioConnectionStatus(cscon_t *rsp) {
+    char rspBuf[24];
+
+    writeCommand("AT+CSCON?");
+
+    return readSimpleDataResponse(rspBuf, sizeof(rspBuf)) == true && parseCSCONResponse(rspBuf, rsp);
+}
+
+template<typename TStream>
+uint8_t QuectelBC95::BasicModem<TStream>::readRadioConnectionStatus() {
+    cscon_t rsp;
+
+    if (readRadioConnectionStatus(&rsp) == true) {
+        return rsp.mode;
+    }
+
+    // otherwise
+    return BC95_CSCON_MODE_IDLE;
+}
+
+// AT+CSQ
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::readSignalQuality(csq_t *rsp) {
+    char rspBuf[32];
+    uint8_t rssi, ber;
+
+    memset(rsp, 0, sizeof(csq_t));
+
+    writeCommand("AT+CSQ");
+
+    if (readSimpleDataResponse(rspBuf, sizeof(rspBuf)) == true && Parser::parse(rspBuf, "+CSQ:", &rssi, ",", &ber)) {
+        rsp->rssi.value = rssi;
+        rsp->rssi.dBm = (rsp->rssi.value < 99) ? (-113 + (rsp->rssi.value * 2)) : INT16_MIN;
+        rsp->ber = ber;
+
+        return true;
+    }
+
+    return false;
+}
+
+// AT+CGPADDR=<cid>
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::readPDPAddress(uint8_t cid, pdp_addr_t *rsp) {
+    char command[32];
+    char rspBuf[32];
+
+    if (isStateReported() && _state.addrValid && _state.addr.cid == cid) {
+        *rsp = _state.addr;
+        return true;
+    }
+
+    memset(rsp, 0, sizeof(pdp_addr_t));
+
+    sprintf(command, "AT+CGPADDR=%u", cid);
+    writeCommand(command);
+
+    if (readSimpleDataResponse(rspBuf, sizeof(rspBuf)) == true) {
+        if (Parser::parse(rspBuf, "+CGPADDR:", &(rsp->cid), ",", Parser::string(rsp->addr.strVal, sizeof(rsp->addr.strVal)))) {
+            rsp->addr.intVal = ipv4AddressStringToInt(rsp->addr.strVal);
+
+            // registration changes are tracked, the address can be kept
+            if (_state.valid && rsp->cid == cid) {
+                _state.addr = *rsp;
+                _state.addrValid = true;
+            }
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// AT+COPS
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::readPLMNSelection(cops_t *rsp) {
+    char rspBuf[32];
+
+    memset(rsp, 0, sizeof(cops_t));
+
+    writeCommand("AT+COPS?");
+
+    if (readSimpleDataResponse(rspBuf, sizeof(rspBuf)) == true) {
+        if (Parser::parse(rspBuf, "+COPS:", &(rsp->mode), ",", &(rsp->format), ",\"", Parser::string(rsp->oper, sizeof(rsp->oper), '"'))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// AT+CGATT=<state> - PS attach or detach
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::isPSAttached() {
+    char rspBuf[BC95_MIN_RSP_BUF_LEN];
+    uint8_t state;
+
+    writeCommand("AT+CGATT?");
+
+    if (readSimpleDataResponse(rspBuf, sizeof(rspBuf)) == true && Parser::parse(rspBuf, "+CGATT:", &state)) {
+        return state != 0;
+    }
+
+    return false;
+}
+
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::attachPS() {
+    writeCommand("AT+CGATT=1");
+    return waitForOK();
+}
+
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::detachPS() {
+    writeCommand("AT+CGATT=0");
+    return waitForOK();
+}
+
+// AT+CIMI
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::readInternationalMobileSubscriberIdentity(char *rspBuf, size_t rspBufLen) {
+    if (_state.imsi[0] != '\0') {
+        if (strlen(_state.imsi) >= rspBufLen) {
+            return false;
+        }
+
+        strcpy(rspBuf, _state.imsi);
+        return true;
+    }
+
+    writeCommand("AT+CIMI");
+
+    if (readSimpleDataResponse(rspBuf, rspBufLen) == true) {
+        if (strlen(rspBuf) < sizeof(_state.imsi)) {
+            strcpy(_state.imsi, rspBuf);
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+// AT+CGDCONT?
+template<typename TStream>
+uint8_t QuectelBC95::BasicModem<TStream>::readPDNConnectionInfo(pdn_info_t rsp[], uint8_t rspMaxLen) {
+    char lineBuf[BC95_RX_LINE_BUF_LEN];
+    uint8_t rspLen = 0;
+
+    char *tok;
+
+    memset(rsp, 0, sizeof(pdn_info_t) * rspMaxLen);
+    writeCommand("AT+CGDCONT?");
+
+    // one line per context, then OK
+    while (readResponse(lineBuf, sizeof(lineBuf)) == BC95_RESPONSE_TYPE_DATA) {
+        if (rspLen >= rspMaxLen) {
+            continue;
+        }
+
+        // a response line is found
+        // +CGDCONT: <cid>,<type>,<apn>,<addr><dataComp>,<headerComp>
+        pdn_info_t *info = &rsp[rspLen];
+
+        // +CGDCONT:
+        tok = strtok(lineBuf, ":");
+
+        // <cid>
+        tok = strtok(NULL, ",");
+        if (tok != NULL) {
+            info->cid = atoi(tok);
+        }
+
+        // <type>
+        tok = strtok(NULL, ",\"");
+        if (tok != NULL) {
+            strncpy(info->type, tok, sizeof(info->type) - 1);
+        }
+
+        // <apn>
+        tok = strtok(NULL, ",\"");
+        if (tok != NULL) {
+            strncpy(info->apn, tok, sizeof(info->apn) - 1);
+        }
+
+        // <addr>
+        tok = strtok(NULL, ",\"");
+        if (tok != NULL) {
+            strncpy(info->addr.strVal, tok, sizeof(info->addr.strVal) - 1);
+            info->addr.intVal = ipv4AddressStringToInt(tok);
+        }
+
+        // <dataComp>
+        tok = strtok(NULL, ",");
+        if (tok != NULL) {
+            info->dataComp = atoi(tok);
+        }
+
+        // <headerComp>
+        tok = strtok(NULL, ",");
+        if (tok != NULL) {
+            info->headerComp = atoi(tok);
+        }
+
+        rspLen++;
+    }
+
+    return rspLen;
+}
+
+// AT+CGDCONT?, one line at a time without pdn_info_t records
+template<typename TStream>
+int16_t QuectelBC95::BasicModem<TStream>::readNonIPContextId() {
+    char lineBuf[BC95_RX_LINE_BUF_LEN];
+    char type[8];
+    uint8_t cid;
+    int16_t found = -1;
+
+    writeCommand("AT+CGDCONT?");
+
+    // +CGDCONT:<cid>,"<type>",... per context, then OK
+    while (readResponse(lineBuf, sizeof(lineBuf)) == BC95_RESPONSE_TYPE_DATA) {
+        if (found < 0 && Parser::parse(lineBuf, "+CGDCONT:", &cid, ",\"", Parser::string(type, sizeof(type), '"')) &&
+                (strcmp(type, "NONIP") == 0 || strcmp(type, "Non-IP") == 0)) {
+            found = cid;
+        }
+    }
+
+    return found;
+}
+
+// AT+CFUN
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::setPhoneFunctionality(uint8_t level, unsigned long timeout) {
+    char command[16];
+
+    sprintf(command, "AT+CFUN=%u", level);
+    writeCommand(command);
+    return waitForOK(timeout);
+}
+
+// AT+CMEE=<n>
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::setErrorResponseFormat(uint8_t n) {
+    char command[16];
+
+    sprintf(command, "AT+CMEE=%u", n);
+    writeCommand(command);
+    return waitForOK();
+}
+
+// AT+CPSMS=<mode>
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::setPowerSavingMode(bool enabled) {
+    writeCommand(enabled ? "AT+CPSMS=1" : "AT+CPSMS=0");
+    return waitForOK();
+}
+
+// AT+CPSMS=<mode>,,,<Requested_Periodic-TAU>,<Requested_Active-Time>
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::setPowerSavingMode(bool enabled, uint32_t periodicTau, uint32_t activeTime) {
+    char command[40];
+    char tau[9];
+    char active[9];
+
+    encodeGPRSTimer(tau, periodicTau, T3412_UNITS, sizeof(T3412_UNITS) / sizeof(T3412_UNITS[0]));
+    encodeGPRSTimer(active, activeTime, T3324_UNITS, sizeof(T3324_UNITS) / sizeof(T3324_UNITS[0]));
+
+    sprintf(command, "AT+CPSMS=%u,,,%s,%s", enabled ? 1 : 0, tau, active);
+    writeCommand(command);
+    return waitForOK();
+}
+
+// AT+CPSMS?
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::readPowerSavingMode(cpsms_t *rsp) {
+    char rspBuf[40];
+    char tau[10];
+    char active[10];
+
+    writeCommand("AT+CPSMS?");
+
+    // +CPSMS:<mode>,,,<Requested_Periodic-TAU>,<Requested_Active-Time>
+    if (readSimpleDataResponse(rspBuf, sizeof(rspBuf)) != true || 
+        !Parser::parse(rspBuf, "+CPSMS:", &(rsp->mode)))
+    {
+        return false;
+    }
+
+    rsp->periodicTau = BC95_PSM_TIMER_DEACTIVATED;
+    rsp->activeTime = BC95_PSM_TIMER_DEACTIVATED;
+
+    // timers are only reported when they were requested
+    if (Parser::parse(rspBuf, "+CPSMS:", Parser::skip(), ",,,", Parser::string(tau, sizeof(tau), ','), ",", Parser::string(active, sizeof(active)))) {
+        rsp->periodicTau = decodeGPRSTimer(tau, T3412_UNITS, sizeof(T3412_UNITS) / sizeof(T3412_UNITS[0]));
+        rsp->activeTime = decodeGPRSTimer(active, T3324_UNITS, sizeof(T3324_UNITS) / sizeof(T3324_UNITS[0]));
+    }
+
+    return true;
+}
+
+// AT+CEDRXS=<mode>,5,<Requested_eDRX_value>
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::setExtendedDRX(bool enabled, uint8_t edrxCycle) {
+    char command[32];
+
+    sprintf(command, "AT+CEDRXS=%u,5,\"%c%c%c%c\"", 
+        enabled ? 1 : 0,
+        (edrxCycle & 0x08) ? '1' : '0',
+        (edrxCycle & 0x04) ? '1' : '0',
+        (edrxCycle & 0x02) ? '1' : '0',
+        (edrxCycle & 0x01) ? '1' : '0');
+    writeCommand(command);
+    return waitForOK();
+}
+
+// AT+CEDRXS?
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::readExtendedDRX(uint8_t *edrxCycle) {
+    char rspBuf[32];
+    char value[5];
+
+    writeCommand("AT+CEDRXS?");
+
+    // +CEDRXS:<AcT-type>,"<Requested_eDRX_value>", no line when eDRX is disabled
+    int rspType = readResponse(rspBuf, sizeof(rspBuf));
+
+    if (rspType == BC95_RESPONSE_TYPE_OK) {
+        *edrxCycle = 0;
+        return true;
+    }
+
+    if (rspType != BC95_RESPONSE_TYPE_DATA || waitForOK() != true ||
+        !Parser::parse(rspBuf, "+CEDRXS:", Parser::skip(), ",\"", Parser::string(value, sizeof(value), '"')) ||
+        strlen(value) != 4)
+    {
+        return false;
+    }
+
+    *edrxCycle = 0;
+
+    for (int i = 0 ; i < 4 ; i++) {
+        *edrxCycle = (*edrxCycle << 1) | (value[i] == '1');
+    }
+
+    return true;
+}
+
+// AT+CGMR, AT+NSOSTF=?, AT+NSONMI=?
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::probeCapabilities() {
+    char lineBuf[48];
+    int rspType;
+    bool nsonmiModes = false;
+
+    // the test command response would be taken for an inline +NSONMI
+    _inlineRx = false;
+    _fwRevision[0] = '\0';
+
+    writeCommand("AT+CGMR");
+
+    // "<component>,<revision>" lines on B656, "Revision:<revision>" on BC95-G
+    while ((rspType = readResponse(lineBuf, sizeof(lineBuf))) == BC95_RESPONSE_TYPE_DATA) {
+        const char *revision = NULL;
+
+        if (strncmp(lineBuf, "APPLICATION,", 12) == 0) {
+            revision = lineBuf + 12;
+        }
+        else if (strncmp(lineBuf, "Revision:", 9) == 0) {
+            revision = lineBuf + 9;
+        }
+
+        if (revision != NULL && strlen(revision) < sizeof(_fwRevision)) {
+            strcpy(_fwRevision, revision);
+        }
+    }
+
+    if (rspType != BC95_RESPONSE_TYPE_OK) {
+        return false;
+    }
+
+    _caps = 0;
+
+    // a test command is answered with OK when the firmware has the command
+    writeCommand("AT+NSOSTF=?");
+
+    while ((rspType = readResponse(lineBuf, sizeof(lineBuf))) == BC95_RESPONSE_TYPE_DATA) {
+    }
+
+    if (rspType == BC95_RESPONSE_TYPE_OK) {
+        _caps |= BC95_CAP_NSOSTF;
+    }
+
+    // +NSONMI:(0,1,2,3), mode 2 carries the remote address and the data
+    writeCommand("AT+NSONMI=?");
+
+    while ((rspType = readResponse(lineBuf, sizeof(lineBuf))) == BC95_RESPONSE_TYPE_DATA) {
+        if (strncmp(lineBuf, "+NSONMI:", 8) == 0 && rangeListContains(lineBuf + 8, 2)) {
+            nsonmiModes = true;
+        }
+    }
+
+    if (rspType == BC95_RESPONSE_TYPE_OK && nsonmiModes) {
+        _caps |= BC95_CAP_NSONMI_INLINE;
+    }
+
+    // numbered datagrams and +NSOSTR come with AT+NQSOS
+    writeCommand("AT+NQSOS=?");
+
+    while ((rspType = readResponse(lineBuf, sizeof(lineBuf))) == BC95_RESPONSE_TYPE_DATA) {
+    }
+
+    if (rspType == BC95_RESPONSE_TYPE_OK && (_caps & BC95_CAP_NSOSTF)) {
+        _caps |= BC95_CAP_NSOSTR;
+    }
+
+    // the modem may still be in mode 2 from before an MCU-only reset, the
+    // mode is set either way
+    if (_caps & BC95_CAP_NSONMI_INLINE) {
+      #ifdef BC95_INLINE_RX_BUF_LEN
+        writeCommand("AT+NSONMI=2");
+        _inlineRx = waitForOK();
+      #endif
+
+        if (!_inlineRx) {
+            writeCommand("AT+NSONMI=1");
+            waitForOK();
+        }
+    }
+
+    return true;
+}
+
+template<typename TStream>
+uint8_t QuectelBC95::BasicModem<TStream>::capabilities() {
+    return _caps;
+}
+
+template<typename TStream>
+const char *QuectelBC95::BasicModem<TStream>::firmwareRevision() {
+    return _fwRevision;
+}
+
+// AT+NRB - Reboot the modem
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::reboot(bool waitUntilFinished) {
+    char rspBuf[32];
+    int rspType;
+
+    writeCommand("AT+NRB");
+
+    // sockets don't survive the reboot
+    memset(_pendingRxLen, 0, sizeof(_pendingRxLen));
+    _rebooted = false;
+
+    // response: REBOOTING
+    if (readResponse(rspBuf, sizeof(rspBuf)) != BC95_RESPONSE_TYPE_DATA || strcmp(rspBuf, "REBOOTING") != 0) {
+        return false;
+    }
+
+    if (!waitUntilFinished) {
+        return true;
+    }
+
+    // REBOOT_CAUSE_APPLICATION_AT is taken by the URC handler, then the
+    // banner lines and OK follow
+    do {
+        rspType = readResponse(rspBuf, sizeof(rspBuf), NULL, BC95_DEFAULT_REBOOT_TIMEOUT);
+    } while (rspType == BC95_RESPONSE_TYPE_DATA);
+
+    return rspType == BC95_RESPONSE_TYPE_OK && _rebooted;
+}
+
+// AT+NUESTATS
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::readUEStatistics(nuestats_t *rsp) {
+    char lineBuf[32];
+    int rspType;
+
+    memset(rsp, 0, sizeof(nuestats_t));
+    rsp->ecl = BC95_NUESTATS_ECL_UNKNOWN;
+
+    writeCommand("AT+NUESTATS");
+
+    // one "<label>:<value>" line per value, then OK
+    while ((rspType = readResponse(lineBuf, sizeof(lineBuf))) == BC95_RESPONSE_TYPE_DATA) {
+        parseNUESTATSLine(lineBuf, rsp);
+    }
+
+    return rspType == BC95_RESPONSE_TYPE_OK;
+}
+
+// AT+NSOCR=<type>,<protocol>,<listen port>[,<receive control>] - Create a socket
+// For BC95, only type=DGRAM and protocol=17 are supported.
+template<typename TStream>
+int8_t QuectelBC95::BasicModem<TStream>::createSocket(uint16_t port, bool recvMsg) {
+    char command[32];
+    char rspBuf[BC95_MIN_RSP_BUF_LEN];
+    int socket;
+
+    sprintf(command, "AT+NSOCR=DGRAM,17,%u,%u", port, (recvMsg ? 1 : 0));
+    writeCommand(command);
+
+    if (readSimpleDataResponse(rspBuf, sizeof(rspBuf)) == true) {
+        socket = atoi(rspBuf);
+
+        if (socket >= 0 && socket < BC95_MAX_SOCKETS) {
+            _pendingRxLen[socket] = 0;
+        }
+
+        return socket;
+    }
+
+    return -1;
+}
+
+// AT+NSOST=<socket>,<remote_addr>,<remote_port>,<length>,<data> - Send UDP datagram
+// Writes the command already in txBuf (txLen bytes), the data hex encoded
+// and trailer in buffer-sized blocks, then <CR>.
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_writeHexCommand(char *txBuf, size_t txLen, size_t txBufLen, const uint8_t *dataBuf, size_t dataLen, const char *trailer) {
+    size_t trailerLen = strlen(trailer);
+    size_t i = 0;
+    bool lastBlock = false;
+
+  #ifdef BC95_DBG_WRITE_FRAME
+    dbg.print("WRITE: ").tagOff();
+  #endif
+
+    while (!lastBlock) {
+        while (i < dataLen && txLen + 2 <= txBufLen) {
+            txBuf[txLen++] = HEXMAP[dataBuf[i] >> 4];
+            txBuf[txLen++] = HEXMAP[dataBuf[i] & 0x0F];
+            i++;
+        }
+
+        // end
+        if (i >= dataLen && txLen + trailerLen < txBufLen) {
+            memcpy(txBuf + txLen, trailer, trailerLen);
+            txLen += trailerLen;
+            lastBlock = true;
+        }
+
+      #ifdef BC95_DBG_WRITE_FRAME
+        dbg.write((const uint8_t *)txBuf, txLen);
+      #endif
+
+        if (lastBlock) {
+            txBuf[txLen++] = '\r';
+        }
+
+        _streamWrite((const uint8_t *)txBuf, txLen);
+
+      #ifdef BC95_COMMAND_STATS
+        _statsTx(txLen);
+      #endif
+
+        txLen = 0;
+    }
+
+  #ifdef BC95_DBG_WRITE_FRAME
+    dbg.println().tagOn();
+  #endif
+    _streamFlush();
+}
+
+template<typename TStream>
+size_t QuectelBC95::BasicModem<TStream>::_sendUDPDatagram(uint8_t socket, const char *remoteHost, uint16_t remotePort, uint16_t flag, const uint8_t *dataBuf, size_t dataLen, uint8_t *sequence) {
+    char rspBuf[BC95_MIN_RSP_BUF_LEN];
+    char txBuf[BC95_NSOST_TX_BUF_LEN];
+    char trailer[5] = "";
+    size_t txLen;
+    uint16_t bytesSent;
+    uint8_t seq = 0;
+
+    if (sequence != NULL) {
+        *sequence = 0;
+    }
+
+    if (dataLen > BC95_NSOST_MAX_DATA_LEN || strlen(remoteHost) > 15) {
+        return 0;
+    }
+
+    _drainAsync();
+
+    if (!(_caps & BC95_CAP_NSOSTF)) {
+        flag = BC95_NSOST_FLAG_NONE;
+    }
+
+    if (sequence != NULL && (seq = _trackDatagram(socket)) != 0) {
+        formatTrailer(trailer, seq);
+        *sequence = seq;
+    }
+
+    // command and parameters, then the hex encoded data
+    txLen = formatNSOSTHeader(txBuf, socket, remoteHost, remotePort, seq != 0, flag, dataLen);
+    _beginCommand(txBuf);
+    _writeHexCommand(txBuf, txLen, sizeof(txBuf), dataBuf, dataLen, trailer);
+
+    if (readSimpleDataResponse(rspBuf, sizeof(rspBuf)) == true && Parser::parse(rspBuf, Parser::skip(), ",", &bytesSent)) {
+        return bytesSent;
+    }
+
+    if (seq != 0) {
+        _deliveryEnd(socket, seq, BC95_DELIVERY_FAILED);
+    }
+
+    return 0;
+}
+
+template<typename TStream>
+size_t QuectelBC95::BasicModem<TStream>::sendUDPDatagram(uint8_t socket, const char *remoteHost, uint16_t remotePort, const char *msg) {
+    return _sendUDPDatagram(socket, remoteHost, remotePort, BC95_NSOST_FLAG_NONE, (const uint8_t *)msg, strlen(msg), NULL);
+}
+
+template<typename TStream>
+size_t QuectelBC95::BasicModem<TStream>::sendUDPDatagram(uint8_t socket, const char *remoteHost, uint16_t remotePort, const uint8_t *dataBuf, size_t dataLen, uint16_t flag, uint8_t *sequence) {
+    return _sendUDPDatagram(socket, remoteHost, remotePort, flag, dataBuf, dataLen, sequence);
+}
+
+// Numbers the next datagram of socket, 0 when the firmware can't report
+// its delivery. The slot of the oldest tracked datagram is reused.
+template<typename TStream>
+uint8_t QuectelBC95::BasicModem<TStream>::_trackDatagram(uint8_t socket) {
+    if (!(_caps & BC95_CAP_NSOSTR)) {
+        return 0;
+    }
+
+    _lastSequence = (_lastSequence % BC95_NSOST_MAX_SEQUENCE) + 1;
+
+    tracked_datagram_t *entry = &_tracked[_trackedNext];
+    _trackedNext = (_trackedNext + 1) % BC95_MAX_TRACKED_DATAGRAMS;
+
+    entry->socket = socket;
+    entry->sequence = _lastSequence;
+    entry->status = BC95_DELIVERY_PENDING;
+    entry->reported = false;
+
+    return _lastSequence;
+}
+
+template<typename TStream>
+typename QuectelBC95::BasicModem<TStream>::tracked_datagram_t *QuectelBC95::BasicModem<TStream>::_findTracked(uint8_t socket, uint8_t sequence) {
+    for (uint8_t i = 0 ; i < BC95_MAX_TRACKED_DATAGRAMS ; i++) {
+        if (_tracked[i].sequence == sequence && _tracked[i].socket == socket && sequence != 0) {
+            return &_tracked[i];
+        }
+    }
+
+    return NULL;
+}
+
+// reported to the callback from poll(), a report for a datagram no longer
+// tracked is ignored
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_deliveryEnd(uint8_t socket, uint8_t sequence, uint8_t status) {
+    tracked_datagram_t *entry = _findTracked(socket, sequence);
+
+    if (entry != NULL && entry->status == BC95_DELIVERY_PENDING) {
+        entry->status = status;
+    }
+}
+
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_deliveryTask() {
+    for (uint8_t i = 0 ; i < BC95_MAX_TRACKED_DATAGRAMS ; i++) {
+        tracked_datagram_t *entry = &_tracked[i];
+
+        if (entry->sequence == 0 || entry->status == BC95_DELIVERY_PENDING || entry->reported) {
+            continue;
+        }
+
+        entry->reported = true;
+
+        if (_deliveryCallback != NULL) {
+            _deliveryCallback(entry->socket, entry->sequence, entry->status, _deliveryArg);
+        }
+    }
+}
+
+template<typename TStream>
+uint8_t QuectelBC95::BasicModem<TStream>::deliveryStatus(uint8_t socket, uint8_t sequence) {
+    tracked_datagram_t *entry = _findTracked(socket, sequence);
+
+    return (entry != NULL) ? entry->status : BC95_DELIVERY_UNKNOWN;
+}
+
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::setDeliveryCallback(delivery_callback_t callback, void *arg) {
+    _deliveryCallback = callback;
+    _deliveryArg = arg;
+}
+
+// AT+NQSOS=<socket>, a +NQSOS:<socket>,<sequence> line per datagram not reported yet
+template<typename TStream>
+int8_t QuectelBC95::BasicModem<TStream>::readPendingDeliveries(uint8_t socket, uint8_t *sequences, uint8_t maxCount) {
+    char command[16];
+    char lineBuf[BC95_MIN_RSP_BUF_LEN];
+    bool listed[BC95_MAX_TRACKED_DATAGRAMS];
+    uint8_t count = 0;
+    int rspType;
+
+    memset(listed, 0, sizeof(listed));
+
+    sprintf(command, "AT+NQSOS=%u", socket);
+    writeCommand(command);
+
+    while ((rspType = readResponse(lineBuf, sizeof(lineBuf))) == BC95_RESPONSE_TYPE_DATA) {
+        uint8_t s;
+        uint8_t sequence;
+
+        if (!Parser::parse(lineBuf, "+NQSOS:", &s, ",", &sequence) || s != socket) {
+            continue;
+        }
+
+        tracked_datagram_t *entry = _findTracked(socket, sequence);
+
+        if (entry != NULL) {
+            listed[entry - _tracked] = true;
+        }
+
+        if (count < maxCount && sequences != NULL) {
+            sequences[count] = sequence;
+        }
+
+        count++;
+    }
+
+    if (rspType != BC95_RESPONSE_TYPE_OK) {
+        return -1;
+    }
+
+    // the modem is done with these, their +NSOSTR went missing
+    for (uint8_t i = 0 ; i < BC95_MAX_TRACKED_DATAGRAMS ; i++) {
+        if (_tracked[i].sequence != 0 && _tracked[i].socket == socket && _tracked[i].status == BC95_DELIVERY_PENDING && !listed[i]) {
+            _tracked[i].status = BC95_DELIVERY_UNKNOWN;
+        }
+    }
+
+    return (count > 127) ? 127 : count;
+}
+
+// Prepares the decoder for the next NSORF response, decoded data is
+// appended after rsp->dataLen.
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_nsorfArm(nsorf_parser_t *parser, udp_rx_data_t *rsp, uint8_t *dataBuf, size_t dataBufLen) {
+    parser->armed = true;
+    parser->done = false;
+    parser->field = NSORFField::Socket;
+    parser->value = 0;
+    parser->addrLen = 0;
+    parser->hasNibble = false;
+    parser->length = 0;
+    parser->decoded = 0;
+    parser->remaining = 0;
+    parser->rsp = rsp;
+    parser->dataBuf = dataBuf;
+    parser->dataBufLen = dataBufLen;
+}
+
+// <socket>,<ip_addr>,<port>,<length>,<data>,<remaining_length>, an inline
+// +NSONMI has the same fields up to <data>
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_nsorfFeed(nsorf_parser_t *parser, uint8_t b) {
+    if (b == ',') {
+        switch (parser->field) {
+            case NSORFField::Cid:
+                parser->rsp->socket = parser->value;
+                parser->field = NSORFField::Length;
+                break;
+            case NSORFField::Socket:
+                parser->rsp->socket = parser->value;
+                parser->field = NSORFField::RemoteAddr;
+                break;
+            case NSORFField::RemoteAddr:
+                parser->rsp->remoteAddr.strVal[parser->addrLen] = '\0';
+                parser->rsp->remoteAddr.intVal = ipv4AddressStringToInt(parser->rsp->remoteAddr.strVal);
+                parser->field = NSORFField::RemotePort;
+                break;
+            case NSORFField::RemotePort:
+                parser->rsp->remotePort = parser->value;
+                parser->field = NSORFField::Length;
+                break;
+            case NSORFField::Length:
+                parser->length = parser->value;
+                parser->field = NSORFField::Data;
+                break;
+            case NSORFField::Data:
+                parser->field = NSORFField::Remaining;
+                break;
+            default:
+                parser->field = NSORFField::Invalid;
+                break;
+        }
+
+        parser->value = 0;
+        return;
+    }
+
+    switch (parser->field) {
+        case NSORFField::RemoteAddr:
+            if (parser->addrLen < sizeof(parser->rsp->remoteAddr.strVal) - 1) {
+                parser->rsp->remoteAddr.strVal[parser->addrLen++] = b;
+            }
+            break;
+
+        case NSORFField::Data: {
+            uint8_t v = HEX_DECODE(b);
+
+            if (v == 0xFF) {
+                // not a hex digit, the response is rejected in _nsorfEnd()
+                parser->field = NSORFField::Invalid;
+                break;
+            }
+
+            if (!parser->hasNibble) {
+                parser->nibble = v;
+                parser->hasNibble = true;
+                break;
+            }
+
+            parser->hasNibble = false;
+            parser->decoded++;
+
+            // the rest of a datagram larger than dataBuf is dropped
+            if (parser->rsp->dataLen < parser->dataBufLen) {
+                parser->dataBuf[parser->rsp->dataLen++] = (parser->nibble << 4) | v;
+            }
+            break;
+        }
+
+        case NSORFField::Invalid:
+            break;
+
+        default:
+            if (b < '0' || b > '9') {
+                parser->field = NSORFField::Invalid;
+                break;
+            }
+
+            parser->value = (parser->value * 10) + (b - '0');
+            break;
+    }
+}
+
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_nsorfEnd() {
+    _nsorf.armed = false;
+
+    if (_nsorf.field == NSORFField::Remaining && _nsorf.decoded == _nsorf.length) {
+        _nsorf.remaining = _nsorf.value;
+        _nsorf.done = true;
+    }
+}
+
+#ifdef BC95_INLINE_RX_BUF_LEN
+// The datagram is decoded right behind the records already held, the header
+// is written in front of it once the line is complete.
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_nsonmiArm() {
+    size_t offset = _inlineRxLen + sizeof(inline_rx_header_t);
+    size_t space = (offset < sizeof(_inlineRxBuf)) ? sizeof(_inlineRxBuf) - offset : 0;
+
+    memset(&_nsonmiRsp, 0, sizeof(_nsonmiRsp));
+    _nsorfArm(&_nsonmi, &_nsonmiRsp, _inlineRxBuf + offset, space);
+}
+
+// +NSONMI:<socket>,<remote_addr>,<remote_port>,<length>,<data>
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_nsonmiEnd() {
+    nsorf_parser_t *p = &_nsonmi;
+    inline_rx_header_t header;
+    uint16_t len;
+
+    p->armed = false;
+
+    // +NSONMI:<socket>,<length>, the modem has gone back to buffering
+    if (p->field == NSORFField::RemoteAddr) {
+        p->rsp->remoteAddr.strVal[p->addrLen] = '\0';
+
+        if (Parser::parse(p->rsp->remoteAddr.strVal, &len) && p->rsp->socket < BC95_MAX_SOCKETS) {
+            _pendingRxLen[p->rsp->socket] += len;
+        }
+        return;
+    }
+
+    if (p->field != NSORFField::Data || p->hasNibble || p->decoded != p->length || p->rsp->socket >= BC95_MAX_SOCKETS) {
+        return;
+    }
+
+    // lost, the modem has already forgotten it
+    if (p->rsp->dataLen < p->length || p->length == 0) {
+      #ifdef BC95_DBG_READ_FRAME
+        dbg.print("READ: INLINE BUFFER FULL, DROPPED ").tagOff().println(p->length).tagOn();
+      #endif
+
+        return;
+    }
+
+    header.socket = p->rsp->socket;
+    header.remotePort = p->rsp->remotePort;
+    header.dataLen = p->rsp->dataLen;
+    memcpy(header.remoteAddr, p->rsp->remoteAddr.strVal, sizeof(header.remoteAddr));
+
+    memcpy(_inlineRxBuf + _inlineRxLen, &header, sizeof(header));
+    _inlineRxLen += sizeof(header) + header.dataLen;
+}
+
+// +CRTDCP:<cid>,<cpdata_length>,<cpdata>, kept as a record of
+// BC95_CP_RX_SOCKET with the cid in place of the remote port
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_crtdcpEnd() {
+    nsorf_parser_t *p = &_nsonmi;
+    inline_rx_header_t header;
+
+    p->armed = false;
+
+    if (p->field != NSORFField::Data || p->hasNibble || p->decoded != p->length) {
+        return;
+    }
+
+    if (p->rsp->dataLen < p->length || p->length == 0) {
+      #ifdef BC95_DBG_READ_FRAME
+        dbg.print("READ: INLINE BUFFER FULL, DROPPED ").tagOff().println(p->length).tagOn();
+      #endif
+
+        return;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.socket = BC95_CP_RX_SOCKET;
+    header.remotePort = p->rsp->socket;
+    header.dataLen = p->rsp->dataLen;
+
+    memcpy(_inlineRxBuf + _inlineRxLen, &header, sizeof(header));
+    _inlineRxLen += sizeof(header) + header.dataLen;
+}
+
+// Moves the oldest datagram of socket out of the inline buffer.
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::_inlineRxTake(uint8_t socket, uint8_t *dataBuf, size_t dataBufLen, udp_rx_data_t *rsp) {
+    inline_rx_header_t header;
+    size_t pos = 0;
+
+    while (pos < _inlineRxLen) {
+        memcpy(&header, _inlineRxBuf + pos, sizeof(header));
+
+        size_t recordLen = sizeof(header) + header.dataLen;
+
+        if (header.socket == socket) {
+            rsp->socket = socket;
+            memcpy(rsp->remoteAddr.strVal, header.remoteAddr, sizeof(header.remoteAddr));
+            rsp->remoteAddr.intVal = ipv4AddressStringToInt(rsp->remoteAddr.strVal);
+            rsp->remotePort = header.remotePort;
+            // the rest of a datagram larger than dataBuf is dropped
+            rsp->dataLen = (header.dataLen < dataBufLen) ? header.dataLen : dataBufLen;
+            memcpy(dataBuf, _inlineRxBuf + pos + sizeof(header), rsp->dataLen);
+
+            memmove(_inlineRxBuf + pos, _inlineRxBuf + pos + recordLen, _inlineRxLen - pos - recordLen);
+            _inlineRxLen -= recordLen;
+
+          #ifdef BC95_COMMAND_STATS
+            _stats.datagramsReceived++;
+          #endif
+
+            return true;
+        }
+
+        pos += recordLen;
+    }
+
+    return false;
+}
+
+template<typename TStream>
+size_t QuectelBC95::BasicModem<TStream>::_inlineRxPending(uint8_t socket) {
+    inline_rx_header_t header;
+    size_t pos = 0;
+    size_t len = 0;
+
+    while (pos < _inlineRxLen) {
+        memcpy(&header, _inlineRxBuf + pos, sizeof(header));
+
+        if (header.socket == socket) {
+            len += header.dataLen;
+        }
+
+        pos += sizeof(header) + header.dataLen;
+    }
+
+    return len;
+}
+
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_inlineRxDrop(uint8_t socket) {
+    uint8_t dataBuf[1];
+    udp_rx_data_t rsp;
+
+    while (_inlineRxTake(socket, dataBuf, 0, &rsp)) {
+    }
+}
+#else
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::_inlineRxTake(uint8_t, uint8_t *, size_t, udp_rx_data_t *) {
+    return false;
+}
+
+template<typename TStream>
+size_t QuectelBC95::BasicModem<TStream>::_inlineRxPending(uint8_t) {
+    return 0;
+}
+
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_inlineRxDrop(uint8_t) {}
+#endif
+
+// The announced (+NSONMI) or remaining length fetches a whole datagram in
+// one round trip, the free buffer space is only a fallback.
+template<typename TStream>
+size_t QuectelBC95::BasicModem<TStream>::_nsorfRequestLen(size_t hint, size_t space) {
+    size_t reqLen = (hint > 0) ? hint : space;
+
+    if (reqLen == 0) {
+        reqLen = 1;
+    }
+    else if (reqLen > BC95_NSORF_MAX_DATA_LEN) {
+        reqLen = BC95_NSORF_MAX_DATA_LEN;
+    }
+
+    return reqLen;
+}
+
+// AT+NSORF=<socket>,<req_length> - Receive UDP datagram
+template<typename TStream>
+size_t QuectelBC95::BasicModem<TStream>::receiveUDPDatagram(uint8_t socket, uint8_t *dataBuf, size_t dataBufLen, udp_rx_data_t *rsp) {
+    // clear dataBuf and response
+    memset(dataBuf, 0, dataBufLen);
+    memset(rsp, 0, sizeof(udp_rx_data_t));
+    rsp->dataBuf = dataBuf;
+
+    char command[24];
+    char rspBuf[BC95_MIN_RSP_BUF_LEN];
+    size_t reqLen = (socket < BC95_MAX_SOCKETS) ? _pendingRxLen[socket] : 0;
+    size_t readLen = 0;
+    int rspType;
+
+    // delivered by +NSONMI already
+    if (_inlineRxTake(socket, dataBuf, dataBufLen, rsp)) {
+        return rsp->dataLen;
+    }
+
+    do {
+        sprintf(command, "AT+NSORF=%u,%u", socket, (unsigned int)_nsorfRequestLen(reqLen, dataBufLen - rsp->dataLen));
+        writeCommand(command);
+
+        _nsorfArm(&_nsorf, rsp, dataBuf, dataBufLen);
+        rspType = readResponse(rspBuf, sizeof(rspBuf));
+        _nsorf.armed = false;
+
+        if (rspType == BC95_RESPONSE_TYPE_OK) {
+            // nothing to read
+            _updatePendingRxLen(socket, 0);
+            return 0;
+        }
+        else if (rspType != BC95_RESPONSE_TYPE_DATA || !_nsorf.done) {
+            return 0;
+        }
+
+        if (waitForOK() != true) {
+            return 0;
+        }
+
+        readLen += _nsorf.decoded;
+        reqLen = _nsorf.remaining;
+    } while (reqLen > 0);
+
+    // counts what the modem delivered, including bytes dropped for lack of space
+    _updatePendingRxLen(socket, readLen);
+
+    return rsp->dataLen;
+}
+
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::_submitNSORF(size_t reqLen) {
+    async_command_t *cmd = _asyncReserve();
+
+    if (cmd == NULL) {
+        return false;
+    }
+
+    sprintf(cmd->command, "AT+NSORF=%u,%u", _asyncRx.socket, (unsigned int)_nsorfRequestLen(reqLen, _asyncRx.dataBufLen - _asyncRx.rsp->dataLen));
+    cmd->nsorf = true;
+    cmd->timeout = BC95_DEFAULT_READ_RESPONSE_TIMEOUT;
+    cmd->callback = _onAsyncNSORF;
+    cmd->arg = this;
+
+    _asyncCount++;
+
+    return true;
+}
+
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_onAsyncNSORF(int rspType, const char *rspBuf, size_t rspLen, void *arg) {
+    BasicModem *modem = (BasicModem *)arg;
+    async_rx_t *rx = &(modem->_asyncRx);
+
+    (void)rspLen;
+
+    // rspBuf is empty but set when the data line has been decoded
+    bool chunkOK = rspType == BC95_RESPONSE_TYPE_OK && rspBuf != NULL && modem->_nsorf.done;
+
+    if (chunkOK) {
+        rx->readLen += modem->_nsorf.decoded;
+    }
+
+    if (chunkOK && modem->_nsorf.remaining > 0 && modem->_submitNSORF(modem->_nsorf.remaining)) {
+        // rest of the datagram
+        return;
+    }
+
+    if (chunkOK) {
+        modem->_updatePendingRxLen(rx->socket, rx->readLen);
+    }
+    else {
+        if (rspType == BC95_RESPONSE_TYPE_OK && rspBuf == NULL) {
+            // nothing to read
+            modem->_updatePendingRxLen(rx->socket, 0);
+        }
+
+        rx->rsp->dataLen = 0;
+    }
+
+    rx->active = false;
 
-    return false;
+    if (rx->callback != NULL) {
+        rx->callback(rx->rsp, rx->arg);
+    }
 }
 
-// AT+COPS
-bool QuectelBC95::Modem::readPLMNSelection(cops_t *rsp) {
-    char rspBuf[32];
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::receiveUDPDatagramAsync(uint8_t socket, uint8_t *dataBuf, size_t dataBufLen, udp_rx_data_t *rsp, udp_rx_callback_t callback, void *arg) {
+    if (_asyncRx.active) {
+        return false;
+    }
 
-    memset(rsp, 0, sizeof(cops_t));
+    memset(rsp, 0, sizeof(udp_rx_data_t));
+    rsp->dataBuf = dataBuf;
 
-    writeCommand("AT+COPS?");
+    _asyncRx.active = true;
+    _asyncRx.served = false;
+    _asyncRx.socket = socket;
+    _asyncRx.dataBuf = dataBuf;
+    _asyncRx.dataBufLen = dataBufLen;
+    _asyncRx.readLen = 0;
+    _asyncRx.rsp = rsp;
+    _asyncRx.callback = callback;
+    _asyncRx.arg = arg;
+
+    // delivered by +NSONMI already, the callback runs from poll()
+    if (_inlineRxTake(socket, dataBuf, dataBufLen, rsp)) {
+        _asyncRx.served = true;
+        return true;
+    }
 
-    if (readSimpleDataResponse(rspBuf, sizeof(rspBuf)) == true) {
-        if (sscanf(rspBuf, "+COPS:%u,%u,\"%[^\"]", (unsigned int *)&(rsp->mode), (unsigned int *)&(rsp->format), rsp->oper) == 3) {
-            return true;
-        }
+    if (_submitNSORF((socket < BC95_MAX_SOCKETS) ? _pendingRxLen[socket] : 0) != true) {
+        _asyncRx.active = false;
+        return false;
     }
 
-    return false;
+    return true;
 }
 
-// AT+CGATT=<state> - PS attach or detach
-bool QuectelBC95::Modem::isPSAttached() {
-    char rspBuf[BC95_MIN_RSP_BUF_LEN];
-    uint8_t state;
-
-    writeCommand("AT+CGATT?");
+// AT+NSOCL=<socket> - Close a socket
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::closeSocket(uint8_t socket) {
+    char command[16];
 
-    if (readSimpleDataResponse(rspBuf, sizeof(rspBuf)) == true && sscanf(rspBuf, "+CGATT:%u", (unsigned int *)&state) == 1) {
-        return state != 0;
+    if (socket < BC95_MAX_SOCKETS) {
+        _pendingRxLen[socket] = 0;
     }
 
-    return false;
-}
-
-bool QuectelBC95::Modem::attachPS() {
-    writeCommand("AT+CGATT=1");
-    return waitForOK();
-}
+    _inlineRxDrop(socket);
 
-bool QuectelBC95::Modem::detachPS() {
-    writeCommand("AT+CGATT=0");
+    sprintf(command, "AT+NSOCL=%u", socket);
+    writeCommand(command);
     return waitForOK();
 }
 
-// AT+CIMI
-bool QuectelBC95::Modem::readInternationalMobileSubscriberIdentity(char *rspBuf, size_t rspBufLen) {
-    writeCommand("AT+CIMI");
-    return readSimpleDataResponse(rspBuf, rspBufLen) == true;
+// +NSONMI:<socket>,<length>, or held in the inline buffer
+template<typename TStream>
+size_t QuectelBC95::BasicModem<TStream>::pendingUDPDataLength(uint8_t socket) {
+    return (socket < BC95_MAX_SOCKETS) ? _pendingRxLen[socket] + _inlineRxPending(socket) : 0;
 }
 
-// AT+CGDCONT?
-uint8_t QuectelBC95::Modem::readPDNConnectionInfo(pdn_info_t rsp[], uint8_t rspMaxLen) {
-    char lineBuf[192];
-    size_t lineLen;
-    uint8_t rspLen = 0;
+// readLen of zero means NSORF found the socket empty
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_updatePendingRxLen(uint8_t socket, size_t readLen) {
+    if (socket >= BC95_MAX_SOCKETS) {
+        return;
+    }
 
-    char *tok;
+  #ifdef BC95_COMMAND_STATS
+    if (readLen > 0) {
+        _stats.datagramsReceived++;
+    }
+  #endif
 
-    memset(rsp, 0, sizeof(pdn_info_t) * rspMaxLen);
-    writeCommand("AT+CGDCONT?");
-    
-    // purge the first <CR><LF>
-    if (_stream->readBytesUntil('\n', lineBuf, sizeof(lineBuf)) <= 0) {
-        return 0;
+    if (readLen == 0 || readLen >= _pendingRxLen[socket]) {
+        _pendingRxLen[socket] = 0;
     }
+    else {
+        _pendingRxLen[socket] -= readLen;
+    }
+}
 
-    for (int i = 0 ; i <= rspMaxLen ; i++) {
-        lineLen = _stream->readBytesUntil('\n', lineBuf, sizeof(lineBuf));
+// AT+CSODCP=<cid>,<cpdata_length>,<cpdata>,<RAI>
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::sendControlPlaneData(uint8_t cid, const uint8_t *dataBuf, size_t dataLen, uint8_t rai) {
+    char txBuf[BC95_NSOST_TX_BUF_LEN];
+    char trailer[4];
 
-        if (lineLen == 1 &&
-            _stream->readBytesUntil('\n', lineBuf, sizeof(lineBuf)) == 3 &&
-            memcmp(lineBuf, "OK\r", 3) == 0) 
-        {
-            // <CR><LF>OK<CR><LF> is found
-            break;
-        }
+    if (dataLen == 0 || dataLen > BC95_CSODCP_MAX_DATA_LEN || rai > BC95_CSODCP_RAI_ONE_DL) {
+        return false;
+    }
 
-        // a response line is found
-        // +CGDCONT: <cid>,<type>,<apn>,<addr><dataComp>,<headerComp>
-        lineBuf[lineLen-1] = '\0';
+    _drainAsync();
 
-        // +CGDCONT:
-        tok = strtok(lineBuf, ":");
+    size_t txLen = formatCSODCPHeader(txBuf, cid, dataLen);
+    formatTrailer(trailer, rai);
+    _beginCommand(txBuf);
+    _writeHexCommand(txBuf, txLen, sizeof(txBuf), dataBuf, dataLen, trailer);
 
-        // <cid>
-        tok = strtok(NULL, ",");
-        if (tok != NULL) {
-            rsp[i].cid = atoi(tok);
-        }
+    return waitForOK();
+}
 
-        // <type>
-        tok = strtok(NULL, ",\"");
-        if (tok != NULL) {
-            strcpy(rsp[i].type, tok);
-        }
+// AT+CSODCP=<cid>,<cpdata_length>,<cpdata>,<RAI>
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::sendControlPlaneDataAsync(uint8_t cid, const uint8_t *dataBuf, size_t dataLen, command_callback_t callback, void *arg, uint8_t rai) {
+    if (dataLen == 0 || dataLen > BC95_ASYNC_DATA_BUF_LEN || dataLen > BC95_CSODCP_MAX_DATA_LEN || rai > BC95_CSODCP_RAI_ONE_DL) {
+        return false;
+    }
 
-        // <apn>
-        tok = strtok(NULL, ",\"");
-        if (tok != NULL) {
-            strcpy(rsp[i].apn, tok);
-        }
+    async_command_t *cmd = _asyncReserve();
 
-        // <addr>
-        tok = strtok(NULL, ",\"");
-        if (tok != NULL) {
-            strcpy(rsp[i].addr.strVal, tok);
-            rsp[i].addr.intVal = ipv4AddressStringToInt(tok);
-        }
+    if (cmd == NULL) {
+        return false;
+    }
 
-        // <dataComp>
-        tok = strtok(NULL, ",");
-        if (tok != NULL) {
-            rsp[i].dataComp = atoi(tok);
-        }
+    formatCSODCPHeader(cmd->command, cid, dataLen);
+    formatTrailer(cmd->trailer, rai);
+    // for completedDatagram()
+    cmd->socket = cid;
+    cmd->remotePort = 0;
+    cmd->flag = rai;
+    memcpy(cmd->data, dataBuf, dataLen);
+    cmd->dataLen = dataLen;
+    cmd->timeout = BC95_DEFAULT_READ_RESPONSE_TIMEOUT;
+    cmd->callback = callback;
+    cmd->arg = arg;
+
+    _asyncCount++;
+
+    return true;
+}
 
-        // <headerComp>
-        tok = strtok(NULL, ",");
-        if (tok != NULL) {
-            rsp[i].headerComp = atoi(tok);
-        }
+// AT+CRTDCP=<reporting>
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::setControlPlaneDataReporting(bool enabled) {
+  #ifdef BC95_INLINE_RX_BUF_LEN
+    _drainAsync();
 
-        rspLen++;
-    }
+    writeCommand(enabled ? "AT+CRTDCP=1" : "AT+CRTDCP=0");
 
-    return rspLen;
+    return waitForOK();
+  #else
+    // nowhere to keep the data
+    return !enabled;
+  #endif
 }
 
-// AT+CFUN
-bool QuectelBC95::Modem::setPhoneFunctionality(uint8_t level, unsigned long timeout) {
-    char command[16];
+template<typename TStream>
+size_t QuectelBC95::BasicModem<TStream>::receiveControlPlaneData(uint8_t *dataBuf, size_t dataBufLen, uint8_t *cid) {
+    udp_rx_data_t rsp;
 
-    sprintf(command, "AT+CFUN=%u", level);
-    writeCommand(command);
-    return waitForOK(timeout);
-}
+    // already decoded from +CRTDCP by whichever call read the stream
+    if (!_inlineRxTake(BC95_CP_RX_SOCKET, dataBuf, dataBufLen, &rsp)) {
+        return 0;
+    }
 
-// AT+CMEE=<n>
-bool QuectelBC95::Modem::setErrorResponseFormat(uint8_t n) {
-    char command[16];
+    if (cid != NULL) {
+        *cid = rsp.remotePort;
+    }
 
-    sprintf(command, "AT+CMEE=%u", n);
-    writeCommand(command);
-    return waitForOK();
+    return rsp.dataLen;
 }
 
-// AT+NRB - Reboot the modem
-bool QuectelBC95::Modem::reboot(bool waitUntilFinished) {
-    char rspBuf[32];
+template<typename TStream>
+size_t QuectelBC95::BasicModem<TStream>::pendingControlPlaneDataLength() {
+    return _inlineRxPending(BC95_CP_RX_SOCKET);
+}
 
-    writeCommand("AT+NRB");
+// AT+NPING=<ip>,<p_size>,<timeout>
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::pingHost(const char *ipAddressStr, ping_response_t *rsp, unsigned long timeout) {
+    _drainAsync();
 
-    // response: REBOOTING
-    if (readResponse(rspBuf, sizeof(rspBuf)) != BC95_RESPONSE_TYPE_DATA || strcmp(rspBuf, "REBOOTING") != 0) {
+    if (pingHostAsync(ipAddressStr, rsp, NULL, NULL, timeout) != true) {
         return false;
     }
 
-    if (!waitUntilFinished) {
-        return true;
+    while (_ping.status == BC95_PING_STATUS_IN_PROGRESS) {
+        poll();
     }
 
-    // response: REBOOT_CAUSE_APPLICATION_AT
-    if (readResponse(rspBuf, sizeof(rspBuf), NULL, BC95_DEFAULT_REBOOT_TIMEOUT) != BC95_RESPONSE_TYPE_DATA || strcmp(rspBuf, "REBOOT_CAUSE_APPLICATION_AT") != 0) {
+    return _ping.status == BC95_PING_STATUS_SUCCESS;
+}
+
+// AT+NPING=<ip>,<p_size>,<timeout>
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::pingHostAsync(const char *ipAddressStr, ping_response_t *rsp, ping_callback_t callback, void *arg, unsigned long timeout) {
+    char command[64];
+
+    if (_ping.status == BC95_PING_STATUS_IN_PROGRESS || strlen(ipAddressStr) > 15) {
         return false;
     }
 
-    // response: OK
-    return waitForOK();
+    sprintf(command, "AT+NPING=%s,16,%lu", ipAddressStr, timeout);
+
+    if (sendCommandAsync(command, _onAsyncNPING, this) != true) {
+        return false;
+    }
+
+    memset(rsp, 0, sizeof(ping_response_t));
+
+    _ping.status = BC95_PING_STATUS_IN_PROGRESS;
+    _ping.sent = false;
+    _ping.done = false;
+    _ping.timeout = timeout;
+    _ping.rsp = rsp;
+    _ping.callback = callback;
+    _ping.arg = arg;
+
+    return true;
 }
 
-// AT+NSOCR=<type>,<protocol>,<listen port>[,<receive control>] - Create a socket
-// For BC95, only type=DGRAM and protocol=17 are supported.
-int8_t QuectelBC95::Modem::createSocket(uint16_t port, bool recvMsg) {
-    char command[32];
-    char rspBuf[BC95_MIN_RSP_BUF_LEN];
+template<typename TStream>
+uint8_t QuectelBC95::BasicModem<TStream>::pingStatus() {
+    return _ping.status;
+}
 
-    sprintf(command, "AT+NSOCR=DGRAM,17,%u,%u", port, (recvMsg ? 1 : 0));
-    writeCommand(command);
+// OK only means the echo request went out, anything else ends the ping
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_onAsyncNPING(int rspType, const char *rspBuf, size_t rspLen, void *arg) {
+    BasicModem *modem = (BasicModem *)arg;
 
-    if (readSimpleDataResponse(rspBuf, sizeof(rspBuf)) == true) {
-        return atoi(rspBuf);
+    (void)rspLen;
+
+    if (modem->_ping.status != BC95_PING_STATUS_IN_PROGRESS) {
+        return;
     }
 
-    return -1;
-}
+    if (rspType == BC95_RESPONSE_TYPE_OK) {
+        modem->_ping.sent = true;
+        modem->_ping.sentMillis = millis();
 
-// AT+NSOST=<socket>,<remote_addr>,<remote_port>,<length>,<data> - Send UDP datagram
-size_t QuectelBC95::Modem::_sendUDPDatagram(uint8_t socket, const char *remoteHost, uint16_t remotePort, uint16_t flag, const uint8_t *dataBuf, size_t dataLen) {
-    const char *command;
-    char rspBuf[BC95_MIN_RSP_BUF_LEN];
-    size_t i;
-    uint8_t cH, cL;
-    size_t bytesSent;
-    
-    char pBuf[40] = {0};
-    
-    if (!flag) {
-        command = "AT+NSOST=";
-        sprintf(pBuf, "%u,%s,%u,%u,", socket, remoteHost, remotePort, dataLen);
+        // an immediate reply is a line of the command itself
+        if (rspBuf != NULL) {
+            modem->_pingURC(rspBuf);
+        }
     }
     else {
-        command = "AT+NSOSTF=";
-        sprintf(pBuf, "%u,%s,%u,0x%03X,%u,", socket, remoteHost, remotePort, flag, dataLen);
+        modem->_pingEnd(false);
     }
+}
 
-    // command and parameters
-  #ifdef BC95_DBG_WRITE_FRAME
-    dbg.print("WRITE: ").tagOff().print(command).print(pBuf);
-  #endif
-    _stream->print(command);
-    _stream->print(pBuf);
+// +NPING:<ip>,<ttl>,<rtt> or +NPINGERR:<err>, a late one after a timeout is dropped
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_pingURC(const char *line) {
+    ping_response_t *rsp = _ping.rsp;
 
-    // data
-    for (i = 0 ; i < dataLen ; i++) {
-        cH = HEXMAP[(dataBuf[i] & 0xF0) >> 4];
-        cL = HEXMAP[dataBuf[i] & 0x0F];
-        
-      #ifdef BC95_DBG_WRITE_FRAME
-        dbg.write(cH);
-        dbg.write(cL);
-      #endif
-        _stream->write(cH);
-        _stream->write(cL);
+    if (_ping.status != BC95_PING_STATUS_IN_PROGRESS) {
+        return;
     }
-    
-    // end
-  #ifdef BC95_DBG_WRITE_FRAME
-    dbg.println().tagOn();
-  #endif
-    _stream->write('\r');
-    _stream->flush();
 
-    if (readSimpleDataResponse(rspBuf, sizeof(rspBuf)) == true && sscanf(rspBuf, "%*u,%u", (unsigned int *)&bytesSent) == 1) {
-        return bytesSent;
+    if (Parser::parse(line, "+NPING:", Parser::string(rsp->addr.strVal, sizeof(rsp->addr.strVal), ','), ",", &(rsp->ttl), ",", &(rsp->rtt))) {
+        rsp->addr.intVal = ipv4AddressStringToInt(rsp->addr.strVal);
+        _pingEnd(true);
+    }
+    else {
+        _pingEnd(false);
     }
-
-    return 0;
 }
 
-size_t QuectelBC95::Modem::sendUDPDatagram(uint8_t socket, const char *remoteHost, uint16_t remotePort, const char *msg) {
-    return _sendUDPDatagram(socket, remoteHost, remotePort, BC95_NSOST_FLAG_NONE, (const uint8_t *)msg, strlen(msg));
+// The URC may come in while a synchronous command reads the stream, the
+// callback is left to poll() so it never runs in the middle of one.
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_pingEnd(bool success) {
+    _ping.status = success ? BC95_PING_STATUS_SUCCESS : BC95_PING_STATUS_FAILED;
+    _ping.done = true;
 }
 
-size_t QuectelBC95::Modem::sendUDPDatagram(uint8_t socket, const char *remoteHost, uint16_t remotePort, const uint8_t *dataBuf, size_t dataLen) {
-    return _sendUDPDatagram(socket, remoteHost, remotePort, BC95_NSOST_FLAG_NONE, dataBuf, dataLen);
-}
+template<typename TStream>
+void QuectelBC95::BasicModem<TStream>::_pingTask() {
+    if (_ping.status == BC95_PING_STATUS_IN_PROGRESS && _ping.sent &&
+        labs(millis() - _ping.sentMillis) >= _ping.timeout + BC95_PING_URC_GRACE_TIMEOUT) {
+        _pingEnd(false);
+    }
 
-// AT+NSORF=<socket>,<req_length> - Receive UDP datagram
-size_t QuectelBC95::Modem::receiveUDPDatagram(uint8_t socket, uint8_t *dataBuf, size_t dataBufLen, udp_rx_data_t *rsp) {
-    // clear dataBuf and response
-    memset(dataBuf, 0, dataBufLen);
-    memset(rsp, 0, sizeof(udp_rx_data_t));
-    rsp->dataBuf = dataBuf;
+    if (_ping.done) {
+        _ping.done = false;
 
-    char command[16];
-    char chunkBuf[BC95_NSORF_CHUNK_BUF_LEN];
-    size_t remaining = BC95_NSORF_CHUNK_LEN;
+        if (_ping.callback != NULL) {
+            _ping.callback(_ping.status == BC95_PING_STATUS_SUCCESS, _ping.rsp, _ping.arg);
+        }
+    }
+}
 
-    char *payload;
-    size_t payloadLen, i;
-    int payloadPos;
+// AT+NBAND=<n>[,<n>...]
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::setBands(const uint8_t *bands, uint8_t count) {
+    char command[48];
+    size_t len;
 
-    sprintf(command, "AT+NSORF=%u,%u", socket, BC95_NSORF_CHUNK_LEN);
+    if (count == 0 || count > BC95_MAX_BANDS) {
+        return false;
+    }
 
-    while (remaining > 0) {
-        writeCommand(command);
+    len = sprintf(command, "AT+NBAND=%u", bands[0]);
 
-        if (readResponse(chunkBuf, BC95_NSORF_CHUNK_BUF_LEN) != BC95_RESPONSE_TYPE_DATA) {
-            return 0;
-        }
+    for (uint8_t i = 1 ; i < count ; i++) {
+        len += sprintf(command + len, ",%u", bands[i]);
+    }
 
-        payloadPos = 0;
+    writeCommand(command);
+    return waitForOK();
+}
 
-        if (sscanf(chunkBuf, "%u,%[^,],%u,%u,%n", 
-                (unsigned int *)&(rsp->socket),
-                rsp->remoteAddr.strVal,
-                (unsigned int *)&(rsp->remotePort),
-                (unsigned int *)&payloadLen,
-                &payloadPos
-            ) !=  4 || payloadPos == 0)
-        {
-            return 0;
-        }
+// AT+NBAND?
+template<typename TStream>
+uint8_t QuectelBC95::BasicModem<TStream>::readBands(uint8_t *bands, uint8_t maxCount) {
+    char rspBuf[8 + BC95_MAX_BANDS * 3];
+    const char *p;
+    uint8_t count = 0;
 
-        if (waitForOK() != true) {
-            return 0;
-        }
+    writeCommand("AT+NBAND?");
 
-        payload = chunkBuf + payloadPos;
+    // +NBAND:<n>[,<n>...]
+    if (readSimpleDataResponse(rspBuf, sizeof(rspBuf)) != true || (p = Parser::parseField(rspBuf, "+NBAND:")) == NULL) {
+        return 0;
+    }
 
-        for (i = 0 ; i < payloadLen ; i++) {
-            if (rsp->dataLen >= dataBufLen) {
-                break;
-            }
+    while (count < maxCount && (p = Parser::parseField(p, &bands[count])) != NULL) {
+        count++;
 
-            dataBuf[rsp->dataLen] = hexCharToInt(payload[i*2]) * 16 + hexCharToInt(payload[i*2+1]);
-            rsp->dataLen++;
+        if (*p != ',') {
+            break;
         }
-        
-        remaining = atoi(payload + (2 * payloadLen) + 1);  // skips the last comma
+
+        p++;
     }
 
-    return rsp->dataLen;
+    return count;
 }
 
-// AT+NSOCL=<socket> - Close a socket
-bool QuectelBC95::Modem::closeSocket(uint8_t socket) {
-    char command[16];
+// AT+NEARFCN=<search_mode>,<earfcn>[,<pci>], the PCI in hex
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::setEARFCNLock(uint32_t earfcn, uint16_t pci) {
+    char command[40];
+
+    if (pci == BC95_NEARFCN_PCI_ANY) {
+        sprintf(command, "AT+NEARFCN=0,%lu", (unsigned long)earfcn);
+    }
+    else {
+        sprintf(command, "AT+NEARFCN=0,%lu,%X", (unsigned long)earfcn, pci);
+    }
 
-    sprintf(command, "AT+NSOCL=%u", socket);
     writeCommand(command);
     return waitForOK();
 }
 
-// AT+NPING=<ip>,<p_size>,<timeout>
-bool QuectelBC95::Modem::pingHost(const char *ipAddressStr, ping_response_t *rsp, unsigned long timeout) {
-    char command[64];
-    char rspBuf[64];
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::clearEARFCNLock() {
+    writeCommand("AT+NEARFCN=0,0");
+    return waitForOK();
+}
 
-    memset(rsp, 0, sizeof(ping_response_t));
-    sprintf(command, "AT+NPING=%s,16,%lu", ipAddressStr, timeout);
-    writeCommand(command);
+// NB-IoT bands, 36.101 downlink EARFCN ranges
+template<typename TStream>
+uint8_t QuectelBC95::BasicModem<TStream>::bandOfEARFCN(uint32_t earfcn) {
+    static const struct {
+        uint8_t band;
+        uint32_t first;
+        uint32_t last;
+    } ranges[] = {
+        { 1, 0, 599 },
+        { 2, 600, 1199 },
+        { 3, 1200, 1949 },
+        { 4, 1950, 2399 },
+        { 5, 2400, 2649 },
+        { 8, 3450, 3799 },
+        { 12, 5010, 5179 },
+        { 13, 5180, 5279 },
+        { 17, 5730, 5849 },
+        { 18, 5850, 5999 },
+        { 19, 6000, 6149 },
+        { 20, 6150, 6449 },
+        { 25, 8040, 8689 },
+        { 26, 8690, 9039 },
+        { 28, 9210, 9659 },
+        { 66, 66436, 67335 }
+    };
+
+    for (uint8_t i = 0 ; i < sizeof(ranges) / sizeof(ranges[0]) ; i++) {
+        if (earfcn >= ranges[i].first && earfcn <= ranges[i].last) {
+            return ranges[i].band;
+        }
+    }
 
-    if (waitForOK() == true) {
-        if (readResponse(rspBuf, sizeof(rspBuf), NULL, timeout+1000) == BC95_RESPONSE_TYPE_DATA) {
-            if (strncmp(rspBuf, "+NPINGERR", 9) == 0) {
-                return false;
-            }
+    return 0;
+}
 
-            if (sscanf(rspBuf, "+NPING:%[^,],%u,%u", rsp->addr.strVal, (unsigned int *)&(rsp->ttl), (unsigned int *)&(rsp->rtt)) == 3) {
-                rsp->addr.intVal = ipv4AddressStringToInt(rsp->addr.strVal);
-                return true;
-            }
+// AT+NCONFIG=AUTOCONNECT,<enabled>
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::readAutoConnect(bool *enabled) {
+    char lineBuf[48];
+    int rspType;
+    bool found = false;
+
+    writeCommand("AT+NCONFIG?");
+
+    // +NCONFIG:<function>,<value> per setting, then OK
+    while ((rspType = readResponse(lineBuf, sizeof(lineBuf))) == BC95_RESPONSE_TYPE_DATA) {
+        if (strcmp(lineBuf, "+NCONFIG:AUTOCONNECT,TRUE") == 0) {
+            *enabled = true;
+            found = true;
+        }
+        else if (strcmp(lineBuf, "+NCONFIG:AUTOCONNECT,FALSE") == 0) {
+            *enabled = false;
+            found = true;
         }
     }
 
-    return false;
+    return rspType == BC95_RESPONSE_TYPE_OK && found;
 }
 
-// AT+NCONFIG=AUTOCONNECT,<enabled>
-bool QuectelBC95::Modem::configAutoConnect(bool enabled) {
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::configAutoConnect(bool enabled) {
     if (enabled) {
         writeCommand("AT+NCONFIG=AUTOCONNECT,TRUE");
     }
@@ -703,4 +3340,83 @@ bool QuectelBC95::Modem::configAutoConnect(bool enabled) {
     return waitForOK();
 }
 
+// AT+NPSMR=<n>
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::setPowerSavingStatusReporting(bool enabled) {
+    writeCommand(enabled ? "AT+NPSMR=1" : "AT+NPSMR=0");
+    return waitForOK();
+}
+
+// AT+NPSMR?
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::readPowerSavingStatus(uint8_t *status) {
+    char rspBuf[BC95_MIN_RSP_BUF_LEN];
+    uint8_t n;
+
+    writeCommand("AT+NPSMR?");
+
+    // +NPSMR:<n>[,<mode>], <mode> only when reporting is enabled
+    if (readSimpleDataResponse(rspBuf, sizeof(rspBuf)) == true && 
+        Parser::parse(rspBuf, "+NPSMR:", &n, ",", status))
+    {
+        _psmStatus = *status;
+        return true;
+    }
+
+    return false;
+}
+
+template<typename TStream>
+uint8_t QuectelBC95::BasicModem<TStream>::powerSavingStatus() {
+    return _psmStatus;
+}
+
+// AT+NATSPEED=<baud_rate>,<timeout>,<store>,<sync_mode>
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::setUARTBaudRate(uint32_t baudRate, uint8_t timeout, bool store) {
+    char command[40];
+
+    switch (baudRate) {
+        case 4800:
+        case 9600:
+        case 57600:
+        case 115200:
+        case 230400:
+        case 460800:
+            break;
+
+        default:
+            return false;
+    }
+
+    if (timeout > 30) {
+        return false;
+    }
+
+    // sync_mode 2, the default of the firmware
+    sprintf(command, "AT+NATSPEED=%lu,%u,%u,2", (unsigned long)baudRate, timeout, store ? 1 : 0);
+    writeCommand(command);
+
+    return waitForOK();
+}
+
+// AT+NATSPEED?
+template<typename TStream>
+bool QuectelBC95::BasicModem<TStream>::readUARTBaudRate(uint32_t *baudRate) {
+    char rspBuf[48];
+
+    writeCommand("AT+NATSPEED?");
+
+    // +NATSPEED:<baud_rate>,<timeout>,<store>,<sync_mode>,<stopbits>,<parity>,<xonxoff>
+    return readSimpleDataResponse(rspBuf, sizeof(rspBuf)) == true
+        && Parser::parse(rspBuf, "+NATSPEED:", baudRate);
+}
+
+// ----------------------------------------
+//   Instantiations
+// ----------------------------------------
+template class QuectelBC95::BasicModem<Stream>;
 
+#ifdef BC95_MODEM_STREAM_TYPE
+template class QuectelBC95::BasicModem<BC95_MODEM_STREAM_TYPE>;
+#endif
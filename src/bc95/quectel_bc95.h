@@ -20,11 +20,32 @@
 // #define BC95_DBG_READ_TIMEOUT
 // ----------------------------------------
 
+// ----------------------------------------
+//   Statistics
+// ----------------------------------------
+// per command class latency histograms and UART byte counters, see readStats()
+// #define BC95_COMMAND_STATS
+// ----------------------------------------
+
+// ----------------------------------------
+//   Stream Type
+// ----------------------------------------
+// QuectelBC95::Modem talks to any Stream through virtual calls. Naming the
+// class of the modem port here also compiles BasicModem<type>, which calls
+// it directly. The port must be of exactly that class, not derived from it
+// (e.g. SAMD Serial1 is a Uart, not a HardwareSerial).
+// #define BC95_MODEM_STREAM_TYPE  HardwareSerial
+// ----------------------------------------
+
 #define BC95_DEFAULT_STREAM_READ_TIMEOUT    100
 #define BC95_DEFAULT_READ_RESPONSE_TIMEOUT  100
 #define BC95_DEFAULT_CFUN_RESPONSE_TIMEOUT  10000
 #define BC95_DEFAULT_PING_TIMEOUT           5000
+// how long after its timeout a ping still waits for +NPING/+NPINGERR
+#define BC95_PING_URC_GRACE_TIMEOUT         1000
 #define BC95_DEFAULT_REBOOT_TIMEOUT         10000
+// seconds the modem waits for a command at a new baud rate before it falls back
+#define BC95_DEFAULT_NATSPEED_TIMEOUT       3
 
 // minimum length that can receive +CME ERROR: message
 #define BC95_MIN_RSP_BUF_LEN  16
@@ -35,6 +56,14 @@
 #define BC95_RESPONSE_TYPE_ERROR    2
 #define BC95_RESPONSE_TYPE_TIMEOUT  3
 #define BC95_RESPONSE_TYPE_UNKNOWN  4
+// only reported to asynchronous command callbacks
+#define BC95_RESPONSE_TYPE_CANCELLED  5
+
+// BC95::Modem::pingStatus() return values
+#define BC95_PING_STATUS_IDLE         0
+#define BC95_PING_STATUS_IN_PROGRESS  1
+#define BC95_PING_STATUS_SUCCESS      2
+#define BC95_PING_STATUS_FAILED       3
 
 // EPS Network Registration Status
 #define BC95_NETWORK_STAT_NOT_REGISTERED                         0
@@ -63,28 +92,232 @@
 #define BC95_CSCON_STATE_GERAN_CS_PS_CONNECTED  6
 #define BC95_CSCON_STATE_E_UTRAN_CONNECTED      7
 
+// CEREG access technology when the location is not reported
+#define BC95_CEREG_ACT_UNKNOWN  0xFF
+
+// +NPSMR power saving status, BC95::Modem::powerSavingStatus()
+#define BC95_PSM_STATUS_NORMAL   0
+#define BC95_PSM_STATUS_PSM      1
+#define BC95_PSM_STATUS_UNKNOWN  0xFF
+
+// CPSMS timer reported as deactivated by the network
+#define BC95_PSM_TIMER_DEACTIVATED  0xFFFFFFFF
+
+// CEDRXS requested eDRX cycle (NB-S1), 4-bit value
+#define BC95_EDRX_CYCLE_20_48_S     0x02
+#define BC95_EDRX_CYCLE_40_96_S     0x03
+#define BC95_EDRX_CYCLE_81_92_S     0x05
+#define BC95_EDRX_CYCLE_163_84_S    0x09
+#define BC95_EDRX_CYCLE_327_68_S    0x0A
+#define BC95_EDRX_CYCLE_655_36_S    0x0B
+#define BC95_EDRX_CYCLE_1310_72_S   0x0C
+#define BC95_EDRX_CYCLE_2621_44_S   0x0D
+#define BC95_EDRX_CYCLE_5242_88_S   0x0E
+#define BC95_EDRX_CYCLE_10485_76_S  0x0F
+
+// NUESTATS values that are not known (yet)
+#define BC95_NUESTATS_TX_POWER_NONE  (-32768)  // nothing transmitted yet
+#define BC95_NUESTATS_ECL_UNKNOWN    0xFF
+
 // CFUN level
 #define BC95_CFUN_MINIMUM  0
 #define BC95_CFUN_FULL     1
 
+// AT+NEARFCN, any cell on the EARFCN
+#define BC95_NEARFCN_PCI_ANY  0xFFFF
+
+// AT+NBAND? list length, BC95 variants support up to 6 bands
+#define BC95_MAX_BANDS  8
+
 // NSOST max data length
 #define BC95_NSOST_MAX_DATA_LEN  512
 
+// AT+NSOST line assembly buffer, holds the longest command header
+#define BC95_NSOST_TX_BUF_LEN  64
+
 // NSOST flags
 #define BC95_NSOST_FLAG_NONE                    0
 #define BC95_NSOST_FLAG_HIGH_PRIORITY           0x100
 #define BC95_NSOST_FLAG_RELEASE_AFTER_NEXT_MSG  0x200
 #define BC95_NSOST_FLAG_RELEASE_AFTER_REPLIED   0x400
 
-// NSORF receiving chunk
-#define BC95_NSORF_CHUNK_LEN      32
-#define BC95_NSORF_CHUNK_BUF_LEN  (32 + (BC95_NSORF_CHUNK_LEN * 2))
+#define BC95_NSOST_RELEASE_FLAGS  (BC95_NSOST_FLAG_RELEASE_AFTER_NEXT_MSG | BC95_NSOST_FLAG_RELEASE_AFTER_REPLIED)
+
+// AT+NSOSTF sequence numbers run 1..255, +NSOSTR reports each one's delivery
+#define BC95_NSOST_MAX_SEQUENCE  255
+// datagrams tracked at once, the oldest one is forgotten
+#define BC95_MAX_TRACKED_DATAGRAMS  8
+
+// BC95::Modem::deliveryStatus() values
+#define BC95_DELIVERY_UNKNOWN  0  // not tracked, forgotten or its report was lost
+#define BC95_DELIVERY_PENDING  1
+#define BC95_DELIVERY_SENT     2  // +NSOSTR status 1, went out over the radio
+#define BC95_DELIVERY_FAILED   3  // +NSOSTR status 0, refused, or lost in a reboot
+
+// max. number of sockets
+#define BC95_MAX_SOCKETS  7
+
+// AT+CSODCP max data length, non-IP data over the control plane (NIDD)
+#define BC95_CSODCP_MAX_DATA_LEN  512
+
+// AT+CSODCP release assistance indication
+#define BC95_CSODCP_RAI_NONE      0
+#define BC95_CSODCP_RAI_NO_UL_DL  1  // no further uplink or downlink expected
+#define BC95_CSODCP_RAI_ONE_DL    2  // only a single downlink expected
+
+// firmware features found by probeCapabilities(), BC95::Modem::capabilities()
+#define BC95_CAP_NSOSTF         0x01  // AT+NSOSTF, datagrams with flags
+#define BC95_CAP_NSONMI_INLINE  0x02  // AT+NSONMI=2, +NSONMI carries the datagram
+#define BC95_CAP_NSOSTR         0x04  // AT+NSOSTF sequence numbers, +NSOSTR and AT+NQSOS
+// assumed until probed, B656 has AT+NSOSTF
+#define BC95_CAP_DEFAULT        BC95_CAP_NSOSTF
+
+// NSORF max. requested length, the response is decoded as it arrives
+#define BC95_NSORF_MAX_DATA_LEN  512
+
+// asynchronous command engine
+#ifndef BC95_ASYNC_QUEUE_LEN
+  #if defined(__SAM3X8E__) || defined(__SAMD21G18A__) || defined(ESP32)
+    #define BC95_ASYNC_QUEUE_LEN     4
+    #define BC95_ASYNC_DATA_BUF_LEN  512
+  #elif defined (__AVR_ATmega2560__)
+    #define BC95_ASYNC_QUEUE_LEN     2
+    #define BC95_ASYNC_DATA_BUF_LEN  256
+  #else
+    #define BC95_ASYNC_QUEUE_LEN     1
+    #define BC95_ASYNC_DATA_BUF_LEN  64
+  #endif
+#endif
+
+#define BC95_ASYNC_COMMAND_BUF_LEN  48
+
+// first data line of a queued command, NSORF data doesn't go through it,
+// a longer line is dropped (rspBuf is NULL)
+#ifndef BC95_ASYNC_RSP_BUF_LEN
+  #if defined(__SAM3X8E__) || defined(__SAMD21G18A__) || defined(ESP32) || defined (__AVR_ATmega2560__)
+    #define BC95_ASYNC_RSP_BUF_LEN  64
+  #else
+    #define BC95_ASYNC_RSP_BUF_LEN  32
+  #endif
+#endif
+
+// max. bytes written to the stream per poll(), also used when the stream
+// cannot report its free tx buffer space (e.g. SoftwareSerial)
+#define BC95_ASYNC_TX_CHUNK_LEN  16
+
+// longest ';'-joined line sent by sendCommandBatch(), longer batches are
+// split over several lines
+#define BC95_BATCH_LINE_LEN  96
+
+// "+NAME" of every command on the line in flight, ';'-separated, names
+// that don't fit are left out and their lines may be taken for URCs
+#ifndef BC95_COMMAND_NAMES_LEN
+  #if defined(__SAM3X8E__) || defined(__SAMD21G18A__) || defined(ESP32) || defined (__AVR_ATmega2560__)
+    #define BC95_COMMAND_NAMES_LEN  48
+  #else
+    #define BC95_COMMAND_NAMES_LEN  24
+  #endif
+#endif
+
+// APPLICATION revision from AT+CGMR, e.g. "V150R100C10B300SP5"
+#ifndef BC95_FW_REVISION_LEN
+  #if defined(__SAM3X8E__) || defined(__SAMD21G18A__) || defined(ESP32) || defined (__AVR_ATmega2560__)
+    #define BC95_FW_REVISION_LEN  32
+  #else
+    #define BC95_FW_REVISION_LEN  24
+  #endif
+#endif
+
+// received lines, framed once and queued until the pending command reads
+// them, each line takes its length + 1 bytes of the ring (line length <= 256)
+#ifndef BC95_RX_LINE_BUF_LEN
+  #if defined(__SAM3X8E__) || defined(__SAMD21G18A__) || defined(ESP32)
+    #define BC95_RX_LINE_BUF_LEN  256
+    #define BC95_RX_RING_LEN      512
+  #elif defined (__AVR_ATmega2560__)
+    #define BC95_RX_LINE_BUF_LEN  192
+    #define BC95_RX_RING_LEN      256
+  #else
+    #define BC95_RX_LINE_BUF_LEN  80
+    #define BC95_RX_RING_LEN      96
+  #endif
+#endif
+
+// datagrams delivered inline by +NSONMI (AT+NSONMI=2) are held here until
+// read, the modem doesn't keep them. Without it every datagram is fetched
+// with AT+NSORF. Control plane data (+CRTDCP) is only received into it.
+#ifndef BC95_INLINE_RX_BUF_LEN
+  #if defined(__SAM3X8E__) || defined(__SAMD21G18A__) || defined(ESP32)
+    #define BC95_INLINE_RX_BUF_LEN  1024
+  #endif
+#endif
+
+// socket of +CRTDCP records in the inline buffer
+#define BC95_CP_RX_SOCKET  0xFF
+
+// max. number of URC handlers registered with setURCHandler()
+#define BC95_MAX_URC_HANDLERS  4
+
+#ifdef BC95_COMMAND_STATS
+    // command classes, command_stats_t index
+    #define BC95_STATS_CLASS_NSOST   0  // AT+NSOST, AT+NSOSTF
+    #define BC95_STATS_CLASS_NSORF   1  // one per round trip
+    #define BC95_STATS_CLASS_SOCKET  2  // AT+NSOCR, AT+NSOCL
+    #define BC95_STATS_CLASS_NPING   3  // until OK, the reply is a URC
+    #define BC95_STATS_CLASS_OTHER   4
+    #define BC95_STATS_CLASS_COUNT   5
+
+    // bucket 0 counts latencies below 1 ms, bucket i below 2^i ms, the last
+    // one everything longer
+    #define BC95_STATS_HISTOGRAM_LEN  16
+#endif
 
 namespace QuectelBC95 {
 
+// +CME ERROR codes, reported with AT+CMEE=1
+typedef enum {
+    CME_ERROR_NONE                      = 0,  // the command succeeded
+    CME_ERROR_OPERATION_NOT_ALLOWED     = 3,
+    CME_ERROR_OPERATION_NOT_SUPPORTED   = 4,
+    CME_ERROR_SIM_NOT_INSERTED          = 10,
+    CME_ERROR_SIM_PIN_REQUIRED          = 11,
+    CME_ERROR_SIM_FAILURE               = 13,
+    CME_ERROR_SIM_BUSY                  = 14,
+    CME_ERROR_MEMORY_FAILURE            = 23,
+    CME_ERROR_NO_NETWORK_SERVICE        = 30,
+    CME_ERROR_INCORRECT_PARAMETERS      = 50,
+    CME_ERROR_COMMAND_DISABLED          = 51,
+    CME_ERROR_COMMAND_ABORTED           = 52,
+    CME_ERROR_UPLINK_BUSY               = 159,  // flow control
+    CME_ERROR_PARAMETER_NOT_CONFIGURED  = 512,
+    CME_ERROR_TUP_NOT_REGISTERED        = 513,
+    CME_ERROR_AT_INTERNAL_ERROR         = 514,
+    CME_ERROR_CID_IS_ACTIVE             = 515,
+    CME_ERROR_INCORRECT_STATE           = 516,
+    CME_ERROR_CID_IS_INVALID            = 517,
+    CME_ERROR_CID_IS_NOT_ACTIVE         = 518,
+    CME_ERROR_DEACTIVATE_LAST_CID       = 520,
+    CME_ERROR_CID_IS_NOT_DEFINED        = 521,
+    CME_ERROR_UART_PARITY_ERROR         = 522,
+    CME_ERROR_UART_FRAME_ERROR          = 523,
+    CME_ERROR_MT_NOT_POWERED_ON         = 524,
+    CME_ERROR_SEQUENCE_REPEAT_ERROR     = 525,
+    CME_ERROR_AT_COMMAND_ABORTED        = 526,
+    CME_ERROR_COMMAND_INTERRUPTED       = 527,
+    CME_ERROR_CONFIGURATION_CONFLICT    = 528,
+    CME_ERROR_FOTA_UPDATING             = 529,
+    CME_ERROR_SOCKET_NOT_ALLOCATED      = 530,  // no such socket
+    // plain ERROR (AT+CMEE=0) or a code that is not a number
+    CME_ERROR_UNKNOWN                   = 0xFFFF
+} cme_error_t;
+
 typedef struct {
     uint8_t urc;
     uint8_t status;
+    // location, only reported with AT+CEREG=2 while registered
+    uint16_t tac;
+    uint32_t cellId;
+    uint8_t accessTech;
 } cereg_t;
 
 typedef struct {
@@ -136,6 +369,27 @@ typedef struct {
     uint16_t rtt;
 } ping_response_t;
 
+typedef struct {
+    uint8_t mode;
+    uint32_t periodicTau;  // seconds
+    uint32_t activeTime;   // seconds
+} cpsms_t;
+
+// AT+NUESTATS, powers in 0.1 dBm and ratios in 0.1 dB
+typedef struct {
+    int16_t signalPower;  // RSRP
+    int16_t totalPower;   // RSSI
+    int16_t txPower;      // BC95_NUESTATS_TX_POWER_NONE before the first uplink
+    uint32_t txTime;      // ms since boot
+    uint32_t rxTime;      // ms since boot
+    uint32_t cellId;
+    uint8_t ecl;          // coverage enhancement level 0..2
+    int16_t snr;
+    uint32_t earfcn;
+    uint16_t pci;
+    int16_t rsrq;         // 0 when the firmware doesn't report it
+} nuestats_t;
+
 typedef struct {
     uint8_t socket;
     uint8_t *dataBuf;
@@ -144,26 +398,382 @@ typedef struct {
     uint16_t remotePort;
 } udp_rx_data_t;
 
-class Modem {
+typedef struct {
+    const char *command;  // e.g. "AT+CMEE=0"
+    char *rspBuf;         // optional, receives the first data line
+    size_t rspBufLen;
+    int rspType;          // BC95_RESPONSE_TYPE_*, set by sendCommandBatch()
+} batch_command_t;
+
+// a queued datagram handed back by BC95::Modem::completedDatagram(), the
+// pointers are valid during the callback only
+typedef struct {
+    uint8_t socket;          // the cid of AT+CSODCP
+    const char *remoteHost;  // NULL for AT+CSODCP
+    uint16_t remotePort;
+    uint16_t flag;           // BC95_NSOST_FLAG_*, the RAI of AT+CSODCP
+    uint8_t sequence;
+    const uint8_t *dataBuf;
+    size_t dataLen;
+} async_datagram_t;
+
+#ifdef BC95_COMMAND_STATS
+// from the first byte written to the final result
+typedef struct {
+    uint32_t count;
+    uint32_t failures;     // ERROR or no final result
+    uint32_t totalMillis;
+    uint32_t maxMillis;
+    uint32_t txBytes;
+    uint32_t rxBytes;      // while the command was in flight, URCs included
+    uint16_t histogram[BC95_STATS_HISTOGRAM_LEN];  // saturates
+} command_stats_t;
+
+typedef struct {
+    command_stats_t commands[BC95_STATS_CLASS_COUNT];
+    uint32_t idleRxBytes;  // read with no command in flight, i.e. URCs
+    uint32_t datagramsReceived;
+} modem_stats_t;
+#endif
+
+// rspType is one of BC95_RESPONSE_TYPE_*, rspBuf holds the first data line
+// (or the +CME ERROR code) and is only valid during the call
+typedef void (*command_callback_t)(int rspType, const char *rspBuf, size_t rspLen, void *arg);
+// rsp->dataLen is zero when nothing was received or the command failed
+typedef void (*udp_rx_callback_t)(udp_rx_data_t *rsp, void *arg);
+// line is the whole unsolicited result code, e.g. "+CEREG:1", only valid during the call
+typedef void (*urc_handler_t)(const char *line, size_t lineLen, void *arg);
+// rsp is only filled in when success is true
+typedef void (*ping_callback_t)(bool success, ping_response_t *rsp, void *arg);
+// status is one of BC95_DELIVERY_*, never BC95_DELIVERY_PENDING
+typedef void (*delivery_callback_t)(uint8_t socket, uint8_t sequence, uint8_t status, void *arg);
+
+template<typename TStream>
+class BasicModem {
     private:
         enum class ParserState {
             StartCR,
             StartLF,
             Payload,
-            StopLF
+            StopLF,
+            Discard
         };
 
-        Stream *_stream;
+        enum class AsyncState {
+            Idle,
+            Write,
+            WaitResponse
+        };
 
-        size_t _sendUDPDatagram(uint8_t socket, const char *remoteHost, uint16_t remotePort, uint16_t flag, const uint8_t *dataBuf, size_t dataLen);
+        // <socket>,<ip_addr>,<port>,<length>,<data>,<remaining_length>,
+        // +CRTDCP starts at Cid: <cid>,<length>,<data>
+        enum class NSORFField {
+            Cid,
+            Socket,
+            RemoteAddr,
+            RemotePort,
+            Length,
+            Data,
+            Remaining,
+            Invalid
+        };
+
+        typedef struct {
+            char command[BC95_ASYNC_COMMAND_BUF_LEN];
+            uint8_t data[BC95_ASYNC_DATA_BUF_LEN];
+            size_t dataLen;
+            bool nsorf;
+            // AT+NUESTATS, every data line is parsed into it
+            nuestats_t *nuestats;
+            // AT+NSOST(F), the header is formatted when the command is written
+            bool nsost;
+            uint8_t socket;
+            char remoteHost[16];
+            uint16_t remotePort;
+            uint16_t flag;
+            // tracked by +NSOSTR when not 0
+            uint8_t sequence;
+            // written after the hex data, e.g. ",<RAI>" of AT+CSODCP
+            char trailer[5];
+            unsigned long timeout;
+            command_callback_t callback;
+            void *arg;
+        } async_command_t;
+
+        typedef struct {
+            bool active;
+            bool served;  // from the inline buffer, completed by poll()
+            uint8_t socket;
+            uint8_t *dataBuf;
+            size_t dataBufLen;
+            size_t readLen;
+            udp_rx_data_t *rsp;
+            udp_rx_callback_t callback;
+            void *arg;
+        } async_rx_t;
+
+        typedef struct {
+            bool armed;
+            bool done;
+            NSORFField field;
+            uint32_t value;
+            uint8_t addrLen;
+            bool hasNibble;
+            uint8_t nibble;
+            size_t length;
+            size_t decoded;
+            size_t remaining;
+            udp_rx_data_t *rsp;
+            uint8_t *dataBuf;
+            size_t dataBufLen;
+        } nsorf_parser_t;
+
+        typedef struct {
+            uint8_t status;      // BC95_PING_STATUS_*
+            bool sent;           // OK received, the URC is due within timeout
+            bool done;           // the callback is still to be called
+            unsigned long sentMillis;
+            unsigned long timeout;
+            ping_response_t *rsp;
+            ping_callback_t callback;
+            void *arg;
+        } async_ping_t;
+
+        typedef struct {
+            const char *prefix;
+            size_t prefixLen;
+            urc_handler_t handler;
+            void *arg;
+        } urc_entry_t;
+
+        typedef struct {
+            uint8_t socket;
+            uint8_t sequence;  // 0 for a free slot
+            uint8_t status;    // BC95_DELIVERY_*
+            bool reported;     // the final status has been passed to the callback
+        } tracked_datagram_t;
+
+        // record header in _inlineRxBuf, the data follows
+        typedef struct {
+            uint8_t socket;
+            uint16_t remotePort;
+            uint16_t dataLen;
+            char remoteAddr[16];
+        } inline_rx_header_t;
+
+        TStream *_stream;
+
+        // response framer, runs continuously across commands
+        ParserState _rxState;
+        size_t _rxLen;
+        bool _rxStreamed;
+        bool _rxInline;  // the line is an inline +NSONMI going to _nsonmi
+        bool _rxControlPlane;  // ... or a +CRTDCP, also decoded by _nsonmi
+        char _rxLineBuf[BC95_RX_LINE_BUF_LEN];
+
+        // framed lines that are not URCs, [length][payload] records,
+        // a zero length record is an NSORF line streamed to _nsorf
+        uint8_t _rxRing[BC95_RX_RING_LEN];
+        size_t _rxRingHead;
+        size_t _rxRingCount;
+
+        // "+NAME" of the command(s) in flight, their "+NAME:" lines are
+        // responses even when a URC handler is registered for them
+        char _rxCommandName[BC95_COMMAND_NAMES_LEN];
+
+        urc_entry_t _urcHandlers[BC95_MAX_URC_HANDLERS];
+
+        // set by the REBOOT_* URC
+        bool _rebooted;
+
+        // final result of the latest command
+        cme_error_t _lastError;
+
+        // BC95_PSM_STATUS_*, updated by +NPSMR
+        uint8_t _psmStatus;
+
+        // modem state cache, see enableStateReporting()
+        struct {
+            bool valid;        // +CEREG/+CSCON URCs are enabled
+            cereg_t cereg;
+            cscon_t cscon;
+            bool addrValid;    // until the registration changes
+            pdp_addr_t addr;
+            char imei[16];     // empty until read
+            char imsi[16];
+        } _state;
+
+        // NSORF response decoder, fed by the framer
+        nsorf_parser_t _nsorf;
+
+        // BC95_CAP_* and the APPLICATION revision from AT+CGMR
+        uint8_t _caps;
+        char _fwRevision[BC95_FW_REVISION_LEN];
+        // AT+NSONMI=2 is in effect
+        bool _inlineRx;
+
+      #ifdef BC95_INLINE_RX_BUF_LEN
+        // inline +NSONMI datagrams in arrival order, [header][data] records
+        uint8_t _inlineRxBuf[BC95_INLINE_RX_BUF_LEN];
+        size_t _inlineRxLen;
+        nsorf_parser_t _nsonmi;
+        udp_rx_data_t _nsonmiRsp;
+      #endif
+
+        // asynchronous command engine
+        AsyncState _asyncState;
+        async_command_t _asyncQueue[BC95_ASYNC_QUEUE_LEN];
+        uint8_t _asyncHead;
+        uint8_t _asyncCount;
+        size_t _asyncTxPos;
+        bool _asyncTxSpaceKnown;
+        unsigned long _asyncLastActivityMillis;
+        char _asyncRspBuf[BC95_ASYNC_RSP_BUF_LEN];
+        size_t _asyncRspLen;
+        bool _asyncHasData;
+        // the slot of the command just completed is still intact
+        bool _asyncRetryable;
+        // set by completedDatagram() while the callback of the completed command runs
+        bool _asyncRetried;
+        async_rx_t _asyncRx;
+        async_ping_t _ping;
+
+        // bytes announced by +NSONMI and not yet read, per socket
+        size_t _pendingRxLen[BC95_MAX_SOCKETS];
+
+        // datagrams sent with a sequence number, slots reused round robin
+        tracked_datagram_t _tracked[BC95_MAX_TRACKED_DATAGRAMS];
+        uint8_t _trackedNext;
+        uint8_t _lastSequence;
+        delivery_callback_t _deliveryCallback;
+        void *_deliveryArg;
+
+      #ifdef BC95_COMMAND_STATS
+        modem_stats_t _stats;
+        int8_t _statsClass;  // of the command in flight, -1 when none
+        unsigned long _statsStartMicros;
+
+        void _statsBegin(const char *command);
+        void _statsEnd(bool success);
+        void _statsTx(size_t len);
+      #endif
+
+        int _streamAvailable();
+        int _streamRead();
+        int _streamAvailableForWrite();
+        size_t _streamWrite(uint8_t b);
+        size_t _streamWrite(const uint8_t *buf, size_t len);
+        void _streamFlush();
+
+        bool _frameByte(uint8_t b, char *rspBuf, size_t rspBufLen);
+        int _classifyResponse(char *rspBuf, size_t *rspLen);
+        bool _pumpRx();
+        void _dispatchLine(const char *line, size_t lineLen);
+        bool _handleURC(const char *line, size_t lineLen);
+        bool _pushLine(const char *line, size_t lineLen);
+        bool _popLine(char *buf, size_t bufLen, size_t *lineLen);
+        void _flushLines();
+        void _beginCommand(const char *command);
+        void _asyncReadURCs();
+        void _updatePendingRxLen(uint8_t socket, size_t readLen);
+
+        async_command_t *_asyncReserve();
+        void _asyncFormatNSOST(async_command_t *cmd);
+        void _asyncTransmit();
+        void _asyncReceive();
+        void _asyncComplete(int rspType, const char *rspBuf, size_t rspLen);
+        void _drainAsync();
+
+        void _nsorfArm(nsorf_parser_t *parser, udp_rx_data_t *rsp, uint8_t *dataBuf, size_t dataBufLen);
+        void _nsorfFeed(nsorf_parser_t *parser, uint8_t b);
+        void _nsorfEnd();
+        void _nsonmiArm();
+        void _nsonmiEnd();
+        void _crtdcpEnd();
+        bool _inlineRxTake(uint8_t socket, uint8_t *dataBuf, size_t dataBufLen, udp_rx_data_t *rsp);
+        size_t _inlineRxPending(uint8_t socket);
+        void _inlineRxDrop(uint8_t socket);
+        size_t _nsorfRequestLen(size_t hint, size_t space);
+        bool _submitNSORF(size_t reqLen);
+        static void _onAsyncNSORF(int rspType, const char *rspBuf, size_t rspLen, void *arg);
+
+        uint8_t _trackDatagram(uint8_t socket);
+        tracked_datagram_t *_findTracked(uint8_t socket, uint8_t sequence);
+        void _deliveryEnd(uint8_t socket, uint8_t sequence, uint8_t status);
+        void _deliveryTask();
+
+        void _pingURC(const char *line);
+        void _pingEnd(bool success);
+        void _pingTask();
+        static void _onAsyncNPING(int rspType, const char *rspBuf, size_t rspLen, void *arg);
+
+        bool _queryNetworkRegistrationStatus(cereg_t *rsp);
+        bool _queryRadioConnectionStatus(cscon_t *rsp);
+        bool _isResponseName(const char *line);
+        int _runCommandLine(const char *line, batch_command_t commands[], uint8_t count, unsigned long timeout);
+        void _writeHexCommand(char *txBuf, size_t txLen, size_t txBufLen, const uint8_t *dataBuf, size_t dataLen, const char *trailer);
+        size_t _sendUDPDatagram(uint8_t socket, const char *remoteHost, uint16_t remotePort, uint16_t flag, const uint8_t *dataBuf, size_t dataLen, uint8_t *sequence);
     
     public:
-        Modem(Stream *stream);
+        BasicModem(TStream *stream);
 
         void writeCommand(const char *command);
         int readResponse(char *rspBuf, size_t rspBufLen, size_t *rspLen = NULL, unsigned long timeout = BC95_DEFAULT_READ_RESPONSE_TIMEOUT);
         bool readSimpleDataResponse(char *rspBuf, size_t rspBufLen, size_t *rspLen = NULL, unsigned long timeout = BC95_DEFAULT_READ_RESPONSE_TIMEOUT);
         bool waitForOK(unsigned long timeout = BC95_DEFAULT_READ_RESPONSE_TIMEOUT);
+        // drops everything received so far, e.g. after the UART was reconfigured
+        void discardInput();
+        // Why the latest command failed, CME_ERROR_NONE after OK. Only
+        // ERROR-type results set it, a timeout leaves CME_ERROR_NONE. Command
+        // callbacks see the code of their own command.
+        cme_error_t lastError();
+        // "+CME ERROR: <code>" with the prefix already stripped, or "ERROR"
+        static cme_error_t parseError(const char *rspBuf);
+
+      #ifdef BC95_COMMAND_STATS
+        // NSORF round trips per downlink are
+        // commands[BC95_STATS_CLASS_NSORF].count / datagramsReceived
+        void readStats(modem_stats_t *stats);
+        void resetStats();
+      #endif
+
+        // Sends the commands joined with ';' on as few lines as possible, e.g.
+        // "AT+CMEE=0;+NCONFIG=AUTOCONNECT,TRUE". A line that fails is sent again
+        // one command at a time so each gets its own result, the commands must
+        // be safe to repeat. Only extended (AT+) commands are joined. Returns
+        // true when all of them succeeded.
+        bool sendCommandBatch(batch_command_t commands[], uint8_t count, unsigned long timeout = BC95_DEFAULT_READ_RESPONSE_TIMEOUT);
+
+        // Asynchronous commands, queued and driven by poll(). The synchronous
+        // methods below first wait for the queue to drain, so both styles can
+        // be mixed. Callbacks run from poll() and may queue further commands.
+        // Nothing is queued and false returned while the queue is full, the
+        // caller tries again after a later poll().
+        bool sendCommandAsync(const char *command, command_callback_t callback = NULL, void *arg = NULL, unsigned long timeout = BC95_DEFAULT_READ_RESPONSE_TIMEOUT);
+        // A release assistance flag is dropped while another datagram for the
+        // same socket is queued behind it, the connection is still needed.
+        // sequence as for sendUDPDatagram(). A datagram sent again after
+        // completedDatagram() keeps its sequence when it is passed in.
+        bool sendUDPDatagramAsync(uint8_t socket, const char *remoteHost, uint16_t remotePort, const uint8_t *dataBuf, size_t dataLen, command_callback_t callback = NULL, void *arg = NULL, uint16_t flag = BC95_NSOST_FLAG_NONE, uint8_t *sequence = NULL);
+        bool receiveUDPDatagramAsync(uint8_t socket, uint8_t *dataBuf, size_t dataBufLen, udp_rx_data_t *rsp, udp_rx_callback_t callback, void *arg = NULL);
+        // rsp is filled in as the lines arrive, complete once the callback gets OK
+        bool readUEStatisticsAsync(nuestats_t *rsp, command_callback_t callback, void *arg = NULL);
+        // Only from the callback of a failed AT+NSOST or AT+CSODCP and before
+        // anything else is queued: hands the datagram back so that it can be
+        // sent again later. Its delivery stays pending meanwhile.
+        bool completedDatagram(async_datagram_t *dgram);
+        void cancelAsync();
+        bool isIdle();
+        bool isAsyncQueueFull();
+        // continuously call this method in loop()
+        void poll();
+
+        // Unsolicited result codes starting with prefix (e.g. "+CEREG:") are
+        // passed to handler from whichever call reads the stream, instead of
+        // being taken for a command response. prefix is not copied. A NULL
+        // handler removes it.
+        // +NSONMI and REBOOT_* are also tracked by the driver itself.
+        bool setURCHandler(const char *prefix, urc_handler_t handler, void *arg = NULL);
 
         // AT
         bool pingModem();
@@ -180,6 +790,13 @@ class Modem {
         bool readRevisionIdentification(char *rspBuf, size_t rspBufLen);
         // AT+CGSN=1 (IMEI)
         bool readInternationalMobileStationEquipmentIdentity(char *rspBuf, size_t rspBufLen);
+        // AT+CEREG=2 and AT+CSCON=1 - Registration, cell and radio connection
+        // state are then tracked from URCs, the read methods below answer from
+        // memory without a command until the modem reboots. The IP address is
+        // cached until the registration changes, the IMEI for good and the IMSI
+        // until a reboot.
+        bool enableStateReporting();
+        bool isStateReported();
         // AT+CEREG?
         bool readNetworkRegistrationStatus(cereg_t *rsp);
         uint8_t readNetworkRegistrationStatus();
@@ -204,16 +821,22 @@ class Modem {
         bool readInternationalMobileSubscriberIdentity(char *rspBuf, size_t rspBufLen);
         // AT+CGDCONT?
         uint8_t readPDNConnectionInfo(pdn_info_t rsp[], uint8_t rspMaxLen);
+        // cid of the first context of type NONIP, -1 without one
+        int16_t readNonIPContextId();
         // AT+CFUN
         bool setPhoneFunctionality(uint8_t level, unsigned long timeout = BC95_DEFAULT_CFUN_RESPONSE_TIMEOUT);
         // AT+CMEE=<n>
         bool setErrorResponseFormat(uint8_t n);
         // AT+CCLK
         // ----- Not Implemented -----
-        // AT+CPSMS
-        // ----- Not Implemented -----
-        // AT+CEDRXS
-        // ----- Not Implemented -----
+        // AT+CPSMS=<mode>[,,,<Requested_Periodic-TAU>,<Requested_Active-Time>] - Power saving mode
+        // Timers are in seconds, rounded up to the next value the network can be asked for.
+        bool setPowerSavingMode(bool enabled);
+        bool setPowerSavingMode(bool enabled, uint32_t periodicTau, uint32_t activeTime);
+        bool readPowerSavingMode(cpsms_t *rsp);  // AT+CPSMS?
+        // AT+CEDRXS=<mode>,5,<Requested_eDRX_value> - eDRX, edrxCycle is one of BC95_EDRX_CYCLE_*
+        bool setExtendedDRX(bool enabled, uint8_t edrxCycle = BC95_EDRX_CYCLE_20_48_S);
+        bool readExtendedDRX(uint8_t *edrxCycle);  // AT+CEDRXS?
         // AT+CEER
         // ----- Not Implemented -----
         // AT+CEDRXRDP
@@ -235,52 +858,104 @@ class Modem {
         // ----- Not Implemented -----
         // AT+CMGC
         // ----- Not Implemented -----
-        // AT+CSODCP
-        // ----- Not Implemented -----
-        // AT+CRTDCP
-        // ----- Not Implemented -----
+        // AT+CSODCP=<cid>,<cpdata_length>,<cpdata>[,<RAI>] - Send non-IP data over the control plane
+        // rai is one of BC95_CSODCP_RAI_*. The PDN context cid must be of type NONIP.
+        bool sendControlPlaneData(uint8_t cid, const uint8_t *dataBuf, size_t dataLen, uint8_t rai = BC95_CSODCP_RAI_NONE);
+        bool sendControlPlaneDataAsync(uint8_t cid, const uint8_t *dataBuf, size_t dataLen, command_callback_t callback = NULL, void *arg = NULL, uint8_t rai = BC95_CSODCP_RAI_NONE);
+        // AT+CRTDCP=<reporting> - +CRTDCP:<cid>,<cpdata_length>,<cpdata>
+        // Downlink data is kept in the inline buffer until read, without
+        // BC95_INLINE_RX_BUF_LEN reporting can't be enabled.
+        bool setControlPlaneDataReporting(bool enabled);
+        // oldest +CRTDCP data, 0 when there is none, the rest of data larger
+        // than dataBuf is dropped
+        size_t receiveControlPlaneData(uint8_t *dataBuf, size_t dataBufLen, uint8_t *cid = NULL);
+        size_t pendingControlPlaneDataLength();
         
+        // AT+CGMR, AT+NSOSTF=? and AT+NSONMI=? - Firmware features
+        // Switches to inline +NSONMI (no AT+NSORF round trip) when the firmware
+        // and BC95_INLINE_RX_BUF_LEN allow it. Flags are dropped from datagrams
+        // when AT+NSOSTF is missing. Run it again after a reboot.
+        bool probeCapabilities();
+        uint8_t capabilities();
+        // APPLICATION revision, e.g. "V100R100C10B656", empty until probed
+        const char *firmwareRevision();
         // AT+NRB - Reboot the modem
         bool reboot(bool waitUntilFinished = true);
-        // AT+NUESTATS
-        // ----- Not Implemented -----
-        // AT+NEARFCN
-        // ----- Not Implemented -----
+        // AT+NUESTATS - Radio statistics of the serving cell
+        bool readUEStatistics(nuestats_t *rsp);
+        // AT+NEARFCN=0,<earfcn>[,<pci>] - Search only this EARFCN (and cell),
+        // set with the radio off (AT+CFUN=0). Lost when the modem reboots.
+        bool setEARFCNLock(uint32_t earfcn, uint16_t pci = BC95_NEARFCN_PCI_ANY);
+        bool clearEARFCNLock();  // AT+NEARFCN=0,0
+        // LTE band of a downlink EARFCN, 0 for one outside the NB-IoT bands
+        static uint8_t bandOfEARFCN(uint32_t earfcn);
         // AT+NSOCR=<type>,<protocol>,<listen port>[,<receive control>] - Create a socket
         // For BC95, only type=DGRAM and protocol=17 are supported.
         int8_t createSocket(uint16_t port, bool recvMsg = true);
         // AT+NSOST=<socket>,<remote_addr>,<remote_port>,<length>,<data> - Send UDP datagram
         // AT+NSOSTF=<socket>,<remote_addr>,<remote_port>,<flag>,<length>,<data> - Send UDP datagram with flags
         size_t sendUDPDatagram(uint8_t socket, const char *remoteHost, uint16_t remotePort, const char *msg);
-        size_t sendUDPDatagram(uint8_t socket, const char *remoteHost, uint16_t remotePort, const uint8_t *dataBuf, size_t dataLen);
+        // With a sequence pointer and BC95_CAP_NSOSTR the datagram is numbered
+        // (AT+NSOSTF=...,<sequence>) and its delivery tracked, *sequence is
+        // 0 when it is not.
+        size_t sendUDPDatagram(uint8_t socket, const char *remoteHost, uint16_t remotePort, const uint8_t *dataBuf, size_t dataLen, uint16_t flag = BC95_NSOST_FLAG_NONE, uint8_t *sequence = NULL);
+        // +NSOSTR:<socket>,<sequence>,<status> - Where a numbered datagram is,
+        // BC95_DELIVERY_UNKNOWN once BC95_MAX_TRACKED_DATAGRAMS newer ones were sent
+        uint8_t deliveryStatus(uint8_t socket, uint8_t sequence);
+        // callback runs from poll() when a numbered datagram was sent or failed
+        void setDeliveryCallback(delivery_callback_t callback, void *arg = NULL);
+        // AT+NQSOS=<socket> - Sequence numbers the modem has not reported yet,
+        // returns their count or -1. Tracked datagrams of the socket that are
+        // not among them lost their +NSOSTR and become BC95_DELIVERY_UNKNOWN.
+        int8_t readPendingDeliveries(uint8_t socket, uint8_t *sequences = NULL, uint8_t maxCount = 0);
         // AT+NSORF=<socket>,<req_length> - Receive UDP datagram
         size_t receiveUDPDatagram(uint8_t socket, uint8_t *dataBuf, size_t dataBufLen, udp_rx_data_t *rsp);
         // AT+NSOCL=<socket> - Close a socket
         bool closeSocket(uint8_t socket);
-        // +NSONMI
-        // ----- Not Implemented -----
-        // AT+NPING=<ip>,<p_size>,<timeout>
+        // +NSONMI:<socket>,<length> - consumed by every read from the stream
+        size_t pendingUDPDataLength(uint8_t socket);
+        // AT+NPING=<ip>,<p_size>,<timeout> - blocks until +NPING/+NPINGERR
         bool pingHost(const char *ipAddressStr, ping_response_t *rsp, unsigned long timeout = BC95_DEFAULT_PING_TIMEOUT);
-        // AT+NBAND
-        // ----- Not Implemented -----
+        // Returns once the command is queued, the result comes with the
+        // +NPING/+NPINGERR URC. callback then runs from poll() and
+        // pingStatus() tells success or failure until the next ping. One ping
+        // at a time, rsp must stay valid until it is done.
+        bool pingHostAsync(const char *ipAddressStr, ping_response_t *rsp, ping_callback_t callback = NULL, void *arg = NULL, unsigned long timeout = BC95_DEFAULT_PING_TIMEOUT);
+        uint8_t pingStatus();
+        // AT+NBAND=<n>[,<n>...] - Bands to search, stored in NVRAM
+        bool setBands(const uint8_t *bands, uint8_t count);
+        // AT+NBAND? - Returns the number of bands written to bands
+        uint8_t readBands(uint8_t *bands, uint8_t maxCount);
         // AT+NLOGLEVEL
         // ----- Not Implemented -----
-        // AT+NCONFIG
+        // AT+NCONFIG - stored in NVRAM, read it first to avoid needless writes
         bool configAutoConnect(bool enabled);
-        // AT+NATSPEED
-        // ----- Not Implemented -----
+        bool readAutoConnect(bool *enabled);  // AT+NCONFIG?
+        // AT+NATSPEED=<baud_rate>,<timeout>,<store>,<sync_mode> - Change the UART baud rate
+        // OK comes at the current rate, the caller then switches its UART and
+        // must send a command (e.g. AT) within timeout seconds, or the modem
+        // returns to the previous rate. store keeps the rate across reboots.
+        bool setUARTBaudRate(uint32_t baudRate, uint8_t timeout = BC95_DEFAULT_NATSPEED_TIMEOUT, bool store = true);
+        // AT+NATSPEED?
+        bool readUARTBaudRate(uint32_t *baudRate);
         // AT+NCCID
         // ----- Not Implemented -----
         // AT+NFWUPD
         // ----- Not Implemented -----
         // AT+NPOWERCLASS
         // ----- Not Implemented -----
-        // AT+NPSMR
-        // ----- Not Implemented -----
+        // AT+NPSMR=<n> - Power saving mode status report, +NPSMR:<mode>
+        bool setPowerSavingStatusReporting(bool enabled);
+        bool readPowerSavingStatus(uint8_t *status);  // AT+NPSMR?
+        // last status reported by +NPSMR, BC95_PSM_STATUS_UNKNOWN until the first report
+        uint8_t powerSavingStatus();
         // AT+NPTWEDRXS
         // ----- Not Implemented -----
 };
 
+// compiled in quectel_bc95.cpp for Stream and BC95_MODEM_STREAM_TYPE only
+typedef BasicModem<Stream> Modem;
+
 }  // namespace QuectelBC95
 
 #endif /* QUECTEL_BC95_H */
\ No newline at end of file
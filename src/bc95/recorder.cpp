@@ -0,0 +1,118 @@
+/**
+ * Modem traffic recorder for the Quectel BC95 driver.
+ *
+ * Copyright (c) 2018 Sparkbit Co., Ltd. All rights reserved.
+ *
+ * This work is licensed under the terms of the MIT license.
+ * See LICENSE file in the project root for details.
+ */
+
+#include "recorder.h"
+
+QuectelBC95::StreamRecorder::StreamRecorder(Stream *stream) {
+    _stream = stream;
+    _log = NULL;
+    _len = 0;
+    _rx = false;
+    _recordMicros = 0;
+    _lastMicros = 0;
+}
+
+void QuectelBC95::StreamRecorder::setLog(Print *log) {
+    flushLog();
+
+    _log = log;
+    _lastMicros = micros();
+
+    if (_log != NULL) {
+        _log->write((const uint8_t *)"BC95", 4);
+        _log->write((uint8_t)BC95_RECORDER_VERSION);
+    }
+}
+
+void QuectelBC95::StreamRecorder::flushLog() {
+    if (_log == NULL || _len == 0) {
+        _len = 0;
+        return;
+    }
+
+    uint8_t header[6];
+    size_t headerLen = 0;
+    unsigned long delta = _recordMicros - _lastMicros;
+
+    header[headerLen++] = (_rx ? BC95_RECORDER_TAG_RX : 0) | (_len - 1);
+
+    // LEB128, 5 bytes hold any 32-bit delta
+    do {
+        uint8_t b = delta & 0x7F;
+        delta >>= 7;
+        header[headerLen++] = (delta > 0) ? (b | 0x80) : b;
+    } while (delta > 0);
+
+    _log->write(header, headerLen);
+    _log->write(_buf, _len);
+
+    _lastMicros = _recordMicros;
+    _len = 0;
+}
+
+void QuectelBC95::StreamRecorder::_record(bool rx, const uint8_t *data, size_t len) {
+    if (_log == NULL) {
+        return;
+    }
+
+    unsigned long now = micros();
+
+    for (size_t i = 0 ; i < len ; i++) {
+        if (_len > 0 && (rx != _rx || _len >= sizeof(_buf) || now - _recordMicros > BC95_RECORDER_MERGE_MICROS)) {
+            flushLog();
+        }
+
+        _rx = rx;
+        _recordMicros = now;
+        _buf[_len++] = data[i];
+    }
+}
+
+int QuectelBC95::StreamRecorder::available() {
+    return _stream->available();
+}
+
+int QuectelBC95::StreamRecorder::read() {
+    int b = _stream->read();
+
+    if (b >= 0) {
+        uint8_t c = b;
+        _record(true, &c, 1);
+    }
+
+    return b;
+}
+
+int QuectelBC95::StreamRecorder::peek() {
+    return _stream->peek();
+}
+
+int QuectelBC95::StreamRecorder::availableForWrite() {
+    return _stream->availableForWrite();
+}
+
+size_t QuectelBC95::StreamRecorder::write(uint8_t b) {
+    size_t written = _stream->write(b);
+
+    _record(false, &b, written);
+
+    return written;
+}
+
+size_t QuectelBC95::StreamRecorder::write(const uint8_t *buffer, size_t size) {
+    size_t written = _stream->write(buffer, size);
+
+    _record(false, buffer, written);
+
+    return written;
+}
+
+void QuectelBC95::StreamRecorder::flush() {
+    _stream->flush();
+}
@@ -0,0 +1,88 @@
+/**
+ * Modem traffic recorder for the Quectel BC95 driver.
+ *
+ * StreamRecorder sits between QuectelBC95::Modem and the UART and copies
+ * every byte in both directions to a log (an SD card File, a flash writer,
+ * a host file, ...), e.g.
+ *
+ *     QuectelBC95::StreamRecorder tap(&Serial1);
+ *     QuectelBC95::Modem modem(&tap);
+ *
+ *     tap.setLog(&logFile);
+ *
+ * Log format, all sessions start with a header:
+ *   "BC95" <version>
+ * followed by records:
+ *   <tag> <delta> <payload>
+ *   tag      bit 7 set for modem -> host, bits 0-6 payload length - 1
+ *   delta    microseconds from the last payload byte of the previous record
+ *            (or the header) to its own last byte, unsigned LEB128
+ *   payload  the bytes as they passed
+ *
+ * Bytes in the same direction are merged into one record while each
+ * follows the previous one within BC95_RECORDER_MERGE_MICROS, a replay
+ * releases a record once all of it had passed. extras/host replays such
+ * logs.
+ *
+ * Copyright (c) 2018 Sparkbit Co., Ltd. All rights reserved.
+ *
+ * This work is licensed under the terms of the MIT license.
+ * See LICENSE file in the project root for details.
+ */
+
+#ifndef QUECTEL_BC95_RECORDER_H
+#define QUECTEL_BC95_RECORDER_H
+
+#include <Arduino.h>
+
+#define BC95_RECORDER_VERSION  1
+
+// longest record payload, at most 128
+#define BC95_RECORDER_RECORD_LEN  64
+
+// longest gap between merged bytes, a byte at 9600 baud takes ~1 ms
+#define BC95_RECORDER_MERGE_MICROS  2000
+
+#define BC95_RECORDER_TAG_RX  0x80
+
+namespace QuectelBC95 {
+
+class StreamRecorder : public Stream {
+    public:
+        StreamRecorder(Stream *stream);
+
+        // starts a session in log, NULL stops recording, the stream works
+        // the same either way
+        void setLog(Print *log);
+        // writes the record being merged, e.g. before the log file is closed
+        void flushLog();
+
+        // Stream
+        int available();
+        int read();
+        int peek();
+        int availableForWrite();
+        size_t write(uint8_t b);
+        size_t write(const uint8_t *buffer, size_t size);
+        using Print::write;
+        void flush();
+
+    private:
+        Stream *_stream;
+        Print *_log;
+
+        // record being merged
+        uint8_t _buf[BC95_RECORDER_RECORD_LEN];
+        uint8_t _len;
+        bool _rx;
+        // time of its last byte
+        unsigned long _recordMicros;
+        // time of the last record written
+        unsigned long _lastMicros;
+
+        void _record(bool rx, const uint8_t *data, size_t len);
+};
+
+}  // namespace QuectelBC95
+
+#endif /* QUECTEL_BC95_RECORDER_H */
@@ -448,6 +448,13 @@ void _tpNetworkConnectivityTaskTick();
 
 void tpTaskTick() {
     netTaskTick();
+
+    // observe renewals and pings would only wake the radio up, the platform
+    // cannot reach the thing until its next uplink anyway
+    if (netIsDownlinkReachable() != true) {
+        return;
+    }
+
     _tpObservationTaskTick();
     _tpNetworkConnectivityTaskTick();
 }
@@ -480,9 +487,12 @@ static const uint32_t NETCONN_TASK_INTERVALS[] = TP_NETWORK_CONNECTIVITY_CHECK_I
 static const uint8_t NETCONN_TASK_MAX_FAILURE = sizeof(NETCONN_TASK_INTERVALS) / sizeof(uint32_t);
 static uint8_t netConnTaskIntervalIdx = 0;
 static unsigned long lastNetConnCheckingTaskMillis;
+static bool netConnCheckInProgress = false;
+
+void _tpOnNetworkConnectivityChecked(bool success);
 
 void _tpNetworkConnectivityTaskTick() {
-    if (labs(millis() - lastNetConnCheckingTaskMillis) < NETCONN_TASK_INTERVALS[netConnTaskIntervalIdx]) {
+    if (netConnCheckInProgress || labs(millis() - lastNetConnCheckingTaskMillis) < NETCONN_TASK_INTERVALS[netConnTaskIntervalIdx]) {
         return;
     }
 
@@ -490,7 +500,19 @@ void _tpNetworkConnectivityTaskTick() {
     dbg.println("Checking network connectivity...");
   #endif
 
-    if (netSendCoAPPing(platformIPAddrStr, platformPort, TP_NETWORK_CONNECTIVITY_PING_TIMEOUT) != true) {
+    // the result arrives from netTaskTick()
+    if (netStartCoAPPing(platformIPAddrStr, platformPort, TP_NETWORK_CONNECTIVITY_PING_TIMEOUT, _tpOnNetworkConnectivityChecked) == true) {
+        netConnCheckInProgress = true;
+    }
+    else {
+        _tpOnNetworkConnectivityChecked(false);
+    }
+}
+
+void _tpOnNetworkConnectivityChecked(bool success) {
+    netConnCheckInProgress = false;
+
+    if (success != true) {
         // move to next interval
         netConnTaskIntervalIdx++;
 